@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <CL/cl_platform.h>
+
+#include <BVH/bvh.h>
+#include <Model/model_loader.h>
+
+namespace CL_RAYTRACER
+{
+    // a model whose vertices are replaced by the frames of an .obj sequence with the same triangles.
+    // Every frame refits the BVH, it's rebuilt once its SAH cost has degraded past a threshold
+    class ModelAnimation
+    {
+    private:
+        std::unique_ptr<BVH> bvh;
+        // leaf order, see BVH::PermuteFaces()
+        IO::IndexedMesh mesh;
+        // the triangle of the frames behind every face of `mesh`
+        std::vector<cl_uint> order;
+        // position and normal of the three corners of every triangle, in the triangle order of the model
+        std::vector<std::vector<cl_float>> frames;
+        float fps;
+
+    public:
+        // `mesh` and `order` come from bvh->PermuteFaces() on ModelLoader::getIndexedMesh(false), the frames move the
+        // corners of a face independently of the other faces
+        ModelAnimation(std::unique_ptr<BVH> bvh, IO::IndexedMesh mesh, std::vector<cl_uint> order, float fps);
+
+        // false if the model's triangles don't match the animated one
+        bool AddFrame(const std::shared_ptr<IO::ModelLoader> &ml);
+
+        std::size_t GetFrameCount() const { return frames.size(); }
+
+        // the frame to show `time` seconds in, the sequence loops
+        std::size_t GetFrameAt(double time) const;
+
+        // moves the vertices to `frame` and refits the tree, or rebuilds it once GetDegradation() exceeds
+        // `rebuild_threshold` (0: always). True if it was rebuilt, the faces are in a new order then
+        bool SetFrame(std::size_t frame, float rebuild_threshold);
+
+        const BVH &GetBVH() const { return *bvh; }
+        const IO::IndexedMesh &GetMesh() const { return mesh; }
+    };
+} // namespace CL_RAYTRACER
@@ -21,17 +21,33 @@ using Bvh = bvh::Bvh<float>;
 namespace CL_RAYTRACER
 {
     struct cl_Mesh;
+    // links of the stackless traversal, see `split` and kernels/geometry/bvh.cl
+    constexpr unsigned char BVH_SPLIT_AXIS = 0x3;
+    constexpr unsigned char BVH_SPLIT_FLIP = 0x4;   // the second child is nearer along +axis
+    constexpr unsigned char BVH_SECOND_CHILD = 0x8; // the sibling is the previous node
+
+    // host build of the binary tree, picked with -bvh-builder
+    enum BVHBuilder
+    {
+        BVH_BUILDER_SWEEP,    // full SAH sweep, single-threaded
+        BVH_BUILDER_BINNED,   // 64 SAH bins, single-threaded
+        BVH_BUILDER_PARALLEL, // 32 SAH bins, task-parallel on every core, see include/BVH/parallel_builder.h
+    };
+
     struct cl_BVHnode
     {
         float bounds[6];
         unsigned int first_child_or_primitive;
         unsigned int primitive_count;
+        unsigned int parent;
         bool is_leaf;
+        unsigned char split;
     };
 
     namespace IO
     {
         class ModelLoader;
+        struct IndexedMesh;
     }
 } // namespace CL_RAYTRACER
 
@@ -43,15 +59,43 @@ namespace CL_RAYTRACER
         std::vector<Triangle> triangles;
         std::unique_ptr<Bvh> bvh;
         const std::shared_ptr<IO::ModelLoader> model_loader;
+        const BVHBuilder builder;
+        // SAH cost right after the last build, see GetDegradation()
+        float build_cost = 0.0f;
 
     public:
-        BVH(const std::shared_ptr<IO::ModelLoader> &ml);
+        BVH(const std::shared_ptr<IO::ModelLoader> &ml, BVHBuilder builder = BVH_BUILDER_SWEEP);
         ~BVH();
 
         void buildTree(const std::shared_ptr<IO::ModelLoader> &ml);
 
-        std::unique_ptr<std::vector<cl_ulong>> GetPrimitiveIndices() const;
+        // builds a new tree over the current triangles with the builder of the constructor, e.g. after Refit() degraded it.
+        // Call PermuteFaces() again afterwards
+        void Rebuild();
+
+        // reorders the faces into leaf order so that a leaf's primitive range indexes `mesh->faces` directly,
+        // the vertices are renumbered by first use. `mesh` has to be in the triangle order of the build.
+        // `order` receives the previous index of every face
+        void PermuteFaces(IO::IndexedMesh *mesh, std::vector<cl_uint> *order = nullptr);
+
+        // moves the triangles to the vertices of `mesh` and updates the node bounds bottom-up, the topology stays.
+        // `mesh` has to be in leaf order, see PermuteFaces()
+        void Refit(const IO::IndexedMesh &mesh);
+
+        // SAH cost of the tree relative to its root's surface area
+        float GetCost() const;
+
+        // GetCost() over the cost right after the last build, refits of moving geometry make it grow
+        float GetDegradation() const;
+
+        // the child and primitive indices are offset by where the nodes and the faces go in the shared buffers
+        std::unique_ptr<std::vector<cl_BVHnode>> PrepareData(cl_uint node_offset = 0, cl_uint primitive_offset = 0) const;
+
+        // root bounds in the cl_BVHnode layout: min x, max x, min y, max y, min z, max z
+        void GetBounds(float *bounds) const;
 
-        std::unique_ptr<std::vector<cl_BVHnode>> PrepareData() const;
+        // collapses the binary tree into `width` (4 or 8) wide nodes with quantized child bounds,
+        // see include/BVH/wide_bvh.h. Call after PermuteFaces(), leaves index the faces directly
+        std::unique_ptr<std::vector<cl_uint>> PrepareWideData(int width, cl_uint node_offset = 0, cl_uint primitive_offset = 0) const;
     };
 } // namespace CL_RAYTRACER
\ No newline at end of file
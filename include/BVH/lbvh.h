@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // work-group size of every builder kernel, keep in sync with kernels/geometry/lbvh.cl
+    constexpr std::size_t LBVH_GROUP_SIZE = 256;
+
+    // device build of a model's binary BVH with the kernels of kernels/geometry/lbvh.cl: Morton codes of the
+    // face centroids, a radix sort, Karras' hierarchy and the bounds merged bottom-up. One face per leaf
+    class LBVHBuilder
+    {
+    private:
+        cl::Kernel morton;
+        cl::Kernel radix_count;
+        cl::Kernel radix_scan;
+        cl::Kernel radix_scatter;
+        cl::Kernel hierarchy;
+        cl::Kernel leaves;
+
+        bool supported;
+
+    public:
+        LBVHBuilder(const cl::Program &program, const cl::Device &device);
+        ~LBVHBuilder();
+
+        // false if the device can't run work-groups of LBVH_GROUP_SIZE
+        bool isSupported() const { return supported; }
+
+        // writes the 2 * face_count - 1 new_bvhNodes of the faces [primitive_offset, primitive_offset + face_count)
+        // of `faces` at `root` of `nodes` and reorders those faces into leaf order. `bounds` (cl_BVHnode layout)
+        // contains the faces. An empty range enqueues nothing. The first command waits for `events`, `event` signals the last one
+        void build(const cl::CommandQueue &queue, const cl::Buffer &vertices, const cl::Buffer &faces, const cl::Buffer &nodes,
+                   cl_uint root, cl_uint primitive_offset, cl_uint face_count, const float *bounds,
+                   const std::vector<cl::Event> *events = nullptr, cl::Event *event = nullptr);
+
+        // reads a finished build back and checks it: every face of the range sits in exactly one leaf that contains its
+        // triangle, every child box lies in its parent's and the parent links match. Returns the SAH cost like
+        // BVH::GetCost(), negative for a broken tree. `positions` are the uploaded vertex positions
+        float verify(const cl::CommandQueue &queue, const std::vector<cl_float> &positions, const cl::Buffer &faces, const cl::Buffer &nodes,
+                     cl_uint root, cl_uint primitive_offset, cl_uint face_count) const;
+    };
+} // namespace CL_RAYTRACER
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+#include <BVH/bvh.h>
+
+namespace CL_RAYTRACER
+{
+    class ThreadPool;
+
+    // task-parallel binned SAH build of `bvh` over `triangles` on the workers of `pool`. Same layout as the builders of
+    // the bvh library: the root first, the two children of a node next to each other and after their parent
+    void buildParallelBinnedSah(ThreadPool &pool, Bvh &bvh, const std::vector<Triangle> &triangles);
+} // namespace CL_RAYTRACER
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <BVH/bvh.h>
+
+namespace CL_RAYTRACER
+{
+    // leaf primitive of an instance, the instance index is in the low bits
+    constexpr cl_uint TLAS_INSTANCE = 0x80000000u;
+    // depth of the deepest leaf, the root is at 0. The traversal stack of kernels/geometry/tlas.cl has as many entries
+    constexpr std::size_t TLAS_MAX_DEPTH = 32;
+
+    // a model placed in the scene, keep in sync with Instance in kernels/header.cl
+    struct cl_Instance
+    {
+        cl_float4 world_to_object[3]; // rows of the inverse 3x4 transform
+        cl_uint root;                 // root of the model's BVH in the shared node buffer
+        cl_uint pad[3];
+    };
+
+    // inverts the row-major 3x4 object to world `transform` and bounds the model's `bounds` in world space,
+    // false if the transform can't be inverted
+    bool makeInstance(const cl_float *transform, cl_uint root, const float *bounds, cl_Instance *instance, float *world_bounds);
+
+    // an object of the top-level BVH, `ref` is its mesh index or TLAS_INSTANCE | the instance index
+    struct TLASPrimitive
+    {
+        float bounds[6]; // cl_BVHnode layout
+        cl_uint ref;
+    };
+
+    // binary SAH tree over `primitives`, every leaf holds one of them in first_child_or_primitive and is at most
+    // TLAS_MAX_DEPTH levels deep. The tree is never empty, without any primitive the root is a leaf without primitives
+    std::vector<cl_BVHnode> buildTLAS(const std::vector<TLASPrimitive> &primitives);
+} // namespace CL_RAYTRACER
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <CL/cl_platform.h>
+
+namespace CL_RAYTRACER
+{
+    // keep in sync with WideBVHNode in kernels/header.cl and kernels/geometry/wide_bvh.cl
+    constexpr cl_uint WIDE_EMPTY = 0xFFFFFFFFu;
+    // leaf: count - 1 in bits 26..30, first primitive in bits 0..25
+    constexpr cl_uint WIDE_LEAF = 0x80000000u;
+    constexpr cl_uint WIDE_LEAF_SIZE = 32;
+    constexpr cl_uint WIDE_MAX_PRIMITIVES = 1u << 26;
+    // entries of the traversal stack, the collapse keeps the tree shallow enough for it
+    constexpr cl_uint WIDE_STACK_SIZE = 64;
+
+    // the child boxes are stored in the grid of the node's box: origin + q * 2^exponent
+    template <int N>
+    struct cl_WideBVHnode
+    {
+        cl_float origin[3];
+        cl_char exponent[3];
+        cl_uchar pad;
+        // internal: node index, leaf: WIDE_LEAF | count and first primitive, WIDE_EMPTY
+        cl_uint child[N];
+        cl_uchar lo[3][N];
+        cl_uchar hi[3][N];
+    };
+} // namespace CL_RAYTRACER
@@ -171,11 +171,14 @@ inline bool checkVal(
 	}
 }
 
-inline void printErrorLog(const cl::Program &program, const cl::Device &device)
+// `preprocessor` maps the log's line numbers back to the original .cl files
+inline void printErrorLog(const cl::Program &program, const cl::Device &device, const CL_RAYTRACER::KernelPreprocessor *preprocessor = nullptr)
 {
 
 	// Get the error log and print to console
 	std::string buildlog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+	if (preprocessor)
+		buildlog = preprocessor->remapLog(buildlog);
 	std::cerr << "Build log:" << std::endl
 			  << buildlog << std::endl;
 
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace CL_RAYTRACER
+{
+    /*
+     * Single pass preprocessor of the kernel sources.
+     *
+     * "#FILE:path" lines include a file relative to the main file's directory, every file
+     * is loaded and included once and include cycles are reported. "#NAME#" placeholders
+     * are substituted from one dictionary, lines with a disabled placeholder are dropped.
+     * The output keeps a source map so build logs can point back to the original files.
+     */
+    class KernelPreprocessor
+    {
+    private:
+        struct File
+        {
+            std::string name;
+            // on the include stack
+            bool open;
+        };
+
+        // first output line of a run of consecutive lines of one file
+        struct Segment
+        {
+            std::size_t line;
+            std::size_t file;
+            std::size_t file_line;
+        };
+
+        // placeholder name -> value, disabled placeholders aren't in `values`
+        std::unordered_map<std::string, std::string> values;
+        std::unordered_set<std::string> disabled;
+        std::unordered_set<std::string> unknown;
+
+        std::string directory;
+        std::vector<File> files;
+        std::unordered_map<std::string, std::size_t> file_ids;
+        std::vector<Segment> segments;
+        // next output line, 1-based
+        std::size_t line;
+        std::string line_buffer;
+
+        bool include(const std::string &name, std::string *source);
+        void emitLine(std::string_view text, std::size_t file, std::size_t file_line, std::string *source);
+
+    public:
+        KernelPreprocessor();
+
+        void define(const std::string &name, const std::string &value);
+        // drop every line that uses `name`, e.g. the #define of a feature the scene doesn't use
+        void disable(const std::string &name);
+
+        // false if a file is missing or includes itself
+        bool process(const std::string &filepath, std::string *source);
+
+        std::size_t getFileCount() const { return files.size(); }
+
+        // "file.cl:line" of a line of the last output, 1-based
+        std::string getLocation(std::size_t line) const;
+
+        // rewrites the "<source>:line:column" locations of a build log into the original files
+        std::string remapLog(const std::string &log) const;
+    };
+} // namespace CL_RAYTRACER
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // key of a cache entry built from `fields`
+    cl_ulong hashKey(const std::vector<std::string> &fields);
+
+    // on-disk cache of CL_PROGRAM_BINARIES keyed on the preprocessed source, device, driver and build options
+    class ProgramCache
+    {
+    private:
+        // empty: disabled
+        std::string directory;
+
+        cl_uint hits;
+        cl_uint misses;
+        // build time of the cached programs minus their load time, seconds
+        double saved;
+
+        std::string getFilepath(cl_ulong key) const;
+        bool read(cl_ulong key, double *build_time, std::vector<unsigned char> *binary) const;
+        void write(cl_ulong key, double build_time, const cl::Program &program) const;
+
+    public:
+        explicit ProgramCache(const std::string &directory);
+
+        void setDirectory(const std::string &directory) { this->directory = directory; }
+
+        // builds `program` for `device` from the cached binary when the key matches, from `source` otherwise
+        cl_int build(const cl::Context &context, const cl::Device &device, const std::string &source,
+                     const std::string &options, cl::Program *program);
+
+        void printSummary() const;
+    };
+
+    extern ProgramCache program_cache;
+} // namespace CL_RAYTRACER
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // keep in sync with PIXEL_ORDER_* in kernels/main.cl
+    constexpr cl_int PIXEL_ORDER_LINEAR = 0;
+    constexpr cl_int PIXEL_ORDER_TILED = 1;
+    constexpr cl_int PIXEL_ORDER_MORTON = 2;
+
+    // work-group shape of a 1-D launch: each group covers a block_w x block_h block of pixels
+    struct WorkGroupConfig
+    {
+        cl_int order;
+        cl_int block_w;
+        cl_int block_h;
+
+        std::size_t getLocalSize() const { return (std::size_t)block_w * block_h; }
+        // every block is launched whole, the work-items outside the image return
+        std::size_t getGlobalSize(int width, int height) const;
+        // {order, block_w, block_h, blocks per row}
+        cl_int4 getKernelArg(int width) const;
+        std::string toString() const;
+    };
+
+    // picks the fastest work-group shape and pixel order of a kernel and remembers it per device and program
+    class WorkGroupTuner
+    {
+    private:
+        std::string filepath;
+        std::map<cl_ulong, WorkGroupConfig> entries;
+        bool loaded;
+
+        void load();
+        void save() const;
+
+    public:
+        explicit WorkGroupTuner(const std::string &filepath);
+
+        static cl_ulong getKey(const cl::Device &device, const std::string &kernel_name, const std::string &source, const std::string &options);
+
+        // scanline order with the largest work-group of `kernel`
+        static WorkGroupConfig getDefault(const cl::Kernel &kernel, const cl::Device &device);
+
+        bool find(cl_ulong key, WorkGroupConfig *config);
+
+        // times every candidate that fits `kernel` with `benchmark` (seconds) and stores the fastest
+        WorkGroupConfig tune(cl_ulong key, const cl::Kernel &kernel, const cl::Device &device,
+                             const std::function<double(const WorkGroupConfig &)> &benchmark);
+    };
+
+    extern WorkGroupTuner workgroup_tuner;
+} // namespace CL_RAYTRACER
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include <CL/cl.hpp>
+#include <Texture/texture.h>
+#include <utils.h>
+
+extern cl::Context context;
+extern int window_width;
+extern int window_height;
+extern std::string env_map_filepath;
+
+namespace headless
+{
+// radiance, replaces the GL texture used by the viewer
+inline cl::Image2D createRenderTarget(cl_int *err, int width = window_width, int height = window_height)
+{
+	return cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT),
+					   width, height, 0, NULL, err);
+}
+
+// enviroment map, RGB HDRs are expanded to RGBA since most devices don't support CL_RGB floats
+inline cl::Image2D createEnvMap(cl_int *err)
+{
+	int width = 1, height = 1;
+	std::vector<cl_float> pixels(4, 0.0f);
+
+	if (!env_map_filepath.empty())
+	{
+		Texture<float> *hdr = loadHDR(env_map_filepath.c_str());
+		width = hdr->width;
+		height = hdr->height;
+
+		pixels.resize(4 * width * height);
+		for (std::size_t i = 0; i < (std::size_t)(width * height); ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				pixels[4 * i + c] = hdr->data[i * hdr->nrComponents + std::min(c, hdr->nrComponents - 1)];
+			pixels[4 * i + 3] = 1.0f;
+		}
+
+		stbi_image_free(hdr->data);
+		delete hdr;
+	}
+
+	return cl::Image2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_FLOAT),
+					   width, height, 0, pixels.data(), err);
+}
+
+//---------------------------------------------------------------------------------------
+
+// CPU port of shaders/tonemapper.glsl
+namespace tonemapper
+{
+constexpr float W = 1.2f;
+constexpr float T2 = 7.5f;
+
+inline float filmic_reinhard_curve(float x)
+{
+	float q = (T2 * T2 + 1.0f) * x * x;
+	return q / (q + x + T2 * T2);
+}
+
+inline float smoothstep(float e0, float e1, float x)
+{
+	float t = std::min(std::max((x - e0) / (e1 - e0), 0.0f), 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+inline float apply(float c, float vignette)
+{
+	c = filmic_reinhard_curve(c * vignette) / filmic_reinhard_curve(W);
+	c = smoothstep(-0.025f, 1.0f, c);
+	return std::pow(c, 1.0f / 2.2f);
+}
+
+inline float vignette(int x, int y)
+{
+	float px = 1.0f - 2.0f * (x + 0.5f) / window_width;
+	float py = 1.0f - 2.0f * (y + 0.5f) / window_height;
+
+	float v = 1.25f / (1.1f + 1.1f * (px * px + py * py));
+	v *= v;
+	return 1.0f + (smoothstep(0.1f, 1.1f, v) - 1.0f) * 0.25f;
+}
+} // namespace tonemapper
+
+// write RGBA radiance to disk, ".hdr" keeps the linear values
+inline void saveImage(const std::vector<cl_float> &pixels, const std::string &filepath)
+{
+	double tStart = utils::getTime();
+
+	const bool hdr = filepath.size() > 4 && filepath.substr(filepath.size() - 4) == ".hdr";
+
+	// the viewer displays row 0 at the bottom
+	stbi_flip_vertically_on_write(true);
+
+	int res;
+	if (hdr)
+	{
+		std::vector<float> rgb(3 * window_width * window_height);
+		for (std::size_t i = 0; i < rgb.size() / 3; ++i)
+		{
+			rgb[3 * i + 0] = pixels[4 * i + 0];
+			rgb[3 * i + 1] = pixels[4 * i + 1];
+			rgb[3 * i + 2] = pixels[4 * i + 2];
+		}
+		res = stbi_write_hdr(filepath.c_str(), window_width, window_height, 3, rgb.data());
+	}
+	else
+	{
+		std::vector<unsigned char> rgba(4 * window_width * window_height);
+		for (int y = 0; y < window_height; ++y)
+		{
+			for (int x = 0; x < window_width; ++x)
+			{
+				const std::size_t i = y * window_width + x;
+				const float v = tonemapper::vignette(x, y);
+				for (int c = 0; c < 3; ++c)
+				{
+					float value = tonemapper::apply(std::max(pixels[4 * i + c], 0.0f), v);
+					rgba[4 * i + c] = (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+				}
+				rgba[4 * i + 3] = 255;
+			}
+		}
+		res = stbi_write_png(filepath.c_str(), window_width, window_height, 4, rgba.data(), 0);
+	}
+
+	if (res)
+		std::cout << std::endl << "succesfully saved " << filepath << " in ( " << utils::getTime() - tStart << "s )" << std::endl;
+	else
+		std::cout << std::endl << "couldn't write " << filepath << std::endl;
+}
+
+// full frame assembled from tiles, ".pfm" is streamed to disk so the frame never lives in host memory
+class TiledImage
+{
+private:
+	std::string filepath;
+	int width;
+	int height;
+	std::ofstream file;
+	std::streamoff header_size = 0;
+	std::vector<cl_float> pixels;
+
+public:
+	TiledImage(const std::string &filepath, int width, int height)
+		: filepath(filepath), width(width), height(height)
+	{
+		if (filepath.size() > 4 && filepath.substr(filepath.size() - 4) == ".pfm")
+		{
+			file.open(filepath, std::ios::binary);
+			// negative scale: little endian, the rows are stored bottom to top like the viewer's
+			file << "PF\n" << width << " " << height << "\n-1.0\n";
+			header_size = file.tellp();
+		}
+		else
+			pixels.resize(4 * (std::size_t)width * height);
+	}
+
+	// RGBA tile of w*h pixels at (x, y)
+	void write(const std::vector<cl_float> &tile, int x, int y, int w, int h)
+	{
+		if (file.is_open())
+		{
+			std::vector<float> rgb(3 * w);
+			for (int row = 0; row < h; ++row)
+			{
+				for (int i = 0; i < w; ++i)
+				{
+					rgb[3 * i + 0] = tile[4 * (row * w + i) + 0];
+					rgb[3 * i + 1] = tile[4 * (row * w + i) + 1];
+					rgb[3 * i + 2] = tile[4 * (row * w + i) + 2];
+				}
+				file.seekp(header_size + (std::streamoff)(((std::size_t)(y + row) * width + x) * 3 * sizeof(float)));
+				file.write((const char *)rgb.data(), rgb.size() * sizeof(float));
+			}
+		}
+		else
+		{
+			for (int row = 0; row < h; ++row)
+				std::copy_n(tile.begin() + 4 * row * w, 4 * w, pixels.begin() + 4 * ((std::size_t)(y + row) * width + x));
+		}
+	}
+
+	void close()
+	{
+		if (file.is_open())
+		{
+			file.close();
+			std::cout << std::endl << "succesfully saved " << filepath << std::endl;
+		}
+		else
+			saveImage(pixels, filepath);
+	}
+};
+} // namespace headless
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // keep in sync with kernels/path_state.cl, every stream holds one element per pixel
+    enum PathStream
+    {
+        PATH_ORIGIN,   // float4
+        PATH_DIR,      // float4
+        PATH_MASK,     // float4
+        PATH_ACC,      // float4
+        PATH_MOMENTS,  // float2
+        PATH_BOUNCES,  // uint
+        PATH_SAMPLES,  // uint
+        PATH_EPOCH,    // uint
+        PATH_STREAM_COUNT
+    };
+
+    constexpr std::size_t PATH_STREAM_SIZES[PATH_STREAM_COUNT] = {
+        sizeof(cl_float4), sizeof(cl_float4), sizeof(cl_float4), sizeof(cl_float4),
+        sizeof(cl_float2), sizeof(cl_uint), sizeof(cl_uint), sizeof(cl_uint)};
+
+    // bytes per pixel
+    constexpr std::size_t PATH_STATE_SIZE = 4 * sizeof(cl_float4) + sizeof(cl_float2) + 3 * sizeof(cl_uint);
+
+    // the bounce counters are packed into one uint, the bounce limits can't go past them
+    constexpr cl_int PATH_MAX_BOUNCES = 255;
+    constexpr cl_int PATH_MAX_DIFF_BOUNCES = 31;
+    constexpr cl_int PATH_MAX_SPEC_BOUNCES = 31;
+    constexpr cl_int PATH_MAX_TRANS_BOUNCES = 63;
+    constexpr cl_int PATH_MAX_SCATTERING_EVENTS = 63;
+
+    // byte offset of `stream` in a path state of `num_pixels`
+    constexpr std::size_t getPathStreamOffset(PathStream stream, std::size_t num_pixels)
+    {
+        std::size_t offset = 0;
+        for (int i = 0; i < stream; ++i)
+            offset += PATH_STREAM_SIZES[i] * num_pixels;
+        return offset;
+    }
+} // namespace CL_RAYTRACER
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <CL/cl.hpp>
+
+#include <align.h>
+
+namespace CL_RAYTRACER
+{
+    // keep in sync with kernels/integrators/wavefront.cl
+    constexpr cl_uint WF_QUEUE_EXTEND = 0;
+    constexpr cl_uint WF_QUEUE_SHADE = 1;
+    constexpr cl_uint WF_SHADE_QUEUES = 3;
+    constexpr cl_uint WF_QUEUE_SHADOW = WF_QUEUE_SHADE + WF_SHADE_QUEUES;
+    constexpr cl_uint WF_QUEUE_COUNT = WF_QUEUE_SHADOW + 1;
+
+    struct cl_HitRecord
+    {
+        ALIGN(16) cl_float3 pos;
+        ALIGN(16) cl_float3 normal;
+        cl_float t;
+        cl_int mesh_id;
+        cl_int backside;
+        cl_int didHit;
+    };
+
+    struct cl_ShadowRay
+    {
+        ALIGN(16) cl_float3 origin;
+        ALIGN(16) cl_float3 dir;
+        ALIGN(16) cl_float3 contribution;
+        cl_float dist;
+    };
+
+    struct ALIGN(16) cl_WFPath
+    {
+        cl_HitRecord hit;
+        cl_ShadowRay shadow;
+        cl_uint2 seed;
+        cl_float bsdfPdf;
+        cl_int lightSampled;
+    };
+
+    // scene buffers shared by the extend, shade and shadow stages
+    struct WavefrontScene
+    {
+        cl::Buffer meshes;
+        cl_uint8 mesh_count;
+        cl::Buffer faces;
+        cl::Buffer vertices;
+        cl::Buffer normals;
+        cl::Buffer material;
+        cl::Buffer bvh;
+        cl::Buffer settings;
+    };
+
+    // per-frame inputs/outputs, the path state (kernels/path_state.cl) is shared with render_kernel
+    struct WavefrontTargets
+    {
+        int width;
+        int height;
+        cl::Buffer camera;
+        cl::Image env_map;
+        cl::Image output;
+        cl::Buffer path_state;
+        cl::Buffer sample_count;
+    };
+
+    class Wavefront
+    {
+    private:
+        cl::Kernel generate;
+        cl::Kernel extend;
+        cl::Kernel shade;
+        cl::Kernel shadow;
+        cl::Kernel accumulate;
+
+        cl::Buffer paths;
+        cl::Buffer queues;
+        cl::Buffer queue_counters;
+
+        cl_uint num_paths;
+        std::size_t global_work_size;
+        std::size_t local_work_size;
+        // extend, shade and shadow walk their queues with enough work-items to fill the device
+        std::size_t queue_work_size;
+
+        void setSceneArgs(cl::Kernel &kernel, const WavefrontScene &scene);
+
+    public:
+        Wavefront(const cl::Program &program, const cl::Device &device, const WavefrontScene &scene, const WavefrontTargets &targets);
+        ~Wavefront();
+
+        // camera buffer read by the next generate launch
+        void setCamera(const cl::Buffer &camera);
+
+        // traversal counters, the program has to be built with -DRAY_STATS
+        void setRayStats(const cl::Buffer &ray_stats);
+
+        // generate -> extend -> shade -> shadow -> accumulate, one bounce for every path. Never blocks the host,
+        // the first command waits for `events`, `event` signals the last one
+        void enqueue(const cl::CommandQueue &queue, cl_uint framenumber, int random0, int random1,
+                     const std::vector<cl::Event> *events = nullptr, cl::Event *event = nullptr);
+
+        std::size_t getMemoryUsage() const;
+    };
+} // namespace CL_RAYTRACER
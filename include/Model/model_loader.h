@@ -62,6 +62,18 @@ namespace IO
 		Scene(std::vector<Mesh> &_meshes) : meshes(_meshes) {}
 	};
 
+	// every mesh of the scene in one shared vertex pool, packed as float3 for vload3
+	struct IndexedMesh
+	{
+		std::vector<cl_float> positions;
+		std::vector<cl_float> normals;
+		// three vertices per triangle, same triangle order as getFaces()
+		std::vector<cl_uint> faces;
+
+		std::size_t getVertexCount() const { return positions.size() / 3; }
+		std::size_t getFaceCount() const { return faces.size() / 3; }
+	};
+
 	// Raw Data
 	typedef std::pair<std::vector<unsigned int>, std::vector<float>> MeshData;
 	typedef std::vector<MeshData> SceneData;
@@ -79,6 +91,9 @@ namespace IO
 			return sceneData;
 		}
 		const std::unique_ptr<Scene> getFaces();
+		// vertices with the same position and normal are stored once, without `weld` every corner of a face has
+		// its own vertex, e.g. for the frames of an animation that can move coincident vertices apart
+		IndexedMesh getIndexedMesh(bool weld = true) const;
 
 		std::vector<unsigned int> getIndices() const;
 		std::vector<cl_uint4> getIndices4() const;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // device timings of every profiled enqueue (CL_PROFILING_COMMAND_START/END) and host timings of the startup phases
+    class Profiler
+    {
+    private:
+        // startup phases in the order they ran, seconds
+        std::vector<std::pair<std::string, double>> phases;
+        std::string phase;
+        double phase_start = 0.0;
+
+        // per stage durations, milliseconds
+        std::map<std::string, std::vector<double>> stages;
+        std::deque<std::pair<std::string, cl::Event>> pending;
+
+        // collect the finished events, `wait` blocks on every pending one
+        void resolve(bool wait);
+
+    public:
+        void beginPhase(const std::string &name);
+        void endPhase();
+
+        // the event the next enqueue of `stage` should signal
+        cl::Event *newEvent(const std::string &stage);
+        void addEvent(const std::string &stage, const cl::Event &event);
+
+        // min/avg/p99 per stage, ".json" or ".csv" by extension, stdout otherwise
+        void report(const std::string &filepath = "");
+    };
+
+    extern Profiler profiler;
+} // namespace CL_RAYTRACER
+
+#ifdef PROFILING
+#define PROFILE_PHASE_BEGIN(name) CL_RAYTRACER::profiler.beginPhase(name)
+#define PROFILE_PHASE_END() CL_RAYTRACER::profiler.endPhase()
+#define PROFILE_EVENT(stage) CL_RAYTRACER::profiler.newEvent(stage)
+#define PROFILE_ADD_EVENT(stage, event) CL_RAYTRACER::profiler.addEvent(stage, event)
+#define PROFILE_QUEUE_PROPERTIES CL_QUEUE_PROFILING_ENABLE
+#else
+#define PROFILE_PHASE_BEGIN(name)
+#define PROFILE_PHASE_END()
+#define PROFILE_EVENT(stage) nullptr
+#define PROFILE_ADD_EVENT(stage, event)
+#define PROFILE_QUEUE_PROPERTIES 0
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // keep in sync with the RAY_STATS section of kernels/header.cl
+    constexpr cl_uint RAY_STATS_PRIMARY = 0;
+    constexpr cl_uint RAY_STATS_CLOSEST = 1;
+    constexpr cl_uint RAY_STATS_SHADOW = 2;
+    constexpr cl_uint RAY_STATS_NODES = 3;
+    constexpr cl_uint RAY_STATS_TRIANGLES = 4;
+    constexpr cl_uint RAY_STATS_PRIMITIVES = 5;
+    constexpr cl_uint RAY_STATS_COUNTERS = 6;
+
+    constexpr cl_uint RAY_STATS_STACK = 2 * RAY_STATS_COUNTERS;
+    constexpr cl_uint RAY_STATS_SHADOW_STACK = RAY_STATS_STACK + 1;
+    constexpr cl_uint RAY_STATS_SIZE = RAY_STATS_SHADOW_STACK + 1;
+
+    // traversal counters of a program built with -DRAY_STATS, the device buffer accumulates over the whole run
+    class RayStatistics
+    {
+    private:
+        cl_ulong counters[RAY_STATS_COUNTERS];
+        cl_uint stack;
+        cl_uint shadow_stack;
+
+        double tStart;
+        double elapsed;
+
+    public:
+        RayStatistics();
+
+        void start();
+
+        // `device` holds the RAY_STATS_SIZE values of the device buffer, (low, high) pairs for the counters
+        void update(const cl_uint *device);
+
+        void print() const;
+    };
+} // namespace CL_RAYTRACER
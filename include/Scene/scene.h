@@ -1,10 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <map>
 #include <CL/cl.hpp>
 
 #include <rapidjson/document.h>
@@ -12,13 +14,16 @@
 
 #include <Scene/geometry.h>
 #include <Types/media.h>
+#include <Types/settings.h>
+#include <Integrators/path_state.h>
+#include <CL/kernel_preprocessor.h>
 
 extern std::string scene_filepath;
 
 struct host_scene
 {	
 	// n_sphere, n_sdf, n_box, n_quad,
-	// _____, _____, _____, total_count
+	// n_instance, _____, _____, total_count (of the meshes)
 	cl_uint8 object_count;
 	std::vector<Mesh> cpu_meshes;
 
@@ -48,10 +53,38 @@ struct host_scene
 	cl_int MARCHING_STEPS = 128;
 	cl_int SHADOW_MARCHING_STEPS = 64;
 
-	// obj scene
+	// obj scene, every instance places a model with its own transform and material
+	struct host_instance
+	{
+		std::string path;
+		// row-major 3x4, object to world
+		cl_float transform[12] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+		Material mat;
+	};
+
+	// a model's vertices replaced by an .obj per frame, the frames need the model's triangles
+	struct host_animation
+	{
+		std::vector<std::string> frames;
+		cl_float fps = 24.0f;
+	};
+
 	cl_bool BUILD_BVH = false;
-	std::string obj_path;
-	Material *obj_mat = new Material();
+	std::vector<host_instance> instances;
+	// by model path, every instance of the model moves with it
+	std::map<std::string, host_animation> animations;
+
+	// every model once, in the order of their first instance
+	std::vector<std::string> getModelPaths() const
+	{
+		std::vector<std::string> paths;
+		for (const host_instance &instance : instances)
+		{
+			if (std::find(paths.begin(), paths.end(), instance.path) == paths.end())
+				paths.push_back(instance.path);
+		}
+		return paths;
+	}
 
 	void getLights()
 	{
@@ -131,7 +164,8 @@ struct host_scene
 		ACTIVE_MATS |= _mat.t;
 	}
 
-	void load()
+	// false if the file isn't valid json, e.g. while an editor is still writing it
+	bool load()
 	{
 		using namespace rapidjson;
 
@@ -143,8 +177,11 @@ struct host_scene
 		Document document;
 		document.ParseStream(isw);
 
-		assert(document.IsObject());
-		assert(document.HasMember("scene"));
+		if (document.HasParseError() || !document.IsObject() || !document.HasMember("scene"))
+		{
+			std::cout << "couldn't parse (" << scene_filepath << ")" << std::endl;
+			return false;
+		}
 
 		//---------------------- GLOBAL MEDIUM -------------------------
 		HAS_GLOBAL_MEDIUM = document.HasMember("global_medium");
@@ -175,12 +212,13 @@ struct host_scene
 		{
 
 			//---------------------------------- OBJ ----------------------------------
-			BUILD_BVH = document["scene"].HasMember("obj") && document["scene"]["obj"].IsObject() &&
-						document["scene"]["obj"].HasMember("path") && document["scene"]["obj"]["path"].IsString();
-			if (BUILD_BVH)
+			if (document["scene"].HasMember("obj") && document["scene"]["obj"].IsObject() &&
+				document["scene"]["obj"].HasMember("path") && document["scene"]["obj"]["path"].IsString())
 			{
-				// .obj name
-				obj_path = document["scene"]["obj"]["path"].GetString();
+				// .obj name, a single instance that isn't transformed
+				instances.emplace_back();
+				instances.back().path = document["scene"]["obj"]["path"].GetString();
+				Material *obj_mat = &instances.back().mat;
 
 				// obj's material
 				if (document["scene"]["obj"].HasMember("material") &&
@@ -259,6 +297,59 @@ struct host_scene
 				}
 			}
 
+			//---------------------------------- Instances ----------------------------------
+			if (document["scene"].HasMember("instances") && document["scene"]["instances"].IsArray())
+			{
+				GenericArray<false, Value::ValueType> objs = document["scene"]["instances"].GetArray();
+
+				for (cl_uint i = 0; i < objs.Size(); ++i)
+				{
+					if (!objs[i].IsObject() || !objs[i].HasMember("path") || !objs[i]["path"].IsString())
+						continue;
+
+					host_instance instance;
+					instance.path = objs[i]["path"].GetString();
+
+					// instance's transform
+					if (objs[i].HasMember("transform") && objs[i]["transform"].IsArray())
+					{
+						GenericArray<false, Value::ValueType> transform = objs[i]["transform"].GetArray();
+
+						for (cl_uint p = 0; p < transform.Size() && p < 12; p++)
+						{
+							instance.transform[p] = transform[p].GetFloat();
+						}
+					}
+
+					// instance's material
+					if (objs[i].HasMember("material") && objs[i]["material"].IsObject())
+					{
+						parseMaterial(&objs[i]["material"], instance.mat);
+					}
+					ACTIVE_MATS |= instance.mat.t;
+
+					// model's animation
+					if (objs[i].HasMember("frames") && objs[i]["frames"].IsArray())
+					{
+						GenericArray<false, Value::ValueType> frames = objs[i]["frames"].GetArray();
+
+						host_animation &animation = animations[instance.path];
+						animation.frames.clear();
+						for (cl_uint f = 0; f < frames.Size(); f++)
+						{
+							if (frames[f].IsString())
+								animation.frames.push_back(frames[f].GetString());
+						}
+
+						if (objs[i].HasMember("fps") && objs[i]["fps"].IsNumber())
+							animation.fps = objs[i]["fps"].GetFloat();
+					}
+
+					instances.push_back(instance);
+				}
+			}
+			BUILD_BVH = !instances.empty();
+
 			//---------------------------------- Spheres ----------------------------------
 			if (document["scene"].HasMember("spheres") && document["scene"]["spheres"].IsArray())
 			{
@@ -471,5 +562,90 @@ struct host_scene
 
 		if (ACTIVE_MATS & LIGHT)
 			this->getLights();
+
+		return true;
+	}
+
+	// the plain data of the scene, uploaded as a kernel argument instead of compiled in
+	void getSettings(cl_Settings *settings) const
+	{
+		if (HAS_GLOBAL_MEDIUM)
+		{
+			settings->fog_density = GLOBAL_MEDIUM.density;
+			settings->fog_sigma_a = GLOBAL_MEDIUM.sigmaA;
+			settings->fog_sigma_s = GLOBAL_MEDIUM.sigmaS;
+			settings->fog_sigma_t = GLOBAL_MEDIUM.sigmaT;
+			settings->fog_abs_only = GLOBAL_MEDIUM.absorptionOnly;
+		}
+		else
+		{
+			settings->fog_density = settings->fog_sigma_a = settings->fog_sigma_s = settings->fog_sigma_t = 0.0f;
+			settings->fog_abs_only = 0;
+		}
+
+		// the path state packs the bounce counters, see kernels/path_state.cl
+		const auto clampBounces = [](const char *name, int value, cl_int max) {
+			if (value > max)
+				std::cout << name << " is limited to " << max << std::endl;
+			return value > max ? max : (cl_int)value;
+		};
+		settings->max_bounces = clampBounces("max_bounces", MAX_BOUNCES, CL_RAYTRACER::PATH_MAX_BOUNCES);
+		settings->max_diff_bounces = clampBounces("max_diff_bounces", MAX_DIFF_BOUNCES, CL_RAYTRACER::PATH_MAX_DIFF_BOUNCES);
+		settings->max_spec_bounces = clampBounces("max_spec_bounces", MAX_SPEC_BOUNCES, CL_RAYTRACER::PATH_MAX_SPEC_BOUNCES);
+		settings->max_trans_bounces = clampBounces("max_trans_bounces", MAX_TRANS_BOUNCES, CL_RAYTRACER::PATH_MAX_TRANS_BOUNCES);
+		settings->max_scattering_events = clampBounces("max_scattering_events", MAX_SCATTERING_EVENTS, CL_RAYTRACER::PATH_MAX_SCATTERING_EVENTS);
+
+		settings->marching_steps = MARCHING_STEPS;
+		settings->shadow_marching_steps = SHADOW_MARCHING_STEPS;
+
+		if (LIGHT_COUNT > MAX_LIGHTS)
+			std::cout << "only the first " << MAX_LIGHTS << " of " << LIGHT_COUNT << " light sources are sampled" << std::endl;
+
+		settings->light_count = LIGHT_COUNT > MAX_LIGHTS ? MAX_LIGHTS : LIGHT_COUNT;
+		settings->inv_light_count = settings->light_count ? 1.0f / settings->light_count : 0.0f;
+		for (cl_uint i = 0; i < MAX_LIGHTS; ++i)
+			settings->light_indices[i] = i < settings->light_count ? LIGHT_INDICES[i] : 0;
+	}
+
+	// values of the kernel's #NAME# placeholders, features the scene doesn't use are disabled
+	// everything else goes through getSettings() so editing it doesn't change the program
+	void defineKernelTokens(CL_RAYTRACER::KernelPreprocessor *preprocessor) const
+	{
+		using std::to_string;
+
+		// render settings
+		preprocessor->define("GLOBAL_MEDIUM", HAS_GLOBAL_MEDIUM ? "#define GLOBAL_MEDIUM" : "");
+
+		// mesh types
+		const auto defineIf = [preprocessor](const char *name, bool enabled, int value) {
+			if (enabled)
+				preprocessor->define(name, to_string(value));
+			else
+				preprocessor->disable(name);
+		};
+		defineIf("SPHERE", H_SPHERE, SPHERE);
+		defineIf("BOX", H_BOX, BOX);
+		defineIf("SDF", H_SDF, SDF);
+		defineIf("QUAD", H_QUAD, QUAD);
+
+		// material types
+		defineIf("LIGHT", ACTIVE_MATS & LIGHT, LIGHT);
+		defineIf("DIFF", ACTIVE_MATS & DIFF, DIFF);
+		defineIf("COND", ACTIVE_MATS & COND, COND);
+		defineIf("ROUGH_COND", ACTIVE_MATS & ROUGH_COND, ROUGH_COND);
+		defineIf("DIEL", ACTIVE_MATS & DIEL, DIEL);
+		defineIf("ROUGH_DIEL", ACTIVE_MATS & ROUGH_DIEL, ROUGH_DIEL);
+		defineIf("COAT", ACTIVE_MATS & COAT, COAT);
+		defineIf("VOL", ACTIVE_MATS & VOL, VOL);
+		defineIf("TRANS", ACTIVE_MATS & TRANS, TRANS);
+		defineIf("SPECSUB", ACTIVE_MATS & SPECSUB, SPECSUB);
+		preprocessor->define("ABS_REFR", to_string(ABS_REFR));
+		preprocessor->define("ABS_REFR2", to_string(ABS_REFR2));
+
+		// sdf types
+		preprocessor->define("SDF_SPHERE", to_string(SDF_SPHERE));
+		preprocessor->define("SDF_BOX", to_string(SDF_BOX));
+		preprocessor->define("SDF_ROUND_BOX", to_string(SDF_ROUND_BOX));
+		preprocessor->define("SDF_PLANE", to_string(SDF_PLANE));
 	}
 };
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <future>
+#include <filesystem>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // polls the scene file for edits and builds the program of an edited scene off the render thread
+    class SceneWatcher
+    {
+    private:
+        std::string filepath;
+        std::filesystem::file_time_type last_write;
+        double last_poll;
+
+        std::future<cl_int> build;
+        cl::Program program;
+        double build_start;
+
+    public:
+        explicit SceneWatcher(const std::string &filepath);
+
+        // true once per edit, the file is checked at most a few times per second
+        bool changed();
+
+        // builds `source` through the program cache on another thread
+        void startBuild(const cl::Context &context, const cl::Device &device, const std::string &source, const std::string &options);
+        bool isBuilding() const { return build.valid(); }
+
+        // true once the background build is done, `program` receives it even if it failed for the build log
+        bool finishBuild(cl_int *result, cl::Program *program);
+    };
+} // namespace CL_RAYTRACER
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    // a band of rows for one progressive pass
+    struct Tile
+    {
+        cl_uint begin;
+        cl_uint end;
+        cl_uint pass;
+    };
+
+    // every worker owns a deque of tiles, an idle worker steals half of the biggest one
+    class TileScheduler
+    {
+    private:
+        std::mutex mutex;
+        std::vector<std::deque<Tile>> queues;
+        std::vector<std::size_t> stolen;
+
+        cl_uint num_pixels;
+        cl_uint tile_size;
+        cl_uint pass;
+        // 0: until stop()
+        cl_uint passes;
+        bool stopped;
+
+        void distribute();
+
+    public:
+        TileScheduler(std::size_t workers, cl_uint num_pixels, cl_uint tile_size, cl_uint passes);
+
+        // false once every pass has been handed out or the scheduler was stopped
+        bool next(std::size_t worker, Tile &tile);
+        void stop();
+
+        std::size_t getStolen(std::size_t worker) const { return stolen[worker]; }
+    };
+
+    // scene buffers of the primary context, copied to every other device
+    struct MultiDeviceScene
+    {
+        std::string source;
+        std::string options;
+        cl::Buffer meshes;
+        cl_uint8 mesh_count;
+        cl::Buffer faces;
+        cl::Buffer vertices;
+        cl::Buffer normals;
+        cl::Buffer material;
+        cl::Buffer bvh;
+        cl::Buffer camera;
+        cl::Image env_map;
+        cl::Buffer settings;
+    };
+
+    struct DeviceWorker
+    {
+        cl::Device device;
+        cl::Context context;
+        cl::CommandQueue queue;
+        cl::Program program;
+        cl::Kernel kernel;
+
+        cl::Image env_map;
+        cl::Image output;
+        cl::Buffer path_state;
+        cl::Buffer sample_count;
+        cl::Buffer work_counter;
+
+        std::size_t global_work_size;
+        std::size_t local_work_size;
+
+        // throughput report
+        std::size_t tiles = 0;
+        std::atomic<cl_ulong> samples{0};
+        double busy = 0.0;
+    };
+
+    class MultiDevice
+    {
+    private:
+        std::vector<std::unique_ptr<DeviceWorker>> workers;
+        int width;
+        int height;
+        cl_uint spp;
+
+        void initWorker(DeviceWorker &worker, const MultiDeviceScene &scene,
+                        const std::vector<std::vector<char>> &host_buffers, const std::vector<cl_float> &host_env_map);
+        void work(std::size_t id, TileScheduler &scheduler);
+
+    public:
+        // `devices` excludes the primary device, it's always worker 0
+        MultiDevice(const std::vector<cl::Device> &devices, const MultiDeviceScene &scene, int width, int height, cl_uint spp);
+        ~MultiDevice();
+
+        // every OpenCL device on every platform but `primary`
+        static std::vector<cl::Device> getSecondaryDevices(const cl::Device &primary);
+
+        // render until `target_spp` (0: unlimited) or `time_budget` (<= 0: unlimited), then merge the devices' accumulation buffers
+        std::vector<cl_float> render(cl_uint target_spp, double time_budget);
+
+        std::size_t getDeviceCount() const { return workers.size(); }
+    };
+} // namespace CL_RAYTRACER
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <CL/cl.hpp>
+
+namespace CL_RAYTRACER
+{
+    enum class StopReason
+    {
+        NONE,
+        TARGET_SPP,
+        TIME_BUDGET,
+        NOISE_THRESHOLD,
+        // every pixel reached the adaptive sampling threshold
+        CONVERGED,
+        // an spp target ran for as many frames as its paths can take, the device counter fell short
+        FRAME_LIMIT
+    };
+
+    // decides when a progressive render is done: target spp, wall-clock budget or estimated noise
+    class RenderController
+    {
+    private:
+        cl_uint target_spp;
+        double time_budget;
+        float noise_threshold;
+
+        double tStart;
+        double spp;
+        double elapsed;
+        // -1: not estimated yet
+        float noise;
+        StopReason reason;
+
+        // luminance of the last noise checkpoint and its spp
+        std::vector<float> checkpoint;
+        double checkpoint_spp;
+
+        void updateNoise(const std::vector<cl_float> &radiance);
+
+    public:
+        RenderController(cl_uint target_spp, double time_budget, float noise_threshold);
+
+        // false when the render should only stop on user request
+        bool hasTarget() const { return target_spp || time_budget > 0.0 || noise_threshold > 0.0f; }
+
+        void start();
+
+        // true once a target is met, `readback` returns the RGBA radiance and is only called at noise checkpoints
+        bool update(double spp, const std::function<std::vector<cl_float>()> &readback);
+        void stop(StopReason reason) { this->reason = reason; }
+
+        void printProgress(cl_uint framenumber) const;
+        void printSummary(cl_uint framenumber, std::size_t num_pixels) const;
+    };
+} // namespace CL_RAYTRACER
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CL_RAYTRACER
+{
+    // fork/join tasks on every core: a thread pushes and pops its own tasks at the front of its deque,
+    // an idle thread steals the oldest (largest) task from the back of another one
+    class ThreadPool
+    {
+    public:
+        // the tasks of one fork, see wait()
+        struct TaskGroup
+        {
+            std::atomic<std::size_t> pending{0};
+        };
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::thread> workers;
+        // one per worker, the last one is shared by the threads outside the pool
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::atomic<std::size_t> queued{0};
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        std::size_t self() const;
+        // runs a task of the own queue or a stolen one, false if every queue is empty
+        bool runOne(std::size_t index);
+        void work(std::size_t index);
+
+    public:
+        // 0: a worker per hardware thread, the thread that waits is the last one
+        explicit ThreadPool(std::size_t threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        void spawn(TaskGroup &group, std::function<void()> task);
+
+        // helps with any queued task until every task of `group` has finished
+        void wait(TaskGroup &group);
+
+        // body(begin, end) over chunks of `grain` items of [0, count), returns once all of them are done
+        void parallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &body);
+
+        std::size_t getThreadCount() const { return workers.size() + 1; }
+    };
+} // namespace CL_RAYTRACER
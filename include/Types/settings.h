@@ -0,0 +1,32 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+// keep in sync with Settings in kernels/header.cl
+#define MAX_LIGHTS 64
+
+// scene data that doesn't change the shape of the kernels, uploaded instead of compiled in
+struct cl_Settings {
+	// global medium
+	cl_float fog_density;
+	cl_float fog_sigma_a;
+	cl_float fog_sigma_s;
+	cl_float fog_sigma_t;
+	cl_int fog_abs_only;
+
+	// seperate bounce controls
+	cl_int max_bounces;
+	cl_int max_diff_bounces;
+	cl_int max_spec_bounces;
+	cl_int max_trans_bounces;
+	cl_int max_scattering_events;
+
+	// raymarching
+	cl_int marching_steps;
+	cl_int shadow_marching_steps;
+
+	// lights
+	cl_uint light_count;
+	cl_float inv_light_count;
+	cl_uint light_indices[MAX_LIGHTS];
+};
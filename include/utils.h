@@ -3,6 +3,7 @@
 #include <iostream>     // std::cout
 #include <fstream>
 #include <sstream>      // std::stringstream
+#include <chrono>
 
 namespace utils {
 
@@ -14,6 +15,15 @@ namespace utils {
 		return buffer.str();
 	}
 
+	/**
+	* Monotonic wall-clock time, doesn't require a GLFW context.
+	* @return {double} Time in seconds.
+	*/
+	inline double getTime() {
+		using namespace std::chrono;
+		return duration<double>(steady_clock::now().time_since_epoch()).count();
+	}
+
 	/**
 	* Format a value of bytes into more readable units.
 	* @param {size_t}  bytes
@@ -5,7 +5,7 @@
 #FILE:bxdf/Fresnel.cl
 
 /*-------------- LAMBERTIAN ---------------*/
-#FILE:bxdf/materials/Lambert.cl
+#FILE:bxdf/Materials/Lambert.cl
 
 /*----------------- FIBER -----------------*/
 
@@ -41,15 +41,15 @@ void LambertianFiberBCSDF(
 #define LambertianFiberBCSDF_pdf(ray) lambertianCylinder(&ray->dir)
 
 /*---------- DIELECTRIC ----------*/
-#FILE:bxdf/materials/Dielectric.cl
-#FILE:bxdf/materials/RoughDielectric.cl
+#FILE:bxdf/Materials/Dielectric.cl
+#FILE:bxdf/Materials/RoughDielectric.cl
 
 /*---------- CONDUCTOR ----------*/
-#FILE:bxdf/materials/Conductor.cl
-#FILE:bxdf/materials/RoughConductor.cl
+#FILE:bxdf/Materials/Conductor.cl
+#FILE:bxdf/Materials/RoughConductor.cl
 
 /*---------- COAT ----------*/
-#FILE:bxdf/materials/Coat.cl
+#FILE:bxdf/Materials/Coat.cl
 
 
 //------------------------------------------------------------------
@@ -8,7 +8,7 @@ float intersectAxis(int axis, const float p, const Ray* ray){
 	return fma(p, ((float*)(&invDir))[axis], ((float*)(&scaled_origin))[axis]);
 }
 
-float2 intersectNode(__constant new_bvhNode* node, const Ray* ray){
+float2 intersectNode(__global const new_bvhNode* node, const Ray* ray){
 	int3 octant = (int3)(ray->dir.x < 0.0f, ray->dir.y < 0.0f, ray->dir.z < 0.0f);
 	
 	float entry0 = intersectAxis(0, node->bounds[0 * 2 + octant.x], ray);
@@ -25,26 +25,135 @@ float2 intersectNode(__constant new_bvhNode* node, const Ray* ray){
 	);
 } 
 
+/* binary traversal, the wide layouts are traversed in geometry/wide_bvh.cl. The top-level BVH always uses binary nodes */
+#if BVH_WIDTH == 2
+
 bool intersectLeafShadows(const Scene* scene, 
-	__constant new_bvhNode* node, 
+	__global const new_bvhNode* node, 
 	Ray* ray){
 
 	uint begin = node->first_child_or_primitive;
 	uint end = begin + node->primitive_count;
+
+	RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
 	
 	for(uint i = begin; i < end; ++i){
+		RAY_STATS_ADD(scene->stats, RAY_STATS_TRIANGLES, 1)
 		if(intersectTriangle(scene, ray, i))
 			return true;
 	}
 	return false;
 }
 
+bool intersectLeaf(const Scene* scene, 
+	__global const new_bvhNode* node, 
+	Ray* ray){
+
+	uint begin = node->first_child_or_primitive;
+	uint end = begin + node->primitive_count;
+	
+	RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+	RAY_STATS_ADD(scene->stats, RAY_STATS_TRIANGLES, end - begin)
+
+	bool res = false;
+	for(uint i = begin; i < end; ++i){
+		res |= intersectTriangle(scene, ray, i);
+	}
+	return res;
+}
+
+/*
+ * Stackless traversal with parent pointers (Hapala et al. 2011): the walk goes back up
+ * through the parents instead of popping a stack, the near child is picked along the
+ * node's split axis. No private memory per work-item and no depth limit, at the cost
+ * of revisiting the parents. The stack traversals hand it the subtrees they can't
+ * push anymore.
+ */
+#define BVH_FROM_PARENT		0
+#define BVH_FROM_SIBLING	1
+#define BVH_FROM_CHILD		2
+
+#define BVH_SPLIT_AXIS		0x3u
+#define BVH_SPLIT_FLIP		0x4u
+#define BVH_SECOND_CHILD	0x8u
+
+uint nearChild(__global const new_bvhNode* node, const Ray* ray){
+	const uint axis = node->split & BVH_SPLIT_AXIS;
+	const uint negative = ((const float*)(&ray->dir))[axis] < 0.0f;
+	return node->first_child_or_primitive + (negative ^ ((node->split & BVH_SPLIT_FLIP) != 0));
+}
+
+uint siblingOf(__global const new_bvhNode* node, const uint index){
+	return (node->split & BVH_SECOND_CHILD) ? index - 1 : index + 1;
+}
+
+/* the walk ends when it gets back to `root`, the tree's root is its own parent */
+bool traverseStackless(const Scene* scene, Ray* ray, const uint root, const bool anyHit) {
+	__global const new_bvhNode* nodes = scene->new_nodes;
+
+	if(nodes[root].isLeaf){
+		LOGWARNING("[Warning]: root is a leaf!\n");
+		return anyHit ? intersectLeafShadows(scene, &nodes[root], ray) : intersectLeaf(scene, &nodes[root], ray);
+	}
+
+	RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+
+	uint current = nearChild(&nodes[root], ray);
+	uchar state = BVH_FROM_PARENT;
+	bool hit = false;
+
+	while(true){
+		__global const new_bvhNode* node = &nodes[current];
+
+		if(state == BVH_FROM_CHILD){
+			if(current == root)
+				return hit;
+
+			// the far child is left once the near one is done
+			if(current == nearChild(&nodes[node->parent], ray)){
+				current = siblingOf(node, current);
+				state = BVH_FROM_SIBLING;
+			} else {
+				current = node->parent;
+			}
+			continue;
+		}
+
+		const float2 dist = intersectNode(node, ray);
+		if(dist.x <= dist.y){
+			if(!node->isLeaf){
+				RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+				current = nearChild(node, ray);
+				state = BVH_FROM_PARENT;
+				continue;
+			}
+
+			if(anyHit){
+				if(intersectLeafShadows(scene, node, ray))
+					return true;
+			} else {
+				hit |= intersectLeaf(scene, node, ray);
+			}
+		}
+
+		// missed or done with the leaf
+		if(state == BVH_FROM_PARENT){
+			current = siblingOf(node, current);
+			state = BVH_FROM_SIBLING;
+		} else {
+			current = node->parent;
+			state = BVH_FROM_CHILD;
+		}
+	}
+}
+
+#ifndef BVH_STACKLESS
 #define STACK_SIZE 8
-bool traverseShadows(const Scene* scene, Ray* ray) {
-	__constant new_bvhNode* stack[STACK_SIZE];
+bool traverseShadows(const Scene* scene, Ray* ray, const uint root) {
+	__global const new_bvhNode* stack[STACK_SIZE];
 	uchar stackSize = 0;
 	
-	__constant new_bvhNode* node = &scene->new_nodes[0];
+	__global const new_bvhNode* node = &scene->new_nodes[root];
 
 	if(node->isLeaf){
 		LOGWARNING("[Warning]: root is a leaf!\n");
@@ -52,10 +161,12 @@ bool traverseShadows(const Scene* scene, Ray* ray) {
 	}
 
 	while(true){
+		RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+
 		uint first_child = node->first_child_or_primitive;
-		__constant new_bvhNode* left_child = 
+		__global const new_bvhNode* left_child = 
 			&scene->new_nodes[first_child + 0];
-		__constant new_bvhNode* right_child = 
+		__global const new_bvhNode* right_child = 
 			&scene->new_nodes[first_child + 1];
 		float2 dist_left = intersectNode(left_child, ray);
 		float2 dist_right = intersectNode(right_child, ray);
@@ -90,11 +201,17 @@ bool traverseShadows(const Scene* scene, Ray* ray) {
 			node = l_child ? left_child : right_child;
 		} else if(l_child & r_child){
 			if(dist_left.x > dist_right.x){
-				__constant new_bvhNode* temp = left_child;
+				__global const new_bvhNode* temp = left_child;
 				left_child = right_child;
 				right_child = temp;
 			}
-			stack[stackSize++] = right_child;
+			if(stackSize < STACK_SIZE){
+				stack[stackSize++] = right_child;
+				RAY_STATS_MAX(scene->stats, shadow_stack, stackSize)
+			} else if(traverseStackless(scene, ray, right_child - scene->new_nodes, true)){
+				/* the stack is full, the far child is done right away */
+				return true;
+			}
 			node = left_child;
 		} else {
 			if(stackSize == 0)
@@ -102,38 +219,22 @@ bool traverseShadows(const Scene* scene, Ray* ray) {
 			node = stack[--stackSize];
 		}
 	}
-#if DEBUG
-#if VIEW_OPTION == VIEW_STACK_INDEX
+#if DEBUG && VIEW_OPTION == VIEW_STACK_INDEX
 	ray->bvh_stackSize = stackSize;
 #endif
-	if(stackSize >= STACK_SIZE)
-		LOGWARNING("[WARNING]: exceeded max stack size!\n");
-#endif
 
 	return false;
 }
 #undef STACK_SIZE
+#endif
 
-bool intersectLeaf(const Scene* scene, 
-	__constant new_bvhNode* node, 
-	Ray* ray){
-
-	uint begin = node->first_child_or_primitive;
-	uint end = begin + node->primitive_count;
-	
-	bool res = false;
-	for(uint i = begin; i < end; ++i){
-		res |= intersectTriangle(scene, ray, i);
-	}
-	return res;
-}
-
+#ifndef BVH_STACKLESS
 #define STACK_SIZE 64
-bool traverse(const Scene* scene, Ray* ray) {
-	__constant new_bvhNode* stack[STACK_SIZE];
+bool traverse(const Scene* scene, Ray* ray, const uint root) {
+	__global const new_bvhNode* stack[STACK_SIZE];
 	uchar stackSize = 0;
 	
-	__constant new_bvhNode* node = &scene->new_nodes[0];
+	__global const new_bvhNode* node = &scene->new_nodes[root];
 
 	if(node->isLeaf){
 		LOGWARNING("[Warning]: root is a leaf!\n");
@@ -142,10 +243,12 @@ bool traverse(const Scene* scene, Ray* ray) {
 
 
 	while(true){
+		RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+
 		uint first_child = node->first_child_or_primitive;
-		__constant new_bvhNode* left_child = 
+		__global const new_bvhNode* left_child = 
 			&scene->new_nodes[first_child + 0];
-		__constant new_bvhNode* right_child = 
+		__global const new_bvhNode* right_child = 
 			&scene->new_nodes[first_child + 1];
 		float2 dist_left = intersectNode(left_child, ray);
 		float2 dist_right = intersectNode(right_child, ray);
@@ -182,11 +285,18 @@ bool traverse(const Scene* scene, Ray* ray) {
 			node = l_child ? left_child : right_child;
 		} else if(l_child & r_child){
 			if(dist_left.x > dist_right.x){
-				__constant new_bvhNode* temp = left_child;
+				__global const new_bvhNode* temp = left_child;
 				left_child = right_child;
 				right_child = temp;
 			}
-			stack[stackSize++] = right_child;
+			if(stackSize < STACK_SIZE){
+				stack[stackSize++] = right_child;
+				RAY_STATS_MAX(scene->stats, stack, stackSize)
+			} else if(traverseStackless(scene, ray, right_child - scene->new_nodes, false)){
+				/* the stack is full, the far child is done right away */
+				if(ray->t <= EPS)
+					return true;
+			}
 			node = left_child;
 		} else {
 			if(stackSize == 0)
@@ -194,16 +304,29 @@ bool traverse(const Scene* scene, Ray* ray) {
 			node = stack[--stackSize];
 		}
 	}
-#if DEBUG
-#if VIEW_OPTION == VIEW_STACK_INDEX
+#if DEBUG && VIEW_OPTION == VIEW_STACK_INDEX
 	ray->bvh_stackSize = stackSize;
 #endif
-	if(stackSize >= STACK_SIZE)
-		LOGWARNING("[WARNING]: exceeded max stack size!\n");
-#endif
 
 	return false;
 }
 #undef STACK_SIZE
+#endif
+
+#ifdef BVH_STACKLESS
+bool traverseShadows(const Scene* scene, Ray* ray, const uint root) {
+	return traverseStackless(scene, ray, root, true);
+}
+
+bool traverse(const Scene* scene, Ray* ray, const uint root) {
+	return traverseStackless(scene, ray, root, false);
+}
+#endif
+
+#undef BVH_FROM_PARENT
+#undef BVH_FROM_SIBLING
+#undef BVH_FROM_CHILD
+
+#endif
 
 #endif
\ No newline at end of file
@@ -7,6 +7,8 @@
 #FILE:geometry/aabb.cl
 #FILE:geometry/triangle.cl
 #FILE:geometry/bvh.cl
+#FILE:geometry/wide_bvh.cl
+#FILE:geometry/tlas.cl
 
 bool sampleDirect(
 	const Mesh* mesh, 
@@ -0,0 +1,350 @@
+#ifndef __LBVH__
+#define __LBVH__
+
+/*
+ * Device build of a model's binary BVH, see include/BVH/lbvh.h
+ * (Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"):
+ *
+ *   lbvh_morton          30-bit Morton code of every face's centroid on a 1024^3 grid of the model's box
+ *   lbvh_radix_count     4 bits per pass: digit counts of every work-group,
+ *   lbvh_radix_scan      their offsets (digit major, so the sort is stable across groups)
+ *   lbvh_radix_scatter   and the keys sorted on the digit within the group, then scattered
+ *   lbvh_hierarchy       the split of every internal node from the sorted codes
+ *   lbvh_leaves          one leaf per face, the faces in leaf order and the bounds merged bottom-up:
+ *                        the second child to arrive at a node continues with it
+ *
+ * Karras' internal node i is stored at 0 for the root, else at 2p + 1 or 2p + 2 as the left or
+ * right child of internal node p, so every child pair is adjacent like traverse() expects.
+ * Every kernel runs work-groups of LBVH_GROUP_SIZE work-items, keep in sync with the host.
+ */
+
+#define LBVH_GROUP_SIZE		256
+#define LBVH_RADIX_BITS		4
+#define LBVH_RADIX			(1 << LBVH_RADIX_BITS)
+
+/* keep in sync with geometry/bvh.cl and include/BVH/bvh.h */
+#define LBVH_SPLIT_FLIP		0x4u
+#define LBVH_SECOND_CHILD	0x8u
+
+/* 10 bits spread to every third bit */
+uint expandBits(uint v){
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/* `p` in [0, 1]^3 */
+uint morton3D(const float3 p){
+	const float3 q = clamp(p * 1024.0f, 0.0f, 1023.0f);
+	return (expandBits((uint)q.x) << 2) | (expandBits((uint)q.y) << 1) | expandBits((uint)q.z);
+}
+
+/* exclusive prefix sum of one value per work-item, `total` receives the sum of the group */
+uint scanGroup(const uint value, __local uint* scratch, uint* total){
+	const uint lid = get_local_id(0);
+
+	scratch[lid] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(uint offset = 1; offset < LBVH_GROUP_SIZE; offset <<= 1){
+		const uint add = lid >= offset ? scratch[lid - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[lid] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	*total = scratch[LBVH_GROUP_SIZE - 1];
+	const uint inclusive = scratch[lid];
+	/* `scratch` is reused by the next call */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return inclusive - value;
+}
+
+__kernel void lbvh_morton(
+	/* the model's faces, uint3 of vertex indices each */
+	__global const uint* faces,
+	__global const float* vertices,
+	const uint face_count,
+
+	/* the model's box, the centroids are quantized on a 1024^3 grid of it */
+	const float4 lo,
+	const float4 inv_extent,
+
+	__global uint* keys,
+	__global uint* values
+) {
+	const uint i = get_global_id(0);
+	if(i >= face_count)
+		return;
+
+	const uint3 face = vload3(i, faces);
+	const float3 p0 = vload3(face.x, vertices);
+	const float3 p1 = vload3(face.y, vertices);
+	const float3 p2 = vload3(face.z, vertices);
+
+	const float3 center = (fmin(fmin(p0, p1), p2) + fmax(fmax(p0, p1), p2)) * 0.5f;
+	keys[i] = morton3D((center - lo.xyz) * inv_extent.xyz);
+	values[i] = i;
+}
+
+__kernel void lbvh_radix_count(
+	__global const uint* keys,
+	const uint count,
+	const uint shift,
+
+	/* [LBVH_RADIX * groups], digit major */
+	__global uint* histograms
+) {
+	__local uint counts[LBVH_RADIX];
+
+	const uint lid = get_local_id(0);
+	const uint i = get_global_id(0);
+
+	if(lid < LBVH_RADIX)
+		counts[lid] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(i < count)
+		atomic_inc(&counts[(keys[i] >> shift) & (LBVH_RADIX - 1)]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(lid < LBVH_RADIX)
+		histograms[lid * get_num_groups(0) + get_group_id(0)] = counts[lid];
+}
+
+/* a single work-group, every work-item scans a contiguous chunk */
+__kernel void lbvh_radix_scan(
+	__global uint* histograms,
+	const uint size
+) {
+	__local uint scratch[LBVH_GROUP_SIZE];
+
+	const uint lid = get_local_id(0);
+	const uint chunk = (size + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE;
+	const uint begin = min(lid * chunk, size);
+	const uint end = min(begin + chunk, size);
+
+	uint sum = 0;
+	for(uint i = begin; i < end; ++i)
+		sum += histograms[i];
+
+	uint total;
+	uint offset = scanGroup(sum, scratch, &total);
+	for(uint i = begin; i < end; ++i){
+		const uint c = histograms[i];
+		histograms[i] = offset;
+		offset += c;
+	}
+}
+
+__kernel void lbvh_radix_scatter(
+	__global const uint* keys_in,
+	__global const uint* values_in,
+	const uint count,
+	const uint shift,
+
+	/* scanned by lbvh_radix_scan */
+	__global const uint* histograms,
+
+	__global uint* keys_out,
+	__global uint* values_out
+) {
+	__local uint scratch[LBVH_GROUP_SIZE];
+	__local uint local_keys[LBVH_GROUP_SIZE];
+	__local uint local_values[LBVH_GROUP_SIZE];
+	__local uint digit_start[LBVH_RADIX];
+
+	const uint lid = get_local_id(0);
+	const uint i = get_global_id(0);
+	const uint group = get_group_id(0);
+	const uint valid_count = min((uint)LBVH_GROUP_SIZE, count - group * LBVH_GROUP_SIZE);
+
+	/* the padding sorts behind the last digit of the group */
+	uint key = i < count ? keys_in[i] : 0xFFFFFFFFu;
+	uint value = i < count ? values_in[i] : 0;
+	uint digit = (key >> shift) & (LBVH_RADIX - 1);
+
+	/* stable sort of the group on the digit, one split per bit */
+	for(uint b = 0; b < LBVH_RADIX_BITS; ++b){
+		const uint bit = (digit >> b) & 1;
+		uint ones;
+		const uint ones_before = scanGroup(bit, scratch, &ones);
+		const uint slot = bit ? (LBVH_GROUP_SIZE - ones) + ones_before : lid - ones_before;
+
+		local_keys[slot] = key;
+		local_values[slot] = value;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		key = local_keys[lid];
+		value = local_values[lid];
+		digit = (key >> shift) & (LBVH_RADIX - 1);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	/* the first item of every digit's run, the padding is the tail of the group */
+	const bool valid = lid < valid_count;
+	if(valid && (lid == 0 || ((local_keys[lid - 1] >> shift) & (LBVH_RADIX - 1)) != digit))
+		digit_start[digit] = lid;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(valid){
+		const uint dst = histograms[digit * get_num_groups(0) + group] + lid - digit_start[digit];
+		keys_out[dst] = key;
+		values_out[dst] = value;
+	}
+}
+
+/* common prefix length of the sorted keys i and j, equal keys fall back to their indices */
+int lbvhDelta(__global const uint* keys, const int count, const int i, const int j){
+	if(j < 0 || j >= count)
+		return -1;
+
+	const uint a = keys[i];
+	const uint b = keys[j];
+	return a == b ? 32 + (int)clz((uint)i ^ (uint)j) : (int)clz(a ^ b);
+}
+
+/* Karras' numbering: internal nodes 0 .. count - 2, then the leaves */
+__kernel void lbvh_hierarchy(
+	__global const uint* keys,
+	const uint count,
+
+	/* per internal node */
+	__global uint2* children,
+	/* per node, the internal node it hangs from */
+	__global uint* parents
+) {
+	const int i = get_global_id(0);
+	const int n = count;
+	if(i >= n - 1)
+		return;
+
+	/* the node's range grows towards the neighbour with the longer common prefix */
+	const int d = lbvhDelta(keys, n, i, i + 1) > lbvhDelta(keys, n, i, i - 1) ? 1 : -1;
+	const int delta_min = lbvhDelta(keys, n, i, i - d);
+
+	int l_max = 2;
+	while(lbvhDelta(keys, n, i, i + l_max * d) > delta_min)
+		l_max <<= 1;
+
+	int l = 0;
+	for(int t = l_max >> 1; t > 0; t >>= 1){
+		if(lbvhDelta(keys, n, i, i + (l + t) * d) > delta_min)
+			l += t;
+	}
+	const int j = i + l * d;
+
+	/* the split is where the common prefix of the range ends */
+	const int delta_node = lbvhDelta(keys, n, i, j);
+	int s = 0;
+	int t = l;
+	do {
+		t = (t + 1) >> 1;
+		if(lbvhDelta(keys, n, i, i + (s + t) * d) > delta_node)
+			s += t;
+	} while(t > 1);
+	const int gamma = i + s * d + min(d, 0);
+
+	const uint left = min(i, j) == gamma ? (n - 1) + gamma : gamma;
+	const uint right = max(i, j) == gamma + 1 ? (n - 1) + gamma + 1 : gamma + 1;
+	children[i] = (uint2)(left, right);
+	parents[left] = i;
+	parents[right] = i;
+}
+
+/* where Karras' node goes in the output, relative to the model's root */
+uint lbvhSlot(__global const uint2* children, __global const uint* parents, const uint node){
+	if(node == 0)
+		return 0;
+
+	const uint parent = parents[node];
+	return 2 * parent + (children[parent].x == node ? 1 : 2);
+}
+
+__kernel void lbvh_leaves(
+	/* the model's faces in their original order */
+	__global const uint* faces_in,
+	__global const float* vertices,
+	__global const uint* values,
+	__global const uint2* children,
+	__global const uint* parents,
+	const uint count,
+
+	/* where the model starts in the shared node and face buffers */
+	const uint root,
+	const uint primitive_offset,
+
+	__global uint* faces_out,
+	__global new_bvhNode* nodes,
+
+	/* per internal node, the children that are done. Cleared by the host */
+	__global volatile uint* arrivals
+) {
+	const uint i = get_global_id(0);
+	if(i >= count)
+		return;
+
+	const uint3 face = vload3(values[i], faces_in);
+	vstore3(face, primitive_offset + i, faces_out);
+
+	const float3 p0 = vload3(face.x, vertices);
+	const float3 p1 = vload3(face.y, vertices);
+	const float3 p2 = vload3(face.z, vertices);
+	float3 lo = fmin(fmin(p0, p1), p2);
+	float3 hi = fmax(fmax(p0, p1), p2);
+
+	/* a single face is the root, its own parent */
+	uint node = count > 1 ? (count - 1) + i : 0;
+	uint slot = lbvhSlot(children, parents, node);
+	{
+		__global new_bvhNode* leaf = &nodes[root + slot];
+		leaf->bounds[0] = lo.x; leaf->bounds[1] = hi.x;
+		leaf->bounds[2] = lo.y; leaf->bounds[3] = hi.y;
+		leaf->bounds[4] = lo.z; leaf->bounds[5] = hi.z;
+		leaf->first_child_or_primitive = primitive_offset + i;
+		leaf->primitive_count = 1;
+		leaf->parent = root + (node ? lbvhSlot(children, parents, parents[node]) : 0);
+		leaf->isLeaf = true;
+		leaf->split = (slot && !(slot & 1)) ? LBVH_SECOND_CHILD : 0;
+	}
+
+	while(node != 0){
+		node = parents[node];
+
+		/* the child's node is written before it counts as done */
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+		if(atomic_inc(&arrivals[node]) == 0)
+			return;
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+		const uint first_child = 2 * node + 1;
+		const uint sibling = slot == first_child ? first_child + 1 : first_child;
+		__global volatile const new_bvhNode* other = &nodes[root + sibling];
+		const float3 other_lo = (float3)(other->bounds[0], other->bounds[2], other->bounds[4]);
+		const float3 other_hi = (float3)(other->bounds[1], other->bounds[3], other->bounds[5]);
+
+		/* the near child along the axis the children's centers are furthest apart on, see BVH::PrepareData() */
+		const float3 center = slot == first_child ? lo + hi : other_lo + other_hi;
+		const float3 other_center = slot == first_child ? other_lo + other_hi : lo + hi;
+		const float3 separation = fabs(other_center - center);
+		const uint axis = separation.x >= separation.y && separation.x >= separation.z ? 0 : (separation.y >= separation.z ? 1 : 2);
+		const bool flip = ((const float*)&other_center)[axis] < ((const float*)&center)[axis];
+
+		lo = fmin(lo, other_lo);
+		hi = fmax(hi, other_hi);
+		slot = lbvhSlot(children, parents, node);
+
+		__global new_bvhNode* inner = &nodes[root + slot];
+		inner->bounds[0] = lo.x; inner->bounds[1] = hi.x;
+		inner->bounds[2] = lo.y; inner->bounds[3] = hi.y;
+		inner->bounds[4] = lo.z; inner->bounds[5] = hi.z;
+		inner->first_child_or_primitive = root + first_child;
+		inner->primitive_count = 0;
+		inner->parent = root + (node ? lbvhSlot(children, parents, parents[node]) : 0);
+		inner->isLeaf = false;
+		inner->split = axis | (flip ? LBVH_SPLIT_FLIP : 0) | ((slot && !(slot & 1)) ? LBVH_SECOND_CHILD : 0);
+	}
+}
+
+#endif
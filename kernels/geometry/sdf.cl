@@ -55,7 +55,7 @@ float s_map(const Mesh* sdf, const float3 pos) {
 	return INF;
 }
 
-float map(__constant Mesh* meshes, const float tmin, const float3 pos, int* mesh_id, const uint* mesh_count) {
+float map(__global const Mesh* meshes, const float tmin, const float3 pos, int* mesh_id, const uint* mesh_count) {
 
 	float dist = tmin;
 
@@ -86,11 +86,11 @@ float3 calcNormal(const Mesh* mesh, const float3 pos) {
 
 /*----------------------------------- Raymarching -----------------------------------*/
 
-bool shadow_sdf(__constant Mesh* meshes, Ray* ray, const uint* mesh_count) {
+bool shadow_sdf(__global const Mesh* meshes, Ray* ray, const uint* mesh_count, const int steps) {
 	float t = EPS * 100.0f;
 	int id;
 
-	for (int i = 0; i < SHADOW_MARCHING_STEPS; ++i) {
+	for (int i = 0; i < steps; ++i) {
 		float h = fabs(map(meshes, ray->t, (ray->origin + ray->dir * t), &id, mesh_count));
 		t += h;
 		if (h < EPS || t > ray->t) break;
@@ -100,11 +100,11 @@ bool shadow_sdf(__constant Mesh* meshes, Ray* ray, const uint* mesh_count) {
 }
 
 /* sdf intersection */
-bool intesect_sdf(__constant Mesh* meshes, Ray* ray, int* mesh_id, const uint* mesh_count) {
+bool intesect_sdf(__global const Mesh* meshes, Ray* ray, int* mesh_id, const uint* mesh_count, const int steps) {
 	float t = EPS*10.0f;
 	int id;
 
-	for (int i = 0; i < MARCHING_STEPS; ++i) {
+	for (int i = 0; i < steps; ++i) {
 		float h = fabs(map(meshes, ray->t, (ray->origin + ray->dir * t), &id, mesh_count));
 		if (h < EPS || t > ray->t) break;
 		t += h;
@@ -0,0 +1,179 @@
+#ifndef __TLAS__
+#define __TLAS__
+
+/*
+ * Top-level BVH over the spheres, boxes, quads and the instances, stored right behind
+ * the meshes and the instances. Every leaf holds one object: its mesh index or
+ * TLAS_INSTANCE | the instance index, the model's BVH is traversed from the leaf in
+ * object space. Keep in sync with include/BVH/tlas.h
+ */
+#define TLAS_INSTANCE	0x80000000u
+/* the host keeps every leaf within TLAS_MAX_DEPTH = 32 levels, at most 31 far children are pending */
+#define TLAS_STACK_SIZE	32
+
+__global const Instance* sceneInstances(const Scene* scene){
+	return (__global const Instance*)(scene->meshes + scene->mesh_count[7]);
+}
+
+__global const new_bvhNode* sceneTLAS(const Scene* scene){
+	return (__global const new_bvhNode*)(sceneInstances(scene) + scene->mesh_count[4]);
+}
+
+/* the ray in the instance's object space, the direction isn't normalized so t stays the same */
+Ray instanceRay(__global const Instance* instance, const Ray* ray){
+	const float4 o = (float4)(ray->origin, 1.0f);
+	const float4 d = (float4)(ray->dir, 0.0f);
+
+	Ray object_ray = *ray;
+	object_ray.origin = (float3)(dot(instance->world_to_object[0], o), dot(instance->world_to_object[1], o), dot(instance->world_to_object[2], o));
+	object_ray.dir = (float3)(dot(instance->world_to_object[0], d), dot(instance->world_to_object[1], d), dot(instance->world_to_object[2], d));
+	return object_ray;
+}
+
+/* closest hit, `mesh_id` is -(k + 1) for the k-th instance */
+void intersectObject(const Scene* scene, Ray* ray, int* mesh_id, const uint ref){
+	if(ref & TLAS_INSTANCE){
+		const uint k = ref & ~TLAS_INSTANCE;
+		__global const Instance* instance = &sceneInstances(scene)[k];
+
+		Ray object_ray = instanceRay(instance, ray);
+		traverse(scene, &object_ray, instance->root);
+		if(object_ray.t < ray->t){
+			/* the normal goes back with the inverse transpose */
+			const float3 n = object_ray.normal;
+			ray->t = object_ray.t;
+			ray->normal = normalize(instance->world_to_object[0].xyz * n.x + instance->world_to_object[1].xyz * n.y + instance->world_to_object[2].xyz * n.z);
+			ray->pos = ray->origin + ray->dir * ray->t;
+			*mesh_id = -(int)k - 1;
+		}
+		return;
+	}
+
+	RAY_STATS_ADD(scene->stats, RAY_STATS_PRIMITIVES, 1)
+
+	Mesh mesh = scene->meshes[ref]; /* local copy */
+
+#ifdef __SPHERE__
+	if(mesh.t & SPHERE){
+		if(intersect_sphere(ray, &mesh)){
+			ray->pos = ray->origin + ray->dir * ray->t;
+			ray->normal = fast_normalize(ray->pos - mesh.pos);
+			*mesh_id = ref;
+		}
+		return;
+	}
+#endif
+#ifdef __BOX__
+	if(mesh.t & BOX){
+		if(intersect_box(&mesh, ray)){
+			ray->pos = ray->origin + ray->dir * ray->t;
+			*mesh_id = ref;
+		}
+		return;
+	}
+#endif
+#ifdef __QUAD__
+	if(mesh.t & QUAD){
+		if(intersect_quad(&mesh, ray))
+			*mesh_id = ref;
+	}
+#endif
+}
+
+/* any hit closer than ray->t */
+bool occludedObject(const Scene* scene, Ray* ray, const uint ref){
+	if(ref & TLAS_INSTANCE){
+		__global const Instance* instance = &sceneInstances(scene)[ref & ~TLAS_INSTANCE];
+
+		Ray object_ray = instanceRay(instance, ray);
+		return traverseShadows(scene, &object_ray, instance->root);
+	}
+
+	RAY_STATS_ADD(scene->stats, RAY_STATS_PRIMITIVES, 1)
+
+	Mesh mesh = scene->meshes[ref]; /* local copy */
+
+#ifdef __SPHERE__
+	if(mesh.t & SPHERE)
+		return intersect_sphere(ray, &mesh);
+#endif
+#ifdef __BOX__
+	if(mesh.t & BOX)
+		return intersect_box(&mesh, ray);
+#endif
+#ifdef __QUAD__
+	if(mesh.t & QUAD)
+		return intersect_quad(&mesh, ray);
+#endif
+	return false;
+}
+
+/* closest hit over every object but the SDFs, visits the children front to back */
+bool traverseTLAS(const Scene* scene, Ray* ray, int* mesh_id, const bool anyHit){
+	__global const new_bvhNode* nodes = sceneTLAS(scene);
+
+	uint stack[TLAS_STACK_SIZE];
+	uint stackSize = 0;
+
+	const float2 dist_root = intersectNode(&nodes[0], ray);
+	if(dist_root.x > dist_root.y)
+		return false;
+
+	if(nodes[0].isLeaf){
+		if(nodes[0].primitive_count == 0)
+			return false;
+		if(anyHit)
+			return occludedObject(scene, ray, nodes[0].first_child_or_primitive);
+		intersectObject(scene, ray, mesh_id, nodes[0].first_child_or_primitive);
+		return false;
+	}
+
+	uint current = 0;
+	while(true){
+		RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+
+		const uint first_child = nodes[current].first_child_or_primitive;
+		uint children[2] = { first_child + 0, first_child + 1 };
+		float entries[2];
+		uint count = 0;
+
+		for(uint i = 0; i < 2; ++i){
+			__global const new_bvhNode* child = &nodes[children[i]];
+			const float2 dist = intersectNode(child, ray);
+			if(dist.x > dist.y)
+				continue;
+
+			if(child->isLeaf){
+				if(anyHit){
+					if(occludedObject(scene, ray, child->first_child_or_primitive))
+						return true;
+				} else {
+					intersectObject(scene, ray, mesh_id, child->first_child_or_primitive);
+				}
+				continue;
+			}
+
+			children[count] = children[i];
+			entries[count++] = dist.x;
+		}
+
+		if(count == 2){
+			/* an internal node above TLAS_MAX_DEPTH pushes at most once per level, the stack can't overflow */
+			const uint nearest = entries[0] <= entries[1] ? 0 : 1;
+			stack[stackSize++] = children[1 - nearest];
+			current = children[nearest];
+		} else if(count == 1){
+			current = children[0];
+		} else {
+			if(stackSize == 0)
+				break;
+			current = stack[--stackSize];
+		}
+	}
+
+	return false;
+}
+
+#undef TLAS_STACK_SIZE
+
+#endif
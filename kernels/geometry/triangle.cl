@@ -4,10 +4,10 @@
 bool intersectTriangle(
 	const Scene* scene, Ray* ray, const uint fIndex
 ) {
-	const uint fv = scene->indices[fIndex]*3;
-	const float3 p0 = scene->vertices[fv+0].xyz;
-	const float3 p1 = scene->vertices[fv+1].xyz;
-	const float3 p2 = scene->vertices[fv+2].xyz;
+	const uint3 face = vload3(fIndex, scene->faces);
+	const float3 p0 = vload3(face.x, scene->vertices);
+	const float3 p1 = vload3(face.y, scene->vertices);
+	const float3 p2 = vload3(face.z, scene->vertices);
 
 	const float3 e1 = p0 - p1;
 	const float3 e2 = p2 - p0;
@@ -27,9 +27,9 @@ bool intersectTriangle(
 		if(t > EPS && t < ray->t){
 			ray->t = t;
 #if 1  // smooth shading
-			const float3 n0 = scene->normals[fv+0].xyz;
-			const float3 n1 = scene->normals[fv+1].xyz;
-			const float3 n2 = scene->normals[fv+2].xyz;
+			const float3 n0 = vload3(face.x, scene->normals);
+			const float3 n1 = vload3(face.y, scene->normals);
+			const float3 n2 = vload3(face.z, scene->normals);
 
 			ray->normal = w * n0 + u * n1 + v * n2;
 #else
@@ -0,0 +1,129 @@
+#ifndef __WIDE_BVH__
+#define __WIDE_BVH__
+
+#if BVH_WIDTH > 2
+
+/* child codes, keep in sync with include/BVH/wide_bvh.h */
+#define WIDE_EMPTY		0xFFFFFFFFu
+#define WIDE_LEAF		0x80000000u
+#define WIDE_FIRST_MASK	0x03FFFFFFu
+
+/* the host keeps the internal nodes within 64 / (BVH_WIDTH - 1) levels, see WideCollapser::build() */
+#define WIDE_STACK_SIZE 64
+
+/* 2^exponent per axis, built straight from the exponent bits */
+float3 wideScale(__global const BVHNode* node){
+	return (float3)(
+		as_float((uint)(node->exponent[0] + 127) << 23),
+		as_float((uint)(node->exponent[1] + 127) << 23),
+		as_float((uint)(node->exponent[2] + 127) << 23)
+	);
+}
+
+/* visits the hit children front to back, leaves are intersected as soon as their box is hit */
+bool traverseWide(const Scene* scene, Ray* ray, const uint root, const bool anyHit) {
+	uint stack[WIDE_STACK_SIZE];
+	uint stackSize = 0;
+
+	const float3 invDir = native_recip(ray->dir);
+	uint nodeIndex = root;
+	bool hit = false;
+
+	while(true){
+		__global const BVHNode* node = &scene->new_nodes[nodeIndex];
+		RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+
+		const float3 origin = vload3(0, node->origin);
+		const float3 scale = wideScale(node);
+
+		uint children[BVH_WIDTH];
+		float dists[BVH_WIDTH];
+		uint count = 0;
+
+		for(uint i = 0; i < BVH_WIDTH; ++i){
+			const uint child = node->child[i];
+			if(child == WIDE_EMPTY)
+				continue;
+
+			const float3 lo = (float3)(node->lo[0][i], node->lo[1][i], node->lo[2][i]);
+			const float3 hi = (float3)(node->hi[0][i], node->hi[1][i], node->hi[2][i]);
+			const float3 t0 = (fma(lo, scale, origin) - ray->origin) * invDir;
+			const float3 t1 = (fma(hi, scale, origin) - ray->origin) * invDir;
+			const float3 tmin = fmin(t0, t1);
+			const float3 tmax = fmax(t0, t1);
+
+			const float entry = fmax(tmin.x, fmax(tmin.y, fmax(tmin.z, EPS)));
+			const float exit = fmin(tmax.x, fmin(tmax.y, fmin(tmax.z, ray->t)));
+			if(entry > exit)
+				continue;
+
+			if(child & WIDE_LEAF){
+				const uint begin = child & WIDE_FIRST_MASK;
+				const uint end = begin + ((child >> 26) & 31u) + 1;
+
+				RAY_STATS_ADD(scene->stats, RAY_STATS_NODES, 1)
+				RAY_STATS_ADD(scene->stats, RAY_STATS_TRIANGLES, end - begin)
+
+				for(uint p = begin; p < end; ++p){
+					if(intersectTriangle(scene, ray, p)){
+						if(anyHit)
+							return true;
+						hit = true;
+					}
+				}
+				continue;
+			}
+
+			/* insertion sort, nearest first */
+			uint j = count++;
+			while(j > 0 && dists[j - 1] > entry){
+				children[j] = children[j - 1];
+				dists[j] = dists[j - 1];
+				--j;
+			}
+			children[j] = child;
+			dists[j] = entry;
+		}
+
+		if(count == 0){
+			if(stackSize == 0)
+				break;
+			nodeIndex = stack[--stackSize];
+			continue;
+		}
+
+		/* the farthest child is popped last */
+		for(uint j = count - 1; j > 0; --j){
+			if(stackSize < WIDE_STACK_SIZE)
+				stack[stackSize++] = children[j];
+#if DEBUG
+			else
+				LOGWARNING("[WARNING]: exceeded max stack size!\n");
+#endif
+		}
+#ifdef RAY_STATS
+		if(anyHit){
+			RAY_STATS_MAX(scene->stats, shadow_stack, stackSize)
+		} else {
+			RAY_STATS_MAX(scene->stats, stack, stackSize)
+		}
+#endif
+		nodeIndex = children[0];
+	}
+
+	return hit;
+}
+
+bool traverseShadows(const Scene* scene, Ray* ray, const uint root) {
+	return traverseWide(scene, ray, root, true);
+}
+
+bool traverse(const Scene* scene, Ray* ray, const uint root) {
+	return traverseWide(scene, ray, root, false);
+}
+
+#undef WIDE_STACK_SIZE
+
+#endif
+
+#endif
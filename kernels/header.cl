@@ -42,25 +42,8 @@
 #GLOBAL_MEDIUM#
 #ifdef GLOBAL_MEDIUM
 //#define VOLUME_CAUSTICS
-
-#define GLOBAL_FOG_DENSITY		#GLOBAL_FOG_DENSITY#
-#define GLOBAL_FOG_SIGMA_A		#GLOBAL_FOG_SIGMA_A#
-#define GLOBAL_FOG_SIGMA_S		#GLOBAL_FOG_SIGMA_S#
-#define GLOBAL_FOG_SIGMA_T		#GLOBAL_FOG_SIGMA_T#
-#define GLOBAL_FOG_ABS_ONLY		#GLOBAL_FOG_ABS_ONLY#
 #endif
 
-/* Seperate bounce controls for eye tracing */
-#define MAX_BOUNCES				#MAX_BOUNCES#
-#define MAX_DIFF_BOUNCES		#MAX_DIFF_BOUNCES#
-#define MAX_SPEC_BOUNCES		#MAX_SPEC_BOUNCES#
-#define MAX_TRANS_BOUNCES		#MAX_TRANS_BOUNCES#
-#define MAX_SCATTERING_EVENTS	#MAX_SCATTERING_EVENTS#
-
-/* Raymarching Stuff */
-#define MARCHING_STEPS			#MARCHING_STEPS#
-#define SHADOW_MARCHING_STEPS	#SHADOW_MARCHING_STEPS#
-
 /* Mesh types */
 #define SPHERE	#SPHERE#
 #define BOX		#BOX#
@@ -111,12 +94,6 @@
 
 /* Light Sources */
 #ifdef LIGHT
-
-/* total light sources */
-#define LIGHT_COUNT				#LIGHT_COUNT#
-#define INV_LIGHT_COUNT			#INV_LIGHT_COUNT#
-/* light indices */
-__constant uint LIGHT_INDICES[LIGHT_COUNT] = { #LIGHT_INDICES# };
 /* max light bounces */
 #define LIGHT_BOUNCES			2
 #endif
@@ -144,13 +121,6 @@ __constant uint LIGHT_INDICES[LIGHT_COUNT] = { #LIGHT_INDICES# };
 
 //------------- Ray -------------
 
-typedef struct {
-	float3 origin;			// origin
-	float3 dir;				// direction
-	float time;
-	float dist;
-} TempRay;
-
 typedef struct {
 	float3 origin;			// origin
 	float3 dir;				// direction
@@ -246,6 +216,15 @@ typedef struct {
 	uchar t;		// type
 } Mesh;
 
+//------------- INSTANCE -------------
+
+/* a model placed in the scene, keep in sync with include/BVH/tlas.h */
+typedef struct {
+	float4 world_to_object[3];	/* rows of the inverse 3x4 transform */
+	uint root;					/* root of the model's BVH in new_nodes */
+	uint pad[3];
+} Instance;
+
 //------------- BVH -------------
 
 typedef struct {
@@ -253,13 +232,41 @@ typedef struct {
 	float4 bbMax;
 } bvhNode;
 
+/* parent and split are only read by the stackless traversal, see geometry/bvh.cl */
 typedef struct {
 	float bounds[6];
 	uint first_child_or_primitive;
 	uint primitive_count;
+	uint parent;
 	bool isLeaf;
+	uchar split;
 } new_bvhNode;
 
+/* branching factor of the uploaded BVH, the host passes -DBVH_WIDTH for the wide layouts */
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+
+/*
+ * BVH4/BVH8 node, the child boxes are quantized to 8 bits on a per axis grid of
+ * the node's box: origin + q * 2^exponent. See geometry/wide_bvh.cl and
+ * keep in sync with include/BVH/wide_bvh.h
+ */
+typedef struct {
+	float origin[3];
+	char exponent[3];
+	uchar pad;
+	uint child[BVH_WIDTH];
+	uchar lo[3][BVH_WIDTH];
+	uchar hi[3][BVH_WIDTH];
+} WideBVHNode;
+
+#if BVH_WIDTH > 2
+typedef WideBVHNode BVHNode;
+#else
+typedef new_bvhNode BVHNode;
+#endif
+
 //------------- Light Sampler -------------
 typedef struct {
 	float3 d;
@@ -276,14 +283,112 @@ typedef struct {
 } light_t;
 #endif
 
+//------------- Ray Statistics -------------
+
+/*
+ * Traversal counters, only compiled in when the program is built with -DRAY_STATS.
+ * Every work-item counts into a private RayStats and flushes it once per launch,
+ * the global buffer keeps each counter as a (low, high) uint pair and is never reset.
+ * Keep in sync with include/Profiling/ray_stats.h
+ */
+#define RAY_STATS_PRIMARY		0	/* camera rays */
+#define RAY_STATS_CLOSEST		1	/* intersect_scene() calls, camera rays included */
+#define RAY_STATS_SHADOW		2	/* shadow() calls */
+#define RAY_STATS_NODES			3	/* inner nodes and leaves visited */
+#define RAY_STATS_TRIANGLES		4	/* ray/triangle tests */
+#define RAY_STATS_PRIMITIVES	5	/* ray/sphere, box, quad tests and raymarched sdfs */
+#define RAY_STATS_COUNTERS		6
+
+/* high-water marks of the traversal stacks */
+#define RAY_STATS_STACK			(2 * RAY_STATS_COUNTERS)
+#define RAY_STATS_SHADOW_STACK	(RAY_STATS_STACK + 1)
+#define RAY_STATS_SIZE			(RAY_STATS_SHADOW_STACK + 1)
+
+#ifdef RAY_STATS
 typedef struct {
-	__constant Mesh* meshes;
-	__constant ulong* indices;
-	__constant new_bvhNode* new_nodes;
+	uint counters[RAY_STATS_COUNTERS];
+	uint stack, shadow_stack;
+} RayStats;
+
+void flushRayStats(__global uint* ray_stats, const RayStats* stats) {
+	for (uint i = 0; i < RAY_STATS_COUNTERS; ++i) {
+		const uint n = stats->counters[i];
+		if (!n)
+			continue;
+
+		/* the add that wraps the low word carries into the high one */
+		const uint old = atomic_add(&ray_stats[2 * i], n);
+		if (old + n < old)
+			atomic_inc(&ray_stats[2 * i + 1]);
+	}
+	if (stats->stack)
+		atomic_max(&ray_stats[RAY_STATS_STACK], stats->stack);
+	if (stats->shadow_stack)
+		atomic_max(&ray_stats[RAY_STATS_SHADOW_STACK], stats->shadow_stack);
+}
+
+#define RAY_STATS_PARAM					, __global uint* ray_stats
+#define RAY_STATS_BEGIN					RayStats stats = { { 0 }, 0, 0 };
+#define RAY_STATS_SCENE					, &stats
+#define RAY_STATS_END					flushRayStats(ray_stats, &stats);
+#define RAY_STATS_ADD(s, counter, n)	(s)->counters[counter] += (n);
+#define RAY_STATS_MAX(s, field, n)		(s)->field = max((s)->field, (uint)(n));
+#else
+#define RAY_STATS_PARAM
+#define RAY_STATS_BEGIN
+#define RAY_STATS_SCENE
+#define RAY_STATS_END
+#define RAY_STATS_ADD(s, counter, n)
+#define RAY_STATS_MAX(s, field, n)
+#endif
+
+//------------- Render Settings -------------
+
+/* 
+ * everything of the scene file that doesn't change the shape of the code,
+ * uploaded as a kernel argument so editing it doesn't rebuild the program.
+ * Keep in sync with cl_Settings in include/Types/settings.h
+ */
+#define MAX_LIGHTS	64
+
+typedef struct {
+	/* global medium */
+	float fog_density;
+	float fog_sigma_a;
+	float fog_sigma_s;
+	float fog_sigma_t;
+	int fog_abs_only;
+
+	/* seperate bounce controls for eye tracing */
+	int max_bounces;
+	int max_diff_bounces;
+	int max_spec_bounces;
+	int max_trans_bounces;
+	int max_scattering_events;
+
+	/* raymarching */
+	int marching_steps;
+	int shadow_marching_steps;
+
+	/* light sources */
+	uint light_count;
+	float inv_light_count;
+	uint light_indices[MAX_LIGHTS];
+} Settings;
+
+/* the geometry, the BVH and the meshes grow with the scene and live in global memory, constant memory only holds the small per-scene tables */
+typedef struct {
+	__global const Mesh* meshes;		/* followed by the instances and their top-level BVH, see geometry/tlas.cl */
+	__global const uint* faces;			/* uint3 per face in BVH leaf order, see vload3 */
+	__global const BVHNode* new_nodes;
 	const uint* mesh_count;
-	__constant float4* vertices;
-	__constant float4* normals;
-	__constant Material* mat;
+	__global const float* vertices;		/* float3 pool shared by the faces */
+	__global const float* normals;
+	__global const Material* mat;		/* one per instance */
+	__constant Settings* settings;
+#ifdef RAY_STATS
+	RayStats* stats;
+#endif
 } Scene;
 
 #endif
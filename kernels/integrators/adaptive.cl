@@ -0,0 +1,77 @@
+#ifndef __ADAPTIVE__
+#define __ADAPTIVE__
+
+/*
+ * Adaptive sampling, every pixel keeps the first two moments of its paths' luminance.
+ * adaptive_update marks the pixels whose relative error is still above the threshold,
+ * converged pixels don't start new paths anymore.
+ */
+
+/* the error estimate isn't trusted below this */
+#define ADAPTIVE_MIN_SPP 16
+
+/* add the path's contribution, the moments are updated once the path has finished */
+void accumulateMoments(RLH* rlh, const float4 contrib) {
+	rlh->path_lum += dot(contrib.xyz, (float3)(0.2126f, 0.7152f, 0.0722f));
+
+	if (rlh->reset) {
+		rlh->lum_sum += rlh->path_lum;
+		rlh->lum_sqr += rlh->path_lum * rlh->path_lum;
+		rlh->path_lum = 0.0f;
+	}
+}
+
+/* standard error of the mean luminance relative to the mean */
+float pixelError(const RLH* rlh) {
+	/* the latest path may still be in flight */
+	const uint n = rlh->reset ? rlh->samples : rlh->samples - 1;
+	if (rlh->samples == 0 || n < 2)
+		return INFINITY;
+
+	const float mean = rlh->lum_sum / n;
+	const float variance = fmax(rlh->lum_sqr / n - mean * mean, 0.0f) * n / (n - 1);
+
+	/* the offset keeps dark pixels from dominating */
+	return sqrt(variance / n) / (mean + 1e-2f);
+}
+
+__kernel void adaptive_update(
+	/* window size */
+	const int width, const int height,
+
+	/* per pixel path state, see path_state.cl */
+	__global float4* path_state,
+
+	/* relative error a pixel has to get below */
+	const float threshold,
+
+	/* per pixel, read by render_kernel */
+	__global uchar* active_mask,
+
+	/* compacted list of the active pixels, read by render_persistent */
+	__global uint* active_pixels,
+
+	/* [1] receives the number of active pixels, cleared by the host before the launch */
+	__global uint* work_counter,
+
+	/* [SAMPLE_COUNT_EPOCH] reset epoch of the path state */
+	__global const uint* sample_count
+) {
+	const uint pixel = get_global_id(0);
+	if (pixel >= width * height)
+		return;
+
+	const PathState ps = pathState(path_state, width * height);
+
+	RLH path;
+	const RLH* rlh = &path;
+	loadPathEpoch(&ps, pixel, sample_count[SAMPLE_COUNT_EPOCH], &path);
+
+	const bool active = rlh->samples < ADAPTIVE_MIN_SPP || pixelError(rlh) > threshold;
+	active_mask[pixel] = active;
+
+	if (active)
+		active_pixels[atomic_inc(&work_counter[1])] = pixel;
+}
+
+#endif
@@ -55,7 +55,8 @@ float3 bsdfSample(
 		ray->dir = wo;
 
 		int mesh_id;
-		if (intersect_scene(ray, &mesh_id, scene)) {
+		/* the instances aren't sampled as lights */
+		if (intersect_scene(ray, &mesh_id, scene) && mesh_id >= 0) {
 			const Mesh light = scene->meshes[mesh_id];
 
 			if (light.mat.t & LIGHT) {
@@ -87,9 +88,9 @@ float3 lightSample(
 
 #if PICK_RANDOM_LIGHT
 	// pick a random light source
-	const Mesh light = scene->meshes[LIGHT_INDICES[(int)(next1D(RNG_SEED_VALUE) * (float)(LIGHT_COUNT + 1))]];
+	const Mesh light = scene->meshes[scene->settings->light_indices[(int)(next1D(RNG_SEED_VALUE) * (float)(scene->settings->light_count + 1))]];
 #else
-	const Mesh light = scene->meshes[LIGHT_INDICES[0]];
+	const Mesh light = scene->meshes[scene->settings->light_indices[0]];
 #endif
 
 	LightSample rec;
@@ -142,7 +143,7 @@ bool handleSurface(
 	const Scene* scene,
 	RNG_SEED_PARAM,
 	Material* mat,
-	__global RLH* rlh,
+	RLH* rlh,
 	float3* emmision
 ) {
 	bool terminate = false;
@@ -201,9 +202,9 @@ float3 volumeLightSample(
 ){
 #if PICK_RANDOM_LIGHT
 	// pick a random light source
-	const Mesh light = scene->meshes[LIGHT_INDICES[(int)(next1D(RNG_SEED_VALUE) * (float)(LIGHT_COUNT + 1))]];
+	const Mesh light = scene->meshes[scene->settings->light_indices[(int)(next1D(RNG_SEED_VALUE) * (float)(scene->settings->light_count + 1))]];
 #else
-	const Mesh light = scene->meshes[LIGHT_INDICES[0]];
+	const Mesh light = scene->meshes[scene->settings->light_indices[0]];
 #endif
 
 	LightSample rec;
@@ -247,7 +248,7 @@ float3 volumePhaseSample(
 	sRay.dir = phaseSample->w;
 
 	int mesh_id;
-	if (intersect_scene(&sRay, &mesh_id, scene)) {
+	if (intersect_scene(&sRay, &mesh_id, scene) && mesh_id >= 0) {
 		const Mesh light = scene->meshes[mesh_id];
 
 		if (light.mat.t & LIGHT) {
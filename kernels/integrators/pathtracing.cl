@@ -5,16 +5,16 @@ float4 radiance(
 	const Scene* scene,
 	__read_only image2d_t env_map,
 	Ray* ray,
-	__global RLH* rlh,
+	RLH* rlh,
 	RNG_SEED_PARAM
 ){
 #ifdef GLOBAL_MEDIUM
 	const Medium _medium = (Medium){
-		(float3)(GLOBAL_FOG_DENSITY),
-		(float3)(GLOBAL_FOG_SIGMA_A),
-		(float3)(GLOBAL_FOG_SIGMA_S),
-		(float3)(GLOBAL_FOG_SIGMA_T),
-		GLOBAL_FOG_ABS_ONLY
+		(float3)(scene->settings->fog_density),
+		(float3)(scene->settings->fog_sigma_a),
+		(float3)(scene->settings->fog_sigma_s),
+		(float3)(scene->settings->fog_sigma_t),
+		scene->settings->fog_abs_only
 	};
 	const Medium* medium = &_medium;
 #else
@@ -28,8 +28,7 @@ float4 radiance(
 	int mesh_id;
 	bool didHit = intersect_scene(ray, &mesh_id, scene);
 
-	const Mesh mesh = scene->meshes[mesh_id];
-	Material mat = (mesh_id + 1) ? mesh.mat : *scene->mat;
+	Material mat = hitMaterial(scene, mesh_id);
 
 /*------------------- GLOBAL MEDIUM -------------------*/
 #ifdef GLOBAL_MEDIUM
@@ -41,7 +40,7 @@ float4 radiance(
 	rlh->mask *= mediumSample.weight;
 	
 	// scatter
-	if (!mediumSample.exited && rlh->bounce.scatters < MAX_SCATTERING_EVENTS){
+	if (!mediumSample.exited && rlh->bounce.scatters < scene->settings->max_scattering_events){
 		++rlh->bounce.scatters;
 		
 		PhaseSample phaseSample;
@@ -106,10 +105,10 @@ float4 radiance(
 	}
 
 	/* terminate if necessary */
-	if (rlh->bounce.total >= MAX_BOUNCES ||
-		rlh->bounce.diff >= MAX_DIFF_BOUNCES ||
-		rlh->bounce.spec >= MAX_SPEC_BOUNCES ||
-		rlh->bounce.trans >= MAX_TRANS_BOUNCES
+	if (rlh->bounce.total >= scene->settings->max_bounces ||
+		rlh->bounce.diff >= scene->settings->max_diff_bounces ||
+		rlh->bounce.spec >= scene->settings->max_spec_bounces ||
+		rlh->bounce.trans >= scene->settings->max_trans_bounces
 	) {
 		rlh->reset = true;
 	}
@@ -0,0 +1,241 @@
+#ifndef __PERSISTENT__
+#define __PERSISTENT__
+
+/*
+ * Persistent threads [Aila & Laine 09] "Understanding the Efficiency of Ray Traversal on GPUs"
+ *
+ * A fixed number of work-items fetch pixels from a global work counter and
+ * trace `spp` whole paths for each of them, a new camera path is generated
+ * as soon as the previous one terminates. The pixel range [work_counter[0], work_counter[1])
+ * is either the whole frame or a tile handed out by the multi-device scheduler.
+ */
+
+/* trace `spp` whole paths through the pixel at `i_coord` of the full frame */
+void tracePixel(
+	const Scene* scene, __read_only image2d_t env_map, __constant Camera* cam,
+	const int2 i_coord, const int width, const int height,
+	const uint framenumber, const int random0, const int random1,
+	RLH* rlh, const uint spp
+) {
+#if RNG_TYPE == 0
+	/* seeds for random number generator */
+	uint seed0 = i_coord.x * framenumber % 1000 + (random0 * 100);
+	uint seed1 = i_coord.y * framenumber % 1000 + (random1 * 100);
+#elif RNG_TYPE == 1
+	ulong state = 0xBA5EBA11;
+#elif RNG_TYPE == 2
+	const float2 f_coord = (float2)((float)(i_coord.x) / width, (float)(i_coord.y) / height);
+	double seed = dot(f_coord, (float2)(framenumber % 1000 + random0 * 100, framenumber % 333 + random1 * 33));
+#endif
+
+	for (uint s = 0; s < spp; ++s) {
+		++rlh->samples;
+		rlh->bounce.total = 0;
+		rlh->bounce.diff = 0;
+		rlh->bounce.spec = 0;
+		rlh->bounce.trans = 0;
+		rlh->bounce.scatters = 0;
+		rlh->bounce.wasSpecular = true;
+		rlh->reset = false;
+
+		rlh->mask = (float3)(1.0f);
+
+		Ray ray = createCamRay(i_coord, width, height, cam, RNG_SEED_VALUE_P);
+		RAY_STATS_ADD(scene->stats, RAY_STATS_PRIMARY, 1)
+
+		/* trace the whole path */
+		do {
+			const float4 contrib = radiance(scene, env_map, &ray, rlh, RNG_SEED_VALUE_P);
+			rlh->acc += contrib;
+			accumulateMoments(rlh, contrib);
+		} while (!rlh->reset);
+	}
+}
+
+__kernel void render_persistent(
+	/* scene's Meshes */
+	__global const Mesh* restrict meshes,
+
+	/* window size */
+	const int width, const int height,
+
+	/* total meshes in the scene @ToRemove */
+	const uint8 mesh_count,
+
+	/* current frame */
+	const uint framenumber,
+
+	/* camera */
+	__constant Camera* cam,
+
+	/* seeds */
+	const int random0, const int random1,
+
+	/* new frame */
+	__write_only image2d_t output_tex,
+
+	/* BVH */
+	__global const uint* restrict faces,
+	__global const float* restrict vertices,
+	__global const float* restrict normals,
+	__global const Material* restrict mat,
+
+	/* enviroment map */
+	__read_only image2d_t env_map,
+
+	/* per pixel path state, see path_state.cl */
+	__global float4* path_state,
+
+	__global const BVHNode* restrict new_bvh_node,
+
+	/* started paths and the reset epoch of the path state, see countSamples() */
+	__global uint* sample_count,
+
+	/* next pixel to work on and one past the last one, reset by the host before every launch */
+	__global uint* work_counter,
+
+	/* paths per pixel and launch */
+	const uint spp,
+
+	/* adaptive sampling, the counter indexes this list of pixels instead, NULL: every pixel */
+	__global const uint* active_pixels,
+
+	/* scene settings that don't need a rebuild */
+	__constant Settings* settings
+
+	/* traversal counters, see RAY_STATS in header.cl */
+	RAY_STATS_PARAM
+) {
+	__local uint l_count;
+
+	const uint pixel_end = min(work_counter[1], (uint)(width * height));
+	const PathState ps = pathState(path_state, width * height);
+	const uint epoch = sample_count[SAMPLE_COUNT_EPOCH];
+	/* paths this work-item started, counted once the group has run out of pixels */
+	uint started = 0;
+
+	RAY_STATS_BEGIN
+	const Scene scene = { meshes, faces, new_bvh_node, &mesh_count, vertices, normals, mat, settings RAY_STATS_SCENE };
+
+	while (true) {
+		const uint index = atomic_inc(work_counter);
+		if (index >= pixel_end)
+			break;
+
+		const uint pixel = active_pixels ? active_pixels[index] : index;
+
+		/* xy-coordinate of the pixel */
+		const int2 i_coord = (int2)(pixel % width, pixel / width);
+
+		RLH path;
+		loadPathEpoch(&ps, pixel, epoch, &path);
+
+		tracePixel(&scene, env_map, cam, i_coord, width, height, framenumber, random0, random1, &path, spp);
+
+		storePathEpoch(&ps, pixel, epoch, &path);
+		started += spp;
+
+		write_imagef(output_tex, i_coord, path.acc / (float)(path.samples));
+	}
+
+	countSamples(sample_count, started, &l_count);
+
+	RAY_STATS_END
+}
+
+/*
+ * Tiled rendering, the path state and the output only cover `tile` (x, y, width, height)
+ * so that the resolution isn't bound by device memory.
+ */
+__kernel void render_tile(
+	/* scene's Meshes */
+	__global const Mesh* restrict meshes,
+
+	/* window size */
+	const int width, const int height,
+
+	/* total meshes in the scene @ToRemove */
+	const uint8 mesh_count,
+
+	/* current frame */
+	const uint framenumber,
+
+	/* camera */
+	__constant Camera* cam,
+
+	/* seeds */
+	const int random0, const int random1,
+
+	/* the tile's radiance */
+	__write_only image2d_t output_tex,
+
+	/* BVH */
+	__global const uint* restrict faces,
+	__global const float* restrict vertices,
+	__global const float* restrict normals,
+	__global const Material* restrict mat,
+
+	/* enviroment map */
+	__read_only image2d_t env_map,
+
+	/* one entry per pixel of the tile */
+	/* per pixel path state, see path_state.cl */
+	__global float4* path_state,
+
+	__global const BVHNode* restrict new_bvh_node,
+
+	/* started paths and the reset epoch of the path state, see countSamples() */
+	__global uint* sample_count,
+
+	/* next pixel of the tile to work on, reset by the host before every launch */
+	__global uint* work_counter,
+
+	/* paths per pixel and launch */
+	const uint spp,
+
+	const int4 tile,
+
+	/* scene settings that don't need a rebuild */
+	__constant Settings* settings
+
+	/* traversal counters, see RAY_STATS in header.cl */
+	RAY_STATS_PARAM
+) {
+	__local uint l_count;
+
+	const uint tile_pixels = tile.z * tile.w;
+	/* the stride is the full tile size, the layout mustn't change with the smaller tiles at the edges */
+	const PathState ps = pathState(path_state, get_image_width(output_tex) * get_image_height(output_tex));
+	const uint epoch = sample_count[SAMPLE_COUNT_EPOCH];
+	/* paths this work-item started, counted once the group has run out of pixels */
+	uint started = 0;
+
+	RAY_STATS_BEGIN
+	const Scene scene = { meshes, faces, new_bvh_node, &mesh_count, vertices, normals, mat, settings RAY_STATS_SCENE };
+
+	while (true) {
+		const uint pixel = atomic_inc(work_counter);
+		if (pixel >= tile_pixels)
+			break;
+
+		/* xy-coordinate of the pixel in the tile and in the frame */
+		const int2 t_coord = (int2)(pixel % tile.z, pixel / tile.z);
+		const int2 i_coord = tile.xy + t_coord;
+
+		RLH path;
+		loadPathEpoch(&ps, pixel, epoch, &path);
+
+		tracePixel(&scene, env_map, cam, i_coord, width, height, framenumber, random0, random1, &path, spp);
+
+		storePathEpoch(&ps, pixel, epoch, &path);
+		started += spp;
+
+		write_imagef(output_tex, t_coord, path.acc / (float)(path.samples));
+	}
+
+	countSamples(sample_count, started, &l_count);
+
+	RAY_STATS_END
+}
+
+#endif
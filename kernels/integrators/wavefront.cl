@@ -0,0 +1,580 @@
+#ifndef __WAVEFRONT__
+#define __WAVEFRONT__
+
+/*
+ * Wavefront integrator [Laine et al. 13] "Megakernels Considered Harmful"
+ *
+ * generate -> extend -> shade (one launch per material class) -> shadow -> accumulate
+ *
+ * The stages communicate through compacted queues of path indices, every
+ * queue holds up to `num_paths` entries and has its own atomic counter.
+ * extend, shade and shadow are launched at a fixed width and walk their queue
+ * in strides of the launch, the counters never go back to the host.
+ */
+
+#define WF_QUEUE_EXTEND		0
+#define WF_QUEUE_SHADE		1
+#define WF_SHADE_QUEUES		3
+#define WF_QUEUE_SHADOW		(WF_QUEUE_SHADE + WF_SHADE_QUEUES)
+#define WF_QUEUE_COUNT		(WF_QUEUE_SHADOW + 1)
+
+/* shade queues, paths with similar materials are shaded together */
+#define WF_SHADE_MISC		0	/* misses, emitters */
+#define WF_SHADE_DIFFUSE	1
+#define WF_SHADE_GLOSSY		2	/* glossy & specular */
+
+#if RNG_TYPE != 0
+#error "the wavefront integrator only supports RNG_TYPE 0"
+#endif
+
+typedef struct {
+	float3 pos;
+	float3 normal;
+	float t;
+	int mesh_id;
+	int backside;
+	int didHit;
+} HitRecord;
+
+typedef struct {
+	float3 origin;
+	float3 dir;
+	float3 contribution;
+	float dist;
+} ShadowRay;
+
+typedef struct {
+	HitRecord hit;
+	ShadowRay shadow;
+	uint2 seed;
+	/* bsdf pdf of the last bounce, used for MIS when an emitter is hit */
+	float bsdfPdf;
+	int lightSampled;
+} WFPath;
+
+#define WF_SCENE_PARAMS \
+	__global const Mesh* restrict meshes, \
+	const uint8 mesh_count, \
+	__global const uint* restrict faces, \
+	__global const float* restrict vertices, \
+	__global const float* restrict normals, \
+	__global const Material* restrict mat, \
+	__global const BVHNode* restrict new_bvh_node, \
+	__constant Settings* settings
+
+#define WF_SCENE { meshes, faces, new_bvh_node, (const uint*)&mesh_count, vertices, normals, mat, settings RAY_STATS_SCENE }
+
+/* work-group aggregated append, has to be reached by every work-item of the group */
+void wf_push(
+	__global uint* queues, __global uint* counters,
+	const uint q, const uint num_paths,
+	const uint id, const bool active,
+	__local uint* l_count, __local uint* l_base
+) {
+	if (get_local_id(0) == 0)
+		*l_count = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const uint slot = active ? atomic_inc(l_count) : 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0)
+		*l_base = *l_count ? atomic_add(&counters[q], *l_count) : 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (active)
+		queues[q * num_paths + *l_base + slot] = id;
+}
+
+Ray wf_loadRay(const PathState* ps, const uint id, __global const HitRecord* hit) {
+	Ray ray = loadRay(ps, id);
+	ray.pos = hit->pos;
+	ray.normal = hit->normal;
+	ray.t = hit->t;
+	ray.backside = hit->backside;
+	return ray;
+}
+
+uint wf_shadeQueue(const Scene* scene, const bool didHit, const int mesh_id) {
+	if (!didHit)
+		return WF_SHADE_MISC;
+
+	const Material mat = hitMaterial(scene, mesh_id);
+
+#ifdef LIGHT
+	if (mat.t & LIGHT)
+		return WF_SHADE_MISC;
+#endif
+
+	return (mat.lobes & DiffuseLobe) ? WF_SHADE_DIFFUSE : WF_SHADE_GLOSSY;
+}
+
+/*--------------------------- GENERATE ---------------------------*/
+
+__kernel void wf_generate(
+	const int width, const int height,
+	const uint framenumber,
+	__constant Camera* cam,
+	const int random0, const int random1,
+	__global float4* path_state,
+	__global WFPath* paths,
+	__global uint* queues,
+	__global uint* queue_counters,
+	__global uint* sample_count
+	RAY_STATS_PARAM
+) {
+	__local uint l_count, l_base;
+
+	RAY_STATS_BEGIN
+
+	const uint num_paths = width * height;
+	const uint id = get_global_id(0);
+	const bool active = id < num_paths;
+	bool started = false;
+
+	if (active) {
+		const int2 i_coord = (int2)(id % width, id / width);
+
+		uint seed0 = i_coord.x * framenumber % 1000 + (random0 * 100);
+		uint seed1 = i_coord.y * framenumber % 1000 + (random1 * 100);
+
+		const PathState ps = pathState(path_state, num_paths);
+		const uint epoch = sample_count[SAMPLE_COUNT_EPOCH];
+
+		RLH path;
+		RLH* rlh = &path;
+		loadPathEpoch(&ps, id, epoch, rlh);
+
+		if (rlh->reset || rlh->samples == 0) {
+			++rlh->samples;
+			started = true;
+			rlh->bounce.total = 0;
+			rlh->bounce.diff = 0;
+			rlh->bounce.spec = 0;
+			rlh->bounce.trans = 0;
+			rlh->bounce.scatters = 0;
+			rlh->bounce.wasSpecular = true;
+			rlh->reset = false;
+
+			rlh->mask = (float3)(1.0f);
+
+			Ray ray = createCamRay(i_coord, width, height, cam, RNG_SEED_VALUE_P);
+			RAY_STATS_ADD(&stats, RAY_STATS_PRIMARY, 1)
+			storeRay(&ps, id, &ray);
+			storePathEpoch(&ps, id, epoch, rlh);
+
+			paths[id].lightSampled = false;
+		}
+
+		paths[id].seed = (uint2)(seed0, seed1);
+	}
+
+	countSamples(sample_count, started, &l_count);
+	wf_push(queues, queue_counters, WF_QUEUE_EXTEND, num_paths, id, active, &l_count, &l_base);
+
+	RAY_STATS_END
+}
+
+/*--------------------------- EXTEND ---------------------------*/
+
+__kernel void wf_extend(
+	WF_SCENE_PARAMS,
+	const uint num_paths,
+	__global float4* path_state,
+	__global WFPath* paths,
+	__global uint* queues,
+	__global uint* queue_counters
+	RAY_STATS_PARAM
+) {
+	__local uint l_count, l_base;
+
+	RAY_STATS_BEGIN
+
+	/* the whole group runs every stride, wf_push needs all of its work-items */
+	const uint count = queue_counters[WF_QUEUE_EXTEND];
+	for (uint base = get_group_id(0) * get_local_size(0); base < count; base += get_global_size(0)) {
+		const uint gid = base + get_local_id(0);
+		const bool active = gid < count;
+
+		uint id = 0;
+		uint q = 0;
+
+		if (active) {
+			const Scene scene = WF_SCENE;
+
+			id = queues[WF_QUEUE_EXTEND * num_paths + gid];
+
+			const PathState ps = pathState(path_state, num_paths);
+			Ray ray = loadRay(&ps, id);
+
+			int mesh_id;
+			const bool didHit = intersect_scene(&ray, &mesh_id, &scene);
+
+			__global HitRecord* hit = &paths[id].hit;
+			hit->pos = ray.pos;
+			hit->normal = ray.normal;
+			hit->t = ray.t;
+			hit->mesh_id = mesh_id;
+			hit->backside = ray.backside;
+			hit->didHit = didHit;
+
+			q = wf_shadeQueue(&scene, didHit, mesh_id);
+		}
+
+		for (uint i = 0; i < WF_SHADE_QUEUES; ++i)
+			wf_push(queues, queue_counters, WF_QUEUE_SHADE + i, num_paths, id, active && q == i, &l_count, &l_base);
+	}
+
+	RAY_STATS_END
+}
+
+/*--------------------------- SHADE ---------------------------*/
+
+#ifdef LIGHT
+/* same as lightSample() but the occlusion test is deferred to the shadow stage */
+bool wf_lightSample(
+	SurfaceScatterEvent* event,
+	const Ray* ray,
+	const Medium* medium,
+	const Scene* scene,
+	RNG_SEED_PARAM,
+	const Material* mat,
+	const float3 mask,
+	__global ShadowRay* shadowRay
+) {
+#if PICK_RANDOM_LIGHT
+	const Mesh light = scene->meshes[scene->settings->light_indices[(int)(next1D(RNG_SEED_VALUE) * (float)(scene->settings->light_count + 1))]];
+#else
+	const Mesh light = scene->meshes[scene->settings->light_indices[0]];
+#endif
+
+	LightSample rec;
+
+	if (!sampleDirect(&light, &ray->pos, &rec, RNG_SEED_VALUE))
+		return false;
+
+	event->wo = toLocal(&event->frame, rec.d);
+
+	float3 fr = BSDF_eval2(event, mat, false);
+	if (dot(fr, fr) == 0.0f)
+		return false;
+
+	float3 contribution = light.mat.color * fr;
+
+#ifdef GLOBAL_MEDIUM
+	if (medium != NULL)
+		contribution *= native_exp(-medium->sigmaT * rec.dist);
+#endif
+
+	contribution *= powerHeuristic(rec.pdf, BSDF_pdf(event, mat));
+
+	shadowRay->origin = ray->pos;
+	shadowRay->dir = rec.d;
+	shadowRay->dist = rec.dist;
+	shadowRay->contribution = mask * contribution / rec.pdf;
+	return true;
+}
+
+#ifdef GLOBAL_MEDIUM
+/* same as volumeLightSample() but the occlusion test is deferred to the shadow stage */
+bool wf_volumeLightSample(
+	const MediumSample* mediumSample,
+	const Medium* medium,
+	const Ray* ray,
+	const Scene* scene,
+	RNG_SEED_PARAM,
+	const float3 mask,
+	__global ShadowRay* shadowRay
+) {
+#if PICK_RANDOM_LIGHT
+	const Mesh light = scene->meshes[scene->settings->light_indices[(int)(next1D(RNG_SEED_VALUE) * (float)(scene->settings->light_count + 1))]];
+#else
+	const Mesh light = scene->meshes[scene->settings->light_indices[0]];
+#endif
+
+	LightSample rec;
+
+	if (!sampleDirect(&light, &mediumSample->p, &rec, RNG_SEED_VALUE))
+		return false;
+
+	const float3 f = phase_eval(ray->dir, rec.d);
+	if (dot(f, f) == 0.0f)
+		return false;
+
+	shadowRay->origin = mediumSample->p;
+	shadowRay->dir = rec.d;
+	shadowRay->dist = rec.dist;
+	shadowRay->contribution = mask * native_exp(-medium->sigmaT * rec.dist) * light.mat.color * f *
+		powerHeuristic(rec.pdf, phase_pdf(ray->dir, rec.d)) / rec.pdf;
+	return true;
+}
+#endif
+#endif
+
+/* radiance() without the closest-hit query, returns true if a shadow ray was emitted */
+bool wf_shadePath(
+	const Scene* scene,
+	__read_only image2d_t env_map,
+	Ray* ray,
+	RLH* rlh,
+	__global WFPath* path,
+	RNG_SEED_PARAM
+) {
+#ifdef GLOBAL_MEDIUM
+	const Medium _medium = (Medium){
+		(float3)(scene->settings->fog_density),
+		(float3)(scene->settings->fog_sigma_a),
+		(float3)(scene->settings->fog_sigma_s),
+		(float3)(scene->settings->fog_sigma_t),
+		scene->settings->fog_abs_only
+	};
+	const Medium* medium = &_medium;
+#else
+	const Medium* medium = NULL;
+#endif
+
+	float alpha = 1.0f;
+	float3 emission = (float3)(0.0f);
+	bool emitShadow = false;
+
+	const bool didHit = path->hit.didHit;
+	const int mesh_id = path->hit.mesh_id;
+	Material mat = hitMaterial(scene, mesh_id);
+
+/*------------------- GLOBAL MEDIUM -------------------*/
+#ifdef GLOBAL_MEDIUM
+	MediumSample mediumSample;
+	mediumSample.continuedWeight = rlh->mask;
+
+	HomogeneousMedium_sampleDistance(&mediumSample, medium, ray, RNG_SEED_VALUE);
+
+	rlh->mask *= mediumSample.weight;
+
+	// scatter like a surface bounce: wf_shadow traces the light sample and the phase sample is the next
+	// wf_extend ray, an emitter it hits gets its half of the MIS estimator from the path's bsdfPdf
+	if (!mediumSample.exited && rlh->bounce.scatters < scene->settings->max_scattering_events){
+		++rlh->bounce.scatters;
+
+		PhaseSample phaseSample;
+		if (!phase_sample(ray->dir, &phaseSample, RNG_SEED_VALUE)) {
+			rlh->reset = true;
+			rlh->acc += (float4)(emission, alpha);
+			return false;
+		}
+
+		rlh->bounce.wasSpecular = !(enableVolumeLightSampling && (lowOrderScattering || rlh->bounce.scatters > 1));
+
+		path->lightSampled = false;
+#ifdef LIGHT
+		if (!rlh->bounce.wasSpecular) {
+			emitShadow = wf_volumeLightSample(&mediumSample, medium, ray, scene, RNG_SEED_VALUE, rlh->mask, &path->shadow);
+			path->lightSampled = true;
+		}
+#endif
+
+		ray->origin = mediumSample.p;
+		ray->dir = phaseSample.w;
+		path->bsdfPdf = phaseSample.pdf;
+
+		rlh->mask *= phaseSample.weight;
+	} else
+#endif
+	{
+		if (!didHit) {
+			rlh->reset = true;
+
+#ifdef ALPHA_TESTING
+			return false;
+#else
+			rlh->acc += (float4)(rlh->mask * read_imagef(env_map, samplerA, envMapEquirect(ray->dir)).xyz, 1.0f);
+			return false;
+#endif
+		}
+
+#ifdef LIGHT
+		if (mat.t & LIGHT) {
+			/* the lights that are sampled are meshes, the instances only get hit */
+			if (!path->lightSampled || rlh->bounce.wasSpecular || mesh_id < 0) {
+				emission += mat.emission * rlh->mask;
+			} else {
+				/* the light sample of the previous bounce covered the other half of the MIS estimator */
+				const Mesh light = scene->meshes[mesh_id];
+				emission += mat.emission * rlh->mask *
+					powerHeuristic(path->bsdfPdf, directPdf(&light, &ray->dir, &ray->origin));
+			}
+
+			rlh->reset = true;
+			rlh->acc += (float4)(emission, alpha);
+			return false;
+		}
+#endif
+
+		SurfaceScatterEvent event = makeLocalScatterEvent(ray, scene);
+
+		path->lightSampled = false;
+#ifdef LIGHT
+		if (enableLightSampling && mat.lobes & ~(SpecularLobe|ForwardLobe)) {
+			emitShadow = wf_lightSample(&event, ray, medium, scene, RNG_SEED_VALUE, &mat, rlh->mask, &path->shadow);
+			path->lightSampled = true;
+		}
+#endif
+
+		if (!BSDF2(&event, ray, scene, &mat, RNG_SEED_VALUE, false)) {
+			rlh->reset = true;
+			rlh->acc += (float4)(emission, alpha);
+			return emitShadow;
+		}
+
+		ray->origin = ray->pos;
+		ray->dir = toGlobal(&event.frame, event.wo);
+		path->bsdfPdf = event.pdf;
+
+		rlh->bounce.wasSpecular = event.sampledLobe & SpecularLobe;
+
+		rlh->mask *= event.weight;
+		rlh->bounce.diff += (event.sampledLobe & (DiffuseReflectionLobe | GlossyReflectionLobe)) != 0;
+		rlh->bounce.spec += (event.sampledLobe & SpecularReflectionLobe) != 0;
+		rlh->bounce.trans += (event.sampledLobe & TransmissiveLobe) != 0;
+
+		rlh->bounce.scatters = 0;
+		++rlh->bounce.total;
+	}
+
+	//russian roulette
+	const float roulettePdf = fmax3(rlh->mask);
+	if (rlh->bounce.total > 2 && roulettePdf < 0.1f) {
+		if (next1D(RNG_SEED_VALUE) < roulettePdf){
+			rlh->mask /= roulettePdf;
+		} else {
+			rlh->reset = true;
+		}
+	}
+
+	/* terminate if necessary */
+	if (rlh->bounce.total >= scene->settings->max_bounces ||
+		rlh->bounce.diff >= scene->settings->max_diff_bounces ||
+		rlh->bounce.spec >= scene->settings->max_spec_bounces ||
+		rlh->bounce.trans >= scene->settings->max_trans_bounces
+	) {
+		rlh->reset = true;
+	}
+
+	rlh->acc += (float4)(emission, alpha);
+	return emitShadow;
+}
+
+__kernel void wf_shade(
+	WF_SCENE_PARAMS,
+	__read_only image2d_t env_map,
+	const uint num_paths,
+	const uint queue_id,
+	__global float4* path_state,
+	__global WFPath* paths,
+	__global uint* queues,
+	__global uint* queue_counters
+	RAY_STATS_PARAM
+) {
+	__local uint l_count, l_base;
+
+	RAY_STATS_BEGIN
+
+	/* the whole group runs every stride, wf_push needs all of its work-items */
+	const uint count = queue_counters[queue_id];
+	for (uint base = get_group_id(0) * get_local_size(0); base < count; base += get_global_size(0)) {
+		const uint gid = base + get_local_id(0);
+		const bool active = gid < count;
+
+		uint id = 0;
+		bool emitShadow = false;
+
+		if (active) {
+			const Scene scene = WF_SCENE;
+
+			id = queues[queue_id * num_paths + gid];
+
+			__global WFPath* path = &paths[id];
+			uint seed0 = path->seed.x;
+			uint seed1 = path->seed.y;
+
+			/* wf_generate brought every path to the current epoch */
+			const PathState ps = pathState(path_state, num_paths);
+			Ray ray = wf_loadRay(&ps, id, &path->hit);
+
+			RLH rlh;
+			loadPath(&ps, id, &rlh);
+
+			emitShadow = wf_shadePath(&scene, env_map, &ray, &rlh, path, RNG_SEED_VALUE_P);
+
+			storeRay(&ps, id, &ray);
+			storePath(&ps, id, &rlh);
+			path->seed = (uint2)(seed0, seed1);
+		}
+
+		wf_push(queues, queue_counters, WF_QUEUE_SHADOW, num_paths, id, emitShadow, &l_count, &l_base);
+	}
+
+	RAY_STATS_END
+}
+
+/*--------------------------- SHADOW ---------------------------*/
+
+__kernel void wf_shadow(
+	WF_SCENE_PARAMS,
+	const uint num_paths,
+	__global float4* path_state,
+	__global WFPath* paths,
+	__global uint* queues,
+	__global uint* queue_counters
+	RAY_STATS_PARAM
+) {
+#ifdef LIGHT
+	const uint count = queue_counters[WF_QUEUE_SHADOW];
+	if (get_global_id(0) >= count)
+		return;
+
+	RAY_STATS_BEGIN
+	const Scene scene = WF_SCENE;
+	const PathState ps = pathState(path_state, num_paths);
+
+	for (uint gid = get_global_id(0); gid < count; gid += get_global_size(0)) {
+		const uint id = queues[WF_QUEUE_SHADOW * num_paths + gid];
+		__global ShadowRay* sr = &paths[id].shadow;
+
+		Ray ray;
+		ray.origin = sr->origin;
+		ray.dir = sr->dir;
+		ray.t = sr->dist;
+
+		if (shadow(&ray, &scene))
+			ps.acc[id].xyz += sr->contribution;
+	}
+
+	RAY_STATS_END
+#endif
+}
+
+/*--------------------------- ACCUMULATE ---------------------------*/
+
+__kernel void wf_accumulate(
+	const int width, const int height,
+	__global float4* path_state,
+	__write_only image2d_t output_tex
+) {
+	const uint id = get_global_id(0);
+	if (id >= width * height)
+		return;
+
+	const int2 i_coord = (int2)(id % width, id / width);
+	const PathState ps = pathState(path_state, width * height);
+
+#if VIEW_OPTION == VIEW_RESULTS
+	write_imagef(output_tex, i_coord, ps.acc[id] / (float)(ps.samples[id]));
+#else
+	write_imagef(output_tex, i_coord, ps.acc[id]);
+#endif
+}
+
+#undef WF_SCENE_PARAMS
+#undef WF_SCENE
+
+#endif
@@ -1,13 +1,18 @@
 #ifndef __INTERSECT__
 #define __INTERSECT__
 
+/* the material of a hit, -(k + 1) is the k-th instance. A miss is -1 and reads the first instance's */
+Material hitMaterial(const Scene* scene, const int mesh_id){
+	return mesh_id >= 0 ? scene->meshes[mesh_id].mat : scene->mat[-mesh_id - 1];
+}
+
 /* Find the closest distance to a specific object */
 bool get_dist(float* dist, const Ray* sray, const Mesh* mesh, const Scene* scene, const bool isOBJ){
 	Ray temp_ray = *sray;
 	temp_ray.t = INF;
 
 	if(isOBJ) {
-		traverse(scene, &temp_ray);
+		traverse(scene, &temp_ray, 0);
 	} 
 #ifdef __SPHERE__
 	else if(mesh->t & SPHERE){ 
@@ -44,7 +49,7 @@ bool intersect_mesh(Ray* sray, const Mesh* mesh, const Scene* scene, const bool
 	sray->t = INF;
 
 	if (isOBJ) {
-		traverse(scene, sray);
+		traverse(scene, sray, 0);
 		sray->pos = sray->origin + sray->dir * sray->t;
 
 		sray->backside = dot(sray->normal, sray->dir) >= 0.0f;
@@ -95,59 +100,25 @@ bool shadow(
 	Ray* ray,
 	const Scene* scene
 ){ 
-	const float maxDist = ray->t;
+	RAY_STATS_ADD(scene->stats, RAY_STATS_SHADOW, 1)
 
-#ifdef __BVH__
-	Ray temp_ray = *ray;
-	if(traverseShadows(scene, ray)){
+	/* spheres, boxes, quads and the instances */
+	const Ray temp_ray = *ray;
+	if (traverseTLAS(scene, ray, NULL, true)) {
 		*ray = temp_ray;
 		return false;
 	}
-#endif
-
-#ifdef __SPHERE__
-	for (uint i = 0; i < scene->mesh_count[0]; ++i) {
-
-		Mesh sphere = scene->meshes[i]; /* local copy */
-
-		if (intersect_sphere(ray, &sphere)) {
-			if (ray->t < maxDist) return false;
-		}
-	}
-#endif
 
 #ifdef __SDF__
 	/* if there are any sdfs in the scene raymarch them */
 	if (scene->mesh_count[1]) {
-		if (shadow_sdf(scene->meshes, ray, scene->mesh_count)) {
+		RAY_STATS_ADD(scene->stats, RAY_STATS_PRIMITIVES, scene->mesh_count[1])
+		if (shadow_sdf(scene->meshes, ray, scene->mesh_count, scene->settings->shadow_marching_steps)) {
 			return false;
 		}
 	}
 #endif
 
-	uint fl = scene->mesh_count[0] + scene->mesh_count[1];
-#ifdef __BOX__
-	for (uint i = 0; i < scene->mesh_count[2]; ++i) {
-		
-		Mesh box = scene->meshes[fl++]; /* local copy */
-
-		if (intersect_box(&box, ray)) {
-			if (ray->t < maxDist) return false;
-		}
-	}
-#endif
-
-#ifdef __QUAD__
-	for (uint i = 0; i < scene->mesh_count[3]; ++i) {
-	
-		Mesh tquad = scene->meshes[fl++]; /* local copy */
-
-		if (intersect_quad(&tquad, ray)) {
-			if (ray->t < maxDist) return false;
-		}
-	}
-#endif
-
 	return true;
 }
 
@@ -163,29 +134,16 @@ bool intersect_scene(
 	ray->t = INF;
 	*mesh_id = -1;
 
-#ifdef __BVH__
-		traverse(scene, ray);
-		ray->normal = normalize(ray->normal);
-		ray->pos = ray->origin + ray->dir * ray->t;
-#endif
-
-#ifdef __SPHERE__
-	for (uint i = 0; i < scene->mesh_count[0]; ++i) {
+	RAY_STATS_ADD(scene->stats, RAY_STATS_CLOSEST, 1)
 
-		Mesh sphere = scene->meshes[i]; /* local copy */
-
-		if (intersect_sphere(ray, &sphere)) {
-			ray->pos = ray->origin + ray->dir * ray->t;
-			ray->normal = fast_normalize(ray->pos - sphere.pos);
-			*mesh_id = i;
-		}
-	}
-#endif
+	/* spheres, boxes, quads and the instances */
+	traverseTLAS(scene, ray, mesh_id, false);
 
 #ifdef __SDF__
 	/* if there are any sdfs in the scene raymarch them */
 	if (scene->mesh_count[1]) {
-		if (intesect_sdf(scene->meshes, ray, mesh_id, scene->mesh_count)) {
+		RAY_STATS_ADD(scene->stats, RAY_STATS_PRIMITIVES, scene->mesh_count[1])
+		if (intesect_sdf(scene->meshes, ray, mesh_id, scene->mesh_count, scene->settings->marching_steps)) {
 			ray->pos = ray->origin + ray->dir * ray->t;
 			Mesh sdf = scene->meshes[*mesh_id]; /* local copy */
 			ray->normal = calcNormal(&sdf, ray->pos);
@@ -193,38 +151,16 @@ bool intersect_scene(
 	}
 #endif
 
-	uint fl = scene->mesh_count[0] + scene->mesh_count[1];
-#ifdef __BOX__
-	for (uint i = 0; i < scene->mesh_count[2]; ++i) {
-		
-		Mesh box = scene->meshes[fl]; /* local copy */
-
-		if (intersect_box(&box, ray)) {
-			ray->pos = ray->origin + ray->dir * ray->t;
-			*mesh_id = fl;
-		}
-		++fl;
-	}
-#endif
-
-#ifdef __QUAD__
-	for (uint i = 0; i < scene->mesh_count[3]; ++i) {
-		
-		Mesh tquad = scene->meshes[fl]; /* local copy */
-
-		if(intersect_quad(&tquad, ray)){
-			*mesh_id = fl;
-		}
-		++fl;
-	}
+#if defined DIEL || defined ROUGH_DIEL
+	/* the instances' materials aren't in the meshes */
+	const ushort mat_t = hitMaterial(scene, *mesh_id).t;
 #endif
-
 #if defined DIEL && defined ROUGH_DIEL
-	const bool nTrans = scene->meshes[*mesh_id].mat.t & ~(DIEL | ROUGH_DIEL);
+	const bool nTrans = mat_t & ~(DIEL | ROUGH_DIEL);
 #elif defined DIEL
-	const bool nTrans = scene->meshes[*mesh_id].mat.t & ~DIEL;
+	const bool nTrans = mat_t & ~DIEL;
 #elif defined ROUGH_DIEL
-	const bool nTrans = scene->meshes[*mesh_id].mat.t & ~ROUGH_DIEL;
+	const bool nTrans = mat_t & ~ROUGH_DIEL;
 #else
 	const bool nTrans = true;
 #endif
@@ -24,9 +24,6 @@
 
 __constant sampler_t samplerA = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP | CLK_FILTER_LINEAR;
 
-#define tempToRay(tray) (Ray){ tray.origin, tray.dir, (float3)(0.0f), (float3)(0.0f), {tray.dist}, false, tray.time }
-#define rayToTemp(ray) (TempRay){ ray.origin, ray.dir, ray.t, ray.time }
-
 typedef struct {
 	// throughput
 	float3 mask;
@@ -44,6 +41,9 @@ typedef struct {
 	bool reset;
 	uint samples;
 	//int mesh_id;
+
+	/* luminance of the current path and the moments of the finished ones, see integrators/adaptive.cl */
+	float path_lum, lum_sum, lum_sqr;
 } RLH;
 
 #FILE:header.cl
@@ -55,17 +55,50 @@ typedef struct {
 #FILE:bxdf/bxdf.cl
 #FILE:media.cl
 
-typedef struct {
-	TempRay ray;
-	RLH data;
-} RTD;
+#FILE:path_state.cl
 
 #FILE:integrators/base.cl
 #FILE:integrators/pathtracing.cl
+#FILE:integrators/adaptive.cl
+
+/* pixel orders of render_kernel, keep in sync with include/CL/workgroup_tuner.h */
+#define PIXEL_ORDER_LINEAR	0
+#define PIXEL_ORDER_TILED	1
+#define PIXEL_ORDER_MORTON	2
+
+/* the even bits of x */
+uint compactBits(uint x) {
+	x &= 0x55555555u;
+	x = (x ^ (x >> 1)) & 0x33333333u;
+	x = (x ^ (x >> 2)) & 0x0F0F0F0Fu;
+	x = (x ^ (x >> 4)) & 0x00FF00FFu;
+	x = (x ^ (x >> 8)) & 0x0000FFFFu;
+	return x;
+}
+
+/* 
+ * xy-coordinate of a work item, every work-group covers one block of pixels so its rays stay coherent.
+ * order: { PIXEL_ORDER_*, block width, block height, blocks per row }
+ */
+int2 pixelCoord(const uint id, const int width, const int4 order) {
+	if (order.x == PIXEL_ORDER_LINEAR)
+		return (int2)(id % width, id / width);
+
+	const uint block_size = order.y * order.z;
+	const uint block = id / block_size;
+	const uint local_id = id % block_size;
+	const int2 origin = (int2)((block % order.w) * order.y, (block / order.w) * order.z);
+
+	/* square power of two blocks only */
+	if (order.x == PIXEL_ORDER_MORTON)
+		return origin + (int2)(compactBits(local_id), compactBits(local_id >> 1));
+
+	return origin + (int2)(local_id % order.y, local_id / order.y);
+}
 
 __kernel void render_kernel(
 	/* scene's Meshes */
-	__constant Mesh* meshes,
+	__global const Mesh* restrict meshes,
 	
 	/* window size */
 	const int width, const int height,
@@ -86,22 +119,43 @@ __kernel void render_kernel(
 	__write_only image2d_t output_tex,
 	
 	/* BVH */
-	__constant uint* primitive_indices,
-	__constant float4* vertices,
-	__constant float4* normals,
-	__constant Material* mat,
+	__global const uint* restrict faces,
+	__global const float* restrict vertices,
+	__global const float* restrict normals,
+	__global const Material* restrict mat,
 
 	/* enviroment map */
 	__read_only image2d_t env_map,
 
-	__global RTD* r_flat,
+	/* per pixel path state, see path_state.cl */
+	__global float4* path_state,
+
+	__global const BVHNode* restrict new_bvh_node,
+
+	/* started paths and the reset epoch of the path state, see countSamples() */
+	__global uint* sample_count,
+
+	/* adaptive sampling, NULL: every pixel is active */
+	__global const uchar* active_mask,
 
-	__constant new_bvhNode* new_bvh_node
+	/* scene settings that don't need a rebuild */
+	__constant Settings* settings,
+
+	/* work-group shape picked by the host's autotuner, see pixelCoord() */
+	const int4 pixel_order
+
+	/* traversal counters, see RAY_STATS in header.cl */
+	RAY_STATS_PARAM
 ) {
-	const int work_item_id = get_global_id(0);			/* the unique global id of the work item for the current pixel */
+	__local uint l_count;
 
 	/* xy-coordinate of the pixel */
-	const int2 i_coord = (int2)(work_item_id % width, work_item_id / width);
+	const int2 i_coord = pixelCoord(get_global_id(0), width, pixel_order);
+
+	/* the global work size is rounded up to whole work-groups, the padding only takes part in countSamples() */
+	const bool inside = i_coord.x < width && i_coord.y < height;
+
+	const int work_item_id = inside ? i_coord.y * width + i_coord.x : 0;			/* the index of the pixel's path state */
 
 #if RNG_TYPE == 0
 	/* seeds for random number generator */
@@ -114,12 +168,27 @@ __kernel void render_kernel(
 	double seed = dot(f_coord, (float2)(framenumber % 1000 + random0 * 100, framenumber % 333 + random1 * 33));
 #endif
 
-	__global RLH* rlh = &r_flat[work_item_id].data;
+	const PathState ps = pathState(path_state, width * height);
+	const uint epoch = sample_count[SAMPLE_COUNT_EPOCH];
+
+	RLH path;
+	RLH* rlh = &path;
+	loadPathEpoch(&ps, work_item_id, epoch, rlh);
+
+	/* converged pixels don't start new paths */
+	const bool idle = !inside || (active_mask && !active_mask[work_item_id] && rlh->reset);
+	const bool first_bounce = !idle && (rlh->reset || rlh->samples == 0);
 
-	Ray ray = tempToRay(r_flat[work_item_id].ray);
+	countSamples(sample_count, first_bounce, &l_count);
+	if (idle)
+		return;
+
+	Ray ray = loadRay(&ps, work_item_id);
+
+	RAY_STATS_BEGIN
 
 	// firstBounce or reset
-	if (rlh->reset || rlh->samples == 0) {
+	if (first_bounce) {
 		++rlh->samples;
 		rlh->bounce.total = 0;
 		rlh->bounce.diff = 0;
@@ -133,13 +202,16 @@ __kernel void render_kernel(
 
 		// @ToDo generate cam ray on CPU
 		ray = createCamRay(i_coord, width, height, cam, RNG_SEED_VALUE_P);
+		RAY_STATS_ADD(&stats, RAY_STATS_PRIMARY, 1)
 	}
 
-	const Scene scene = { meshes, primitive_indices, new_bvh_node, &mesh_count, vertices, normals, mat };
+	const Scene scene = { meshes, faces, new_bvh_node, &mesh_count, vertices, normals, mat, settings RAY_STATS_SCENE };
 
 #if VIEW_OPTION == VIEW_RESULTS
 	/* add pixel colour to accumulation buffer (accumulates all samples) */
-	rlh->acc += radiance(&scene, env_map, &ray, rlh, RNG_SEED_VALUE_P);
+	const float4 contrib = radiance(&scene, env_map, &ray, rlh, RNG_SEED_VALUE_P);
+	rlh->acc += contrib;
+	accumulateMoments(rlh, contrib);
 #elif VIEW_OPTION == VIEW_NORMAL
 	radiance(&scene, env_map, &ray, rlh, RNG_SEED_VALUE_P);
 	rlh->acc = (float4)(ray.normal, 1.0f);
@@ -152,7 +224,8 @@ __kernel void render_kernel(
 	rlh->acc = (float4)(ray.normal, 1.0f);
 #endif
 
-	r_flat[work_item_id].ray = rayToTemp(ray);
+	storeRay(&ps, work_item_id, &ray);
+	storePathEpoch(&ps, work_item_id, epoch, rlh);
 
 	/* update the output GLTexture */
 #if VIEW_OPTION == VIEW_RESULTS
@@ -160,6 +233,13 @@ __kernel void render_kernel(
 #else
 	write_imagef(output_tex, i_coord, rlh->acc);
 #endif
+
+	RAY_STATS_END
 }
 
+#FILE:integrators/persistent.cl
+#FILE:integrators/wavefront.cl
+
+#FILE:geometry/lbvh.cl
+
 #endif
\ No newline at end of file
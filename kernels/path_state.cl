@@ -0,0 +1,161 @@
+#ifndef __PATH_STATE__
+#define __PATH_STATE__
+
+/*
+ * Per pixel path state as a structure of arrays, the streams of `n` paths follow each other in one buffer:
+ *
+ *   float4 origin[n]	xyz: origin, w: time
+ *   float4 dir[n]		xyz: direction, w: distance
+ *   float4 mask[n]		xyz: throughput, w: luminance of the current path
+ *   float4 acc[n]		accumulated radiance
+ *   float2 moments[n]	luminance sum and sum of squares of the finished paths
+ *   uint bounces[n]	counters and flags, see packBounces()
+ *   uint samples[n]
+ *   uint epoch[n]		reset epoch of the last write
+ *
+ * Kernels only touch the streams they need. Instead of clearing the buffer the host
+ * bumps the epoch (sample_count[2]), a pixel of an older epoch reads as a fresh one.
+ * Keep in sync with include/Integrators/path_state.h
+ */
+
+typedef struct {
+	__global float4* origin;
+	__global float4* dir;
+	__global float4* mask;
+	__global float4* acc;
+	__global float2* moments;
+	__global uint* bounces;
+	__global uint* samples;
+	__global uint* epoch;
+} PathState;
+
+PathState pathState(__global float4* base, const uint n) {
+	PathState ps;
+	ps.origin = base;
+	ps.dir = base + n;
+	ps.mask = base + 2 * n;
+	ps.acc = base + 3 * n;
+	ps.moments = (__global float2*)(base + 4 * n);
+	ps.bounces = (__global uint*)(ps.moments + n);
+	ps.samples = ps.bounces + n;
+	ps.epoch = ps.samples + n;
+	return ps;
+}
+
+/*------------------- Ray -------------------*/
+
+Ray loadRay(const PathState* ps, const uint id) {
+	const float4 origin = ps->origin[id];
+	const float4 dir = ps->dir[id];
+	return (Ray){ origin.xyz, dir.xyz, (float3)(0.0f), (float3)(0.0f), {dir.w}, false, origin.w };
+}
+
+void storeRay(const PathState* ps, const uint id, const Ray* ray) {
+	ps->origin[id] = (float4)(ray->origin, ray->time);
+	ps->dir[id] = (float4)(ray->dir, ray->t);
+}
+
+/*------------------- Bounces -------------------*/
+
+/*
+ * total: 8 bits, diff: 5, spec: 5, trans: 6, scatters: 6, wasSpecular: 1, reset: 1
+ * the counters saturate, the host clamps the bounce limits to these ranges
+ */
+#define PATH_MAX_TOTAL		255u
+#define PATH_MAX_DIFF		31u
+#define PATH_MAX_SPEC		31u
+#define PATH_MAX_TRANS		63u
+#define PATH_MAX_SCATTERS	63u
+
+uint packBounces(const RLH* rlh) {
+	return min(rlh->bounce.total, PATH_MAX_TOTAL) |
+		(min((uint)rlh->bounce.diff, PATH_MAX_DIFF) << 8) |
+		(min((uint)rlh->bounce.spec, PATH_MAX_SPEC) << 13) |
+		(min((uint)rlh->bounce.trans, PATH_MAX_TRANS) << 18) |
+		(min((uint)rlh->bounce.scatters, PATH_MAX_SCATTERS) << 24) |
+		((uint)rlh->bounce.wasSpecular << 30) |
+		((uint)rlh->reset << 31);
+}
+
+void unpackBounces(const uint bounces, RLH* rlh) {
+	rlh->bounce.total = bounces & PATH_MAX_TOTAL;
+	rlh->bounce.diff = (bounces >> 8) & PATH_MAX_DIFF;
+	rlh->bounce.spec = (bounces >> 13) & PATH_MAX_SPEC;
+	rlh->bounce.trans = (bounces >> 18) & PATH_MAX_TRANS;
+	rlh->bounce.scatters = (bounces >> 24) & PATH_MAX_SCATTERS;
+	rlh->bounce.wasSpecular = (bounces >> 30) & 1u;
+	rlh->reset = bounces >> 31;
+}
+
+/*------------------- Path -------------------*/
+
+/* the caller knows the pixel was written in the current epoch */
+void loadPath(const PathState* ps, const uint id, RLH* rlh) {
+	const float4 mask = ps->mask[id];
+	const float2 moments = ps->moments[id];
+
+	rlh->mask = mask.xyz;
+	rlh->path_lum = mask.w;
+	rlh->acc = ps->acc[id];
+	rlh->lum_sum = moments.x;
+	rlh->lum_sqr = moments.y;
+	unpackBounces(ps->bounces[id], rlh);
+	rlh->samples = ps->samples[id];
+}
+
+void storePath(const PathState* ps, const uint id, const RLH* rlh) {
+	ps->mask[id] = (float4)(rlh->mask, rlh->path_lum);
+	ps->acc[id] = rlh->acc;
+	ps->moments[id] = (float2)(rlh->lum_sum, rlh->lum_sqr);
+	ps->bounces[id] = packBounces(rlh);
+	ps->samples[id] = rlh->samples;
+}
+
+/* lazy reset, a pixel that wasn't written since the host's last reset starts from scratch */
+void loadPathEpoch(const PathState* ps, const uint id, const uint epoch, RLH* rlh) {
+	if (ps->epoch[id] == epoch) {
+		loadPath(ps, id, rlh);
+		return;
+	}
+
+	rlh->mask = (float3)(0.0f);
+	rlh->path_lum = 0.0f;
+	rlh->acc = (float4)(0.0f);
+	rlh->lum_sum = 0.0f;
+	rlh->lum_sqr = 0.0f;
+	unpackBounces(0u, rlh);
+	rlh->samples = 0;
+}
+
+void storePathEpoch(const PathState* ps, const uint id, const uint epoch, const RLH* rlh) {
+	storePath(ps, id, rlh);
+	ps->epoch[id] = epoch;
+}
+
+/*------------------- Sample count -------------------*/
+
+/*
+ * sample_count[0], [1]: low and high word of the paths started since the last reset, [2]: reset epoch.
+ * A 32 bit count wraps after a few thousand spp at 720p. Adds the `n` paths this work-item started
+ * with one global atomic per work-group, every work-item of the group has to call it.
+ */
+#define SAMPLE_COUNT_EPOCH	2
+
+void countSamples(__global uint* sample_count, const uint n, __local uint* l_count) {
+	if (get_local_id(0) == 0)
+		*l_count = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (n)
+		atomic_add(l_count, n);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0 && *l_count) {
+		/* the add that wraps the low word carries into the high one */
+		const uint old = atomic_add(&sample_count[0], *l_count);
+		if (old + *l_count < old)
+			atomic_inc(&sample_count[1]);
+	}
+}
+
+#endif
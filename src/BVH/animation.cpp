@@ -0,0 +1,86 @@
+#include <BVH/animation.h>
+
+#include <algorithm>
+#include <iostream>
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    ModelAnimation::ModelAnimation(std::unique_ptr<BVH> bvh, IO::IndexedMesh mesh, std::vector<cl_uint> order, float fps)
+        : bvh(std::move(bvh)), mesh(std::move(mesh)), order(std::move(order)), fps(fps)
+    {
+    }
+
+    bool ModelAnimation::AddFrame(const std::shared_ptr<IO::ModelLoader> &ml)
+    {
+        std::vector<cl_float> corners;
+        corners.reserve(18 * order.size());
+
+        auto scene = ml->getFaces();
+        for (const auto &m : scene->meshes)
+        {
+            for (const auto &face : m.faces)
+            {
+                for (const auto &point : face.points)
+                {
+                    corners.insert(corners.end(), {point.pos.x, point.pos.y, point.pos.z});
+                    corners.insert(corners.end(), {point.nor.x, point.nor.y, point.nor.z});
+                }
+            }
+        }
+
+        if (corners.size() != 18 * order.size())
+        {
+            std::cerr << "[Animation] the frame has " << corners.size() / 18 << " triangles, the model " << order.size() << std::endl;
+            return false;
+        }
+
+        frames.push_back(std::move(corners));
+        return true;
+    }
+
+    std::size_t ModelAnimation::GetFrameAt(double time) const
+    {
+        if (frames.empty())
+            return 0;
+        return (std::size_t)std::max(0.0, time * fps) % frames.size();
+    }
+
+    bool ModelAnimation::SetFrame(std::size_t frame, float rebuild_threshold)
+    {
+        if (frame >= frames.size())
+            return false;
+
+        // the mesh isn't welded, every corner has its own vertex
+        const std::vector<cl_float> &corners = frames[frame];
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            const cl_float *triangle = &corners[18 * order[i]];
+            for (std::size_t c = 0; c < 3; ++c)
+            {
+                const cl_uint v = mesh.faces[3 * i + c];
+                std::copy(triangle + 6 * c + 0, triangle + 6 * c + 3, &mesh.positions[3 * v]);
+                std::copy(triangle + 6 * c + 3, triangle + 6 * c + 6, &mesh.normals[3 * v]);
+            }
+        }
+
+        bvh->Refit(mesh);
+
+        const float degradation = bvh->GetDegradation();
+        if (rebuild_threshold > 0.0f && degradation <= rebuild_threshold)
+            return false;
+
+        const double t0 = utils::getTime();
+        bvh->Rebuild();
+
+        // the new leaf order of the faces, `order` follows it back to the frames' triangles
+        std::vector<cl_uint> permutation;
+        bvh->PermuteFaces(&mesh, &permutation);
+        for (cl_uint &p : permutation)
+            p = order[p];
+        order = std::move(permutation);
+
+        std::cout << "[Animation] rebuilt the BVH at " << degradation << "x its SAH cost in " << (utils::getTime() - t0) << " seconds" << std::endl;
+        return true;
+    }
+} // namespace CL_RAYTRACER
@@ -1,4 +1,6 @@
 #include <BVH/bvh.h>
+#include <BVH/parallel_builder.h>
+#include <Scheduler/thread_pool.h>
 
 #include <Math/linear_algebra.h>
 #include <Model/model_loader.h>
@@ -9,10 +11,10 @@
 #include <bvh/ray.hpp>
 
 #include <bvh/single_ray_traverser.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
-
-#define GLFW_INCLUDE_NONE
-#include <GLFW/glfw3.h>
+#include <utils.h>
 
 using Vector3 = bvh::Vector3<Scalar>;
 using Ray = bvh::Ray<Scalar>;
@@ -28,8 +30,9 @@ namespace CL_RAYTRACER
         std::vector<cl_uchar3> color;
     };
 
-    BVH::BVH(const std::shared_ptr<IO::ModelLoader> &ml) : bvh(std::make_unique<Bvh>()),
-                                                                   model_loader(ml)
+    BVH::BVH(const std::shared_ptr<IO::ModelLoader> &ml, BVHBuilder builder) : bvh(std::make_unique<Bvh>()),
+                                                                                 model_loader(ml),
+                                                                                 builder(builder)
     {
         buildTree(ml);
     }
@@ -42,9 +45,6 @@ namespace CL_RAYTRACER
 
     void BVH::buildTree(const std::shared_ptr<IO::ModelLoader> &ml)
     {
-        std::cout << "[BVH] Building tree..." << std::endl;
-        double t0 = glfwGetTime();
-
         auto &scene = ml->getFaces();
         for (const auto &mesh : scene->meshes)
         {
@@ -55,29 +55,182 @@ namespace CL_RAYTRACER
             }
         }
 
-        auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(triangles.data(), triangles.size());
-        auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), triangles.size());
+        Rebuild();
+    }
 
-        // bvh::BinnedSahBuilder<Bvh, 64> builder(*bvh);
-        bvh::SweepSahBuilder<Bvh> builder(*bvh);
-        builder.build(global_bbox, bboxes.get(), centers.get(), triangles.size());
+    void BVH::Rebuild()
+    {
+        static const char *const names[] = {"sweep", "binned", "parallel"};
+        std::cout << "[BVH] Building tree (" << names[builder] << ")..." << std::endl;
+        double t0 = utils::getTime();
 
-        std::cout << "[BVH] Finished builing BVH(node_count = " << bvh->node_count << ") in "
-                  << (glfwGetTime() - t0) << "seconds" << std::endl;
+        if (builder == BVH_BUILDER_PARALLEL)
+        {
+            // started by the first parallel build and shared by every later one, animated models rebuild each frame
+            static ThreadPool pool;
+            buildParallelBinnedSah(pool, *bvh, triangles);
+        }
+        else
+        {
+            auto [bboxes, centers] = bvh::compute_bounding_boxes_and_centers(triangles.data(), triangles.size());
+            auto global_bbox = bvh::compute_bounding_boxes_union(bboxes.get(), triangles.size());
+
+            if (builder == BVH_BUILDER_BINNED)
+            {
+                bvh::BinnedSahBuilder<Bvh, 64> binned(*bvh);
+                binned.build(global_bbox, bboxes.get(), centers.get(), triangles.size());
+            }
+            else
+            {
+                bvh::SweepSahBuilder<Bvh> sweep(*bvh);
+                sweep.build(global_bbox, bboxes.get(), centers.get(), triangles.size());
+            }
+        }
+
+        const double build_time = utils::getTime() - t0;
+        build_cost = GetCost();
+
+        std::cout << "[BVH] Finished builing BVH(node_count = " << bvh->node_count << ", SAH cost = " << build_cost << ") in "
+                  << build_time << "seconds" << std::endl;
     }
 
-    std::unique_ptr<std::vector<cl_ulong>> BVH::GetPrimitiveIndices() const {
-        std::unique_ptr<std::vector<cl_ulong>> res = std::make_unique<std::vector<cl_ulong>>();
-        for(size_t i = 0; i < triangles.size(); ++i){
-            res->emplace_back(bvh->primitive_indices[i]);
+    void BVH::PermuteFaces(IO::IndexedMesh *mesh, std::vector<cl_uint> *order)
+    {
+        const std::size_t face_count = triangles.size();
+        if (mesh->getFaceCount() != face_count)
+        {
+            std::cerr << "[BVH] the mesh doesn't match the tree (" << mesh->getFaceCount() << " faces, " << face_count << " triangles)" << std::endl;
+            return;
+        }
+
+        constexpr cl_uint UNUSED = ~0u;
+        std::vector<cl_uint> remap(mesh->getVertexCount(), UNUSED);
+        std::vector<cl_float> positions;
+        std::vector<cl_float> normals;
+        std::vector<cl_uint> faces;
+        std::vector<Triangle> sorted;
+        positions.reserve(mesh->positions.size());
+        normals.reserve(mesh->normals.size());
+        faces.reserve(mesh->faces.size());
+        sorted.reserve(face_count);
+        if (order)
+            order->assign(face_count, 0);
+
+        for (std::size_t i = 0; i < face_count; ++i)
+        {
+            const std::size_t f = bvh->primitive_indices[i];
+            for (std::size_t c = 0; c < 3; ++c)
+            {
+                const cl_uint v = mesh->faces[3 * f + c];
+                if (remap[v] == UNUSED)
+                {
+                    remap[v] = (cl_uint)(positions.size() / 3);
+                    positions.insert(positions.end(), &mesh->positions[3 * v], &mesh->positions[3 * v] + 3);
+                    normals.insert(normals.end(), &mesh->normals[3 * v], &mesh->normals[3 * v] + 3);
+                }
+                faces.push_back(remap[v]);
+            }
+            sorted.push_back(triangles[f]);
+            if (order)
+                (*order)[i] = (cl_uint)f;
+
+            // the tree now references the triangles in place
+            bvh->primitive_indices[i] = i;
         }
-        return res;
+
+        mesh->positions = std::move(positions);
+        mesh->normals = std::move(normals);
+        mesh->faces = std::move(faces);
+        triangles = std::move(sorted);
     }
 
-    std::unique_ptr<std::vector<cl_BVHnode>> BVH::PrepareData() const
+    void BVH::Refit(const IO::IndexedMesh &mesh)
+    {
+        if (mesh.getFaceCount() != triangles.size())
+        {
+            std::cerr << "[BVH] the mesh doesn't match the tree (" << mesh.getFaceCount() << " faces, " << triangles.size() << " triangles)" << std::endl;
+            return;
+        }
+
+        const auto vertex = [&mesh](cl_uint v) {
+            return Vector3(mesh.positions[3 * v + 0], mesh.positions[3 * v + 1], mesh.positions[3 * v + 2]);
+        };
+        for (std::size_t i = 0; i < triangles.size(); ++i)
+            triangles[i] = Triangle(vertex(mesh.faces[3 * i + 0]), vertex(mesh.faces[3 * i + 1]), vertex(mesh.faces[3 * i + 2]));
+
+        // the children are always stored after their parent, one backward pass reaches the root last
+        for (std::size_t i = bvh->node_count; i-- > 0;)
+        {
+            Bvh::Node &node = bvh->nodes[i];
+            for (int a = 0; a < 3; ++a)
+            {
+                node.bounds[2 * a + 0] = INFINITY;
+                node.bounds[2 * a + 1] = -INFINITY;
+            }
+
+            if (node.is_leaf)
+            {
+                for (std::size_t p = node.first_child_or_primitive; p < node.first_child_or_primitive + node.primitive_count; ++p)
+                {
+                    const Triangle &tri = triangles[bvh->primitive_indices[p]];
+                    for (const auto &v : {tri.p0, tri.p1(), tri.p2()})
+                    {
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            node.bounds[2 * a + 0] = std::min(node.bounds[2 * a + 0], v[a]);
+                            node.bounds[2 * a + 1] = std::max(node.bounds[2 * a + 1], v[a]);
+                        }
+                    }
+                }
+                continue;
+            }
+
+            for (std::size_t c = 0; c < 2; ++c)
+            {
+                const Bvh::Node &child = bvh->nodes[node.first_child_or_primitive + c];
+                for (int a = 0; a < 3; ++a)
+                {
+                    node.bounds[2 * a + 0] = std::min(node.bounds[2 * a + 0], child.bounds[2 * a + 0]);
+                    node.bounds[2 * a + 1] = std::max(node.bounds[2 * a + 1], child.bounds[2 * a + 1]);
+                }
+            }
+        }
+    }
+
+    float BVH::GetCost() const
+    {
+        const auto halfArea = [](const Bvh::Node &node) {
+            const float dx = node.bounds[1] - node.bounds[0], dy = node.bounds[3] - node.bounds[2], dz = node.bounds[5] - node.bounds[4];
+            return dx * dy + dy * dz + dz * dx;
+        };
+
+        // a traversal step and a triangle test cost the same, like in the builder
+        double cost = 0.0;
+        for (std::size_t i = 0; i < bvh->node_count; ++i)
+        {
+            const Bvh::Node &node = bvh->nodes[i];
+            cost += halfArea(node) * (node.is_leaf ? (double)node.primitive_count : 1.0);
+        }
+
+        const float root_area = halfArea(bvh->nodes[0]);
+        return root_area > 0.0f ? (float)(cost / root_area) : 0.0f;
+    }
+
+    float BVH::GetDegradation() const
+    {
+        return build_cost > 0.0f ? GetCost() / build_cost : 1.0f;
+    }
+
+    void BVH::GetBounds(float *bounds) const
+    {
+        for (int i = 0; i < 6; ++i)
+            bounds[i] = bvh->nodes[0].bounds[i];
+    }
+
+    std::unique_ptr<std::vector<cl_BVHnode>> BVH::PrepareData(cl_uint node_offset, cl_uint primitive_offset) const
     {
         std::unique_ptr<std::vector<cl_BVHnode>> res = std::make_unique<std::vector<cl_BVHnode>>();
-        for (int i = 0; i < bvh->node_count; ++i)
+        for (std::size_t i = 0; i < bvh->node_count; ++i)
         {
             const Bvh::Node &node = bvh->nodes[i];
             
@@ -91,8 +244,44 @@ namespace CL_RAYTRACER
             bb.is_leaf = node.is_leaf;
             bb.first_child_or_primitive = node.first_child_or_primitive;
             bb.primitive_count = node.primitive_count;
+            bb.parent = 0;
+            bb.split = 0;
             res->push_back(bb);
         }
+
+        // parent pointers and the near child along each node's axis of largest separation
+        for (std::size_t i = 0; i < bvh->node_count; ++i)
+        {
+            cl_BVHnode &node = (*res)[i];
+            if (node.is_leaf)
+                continue;
+
+            cl_BVHnode &left = (*res)[node.first_child_or_primitive + 0];
+            cl_BVHnode &right = (*res)[node.first_child_or_primitive + 1];
+            left.parent = right.parent = (unsigned int)i;
+            right.split |= BVH_SECOND_CHILD;
+
+            unsigned char axis = 0;
+            float separation = -1.0f;
+            for (unsigned char a = 0; a < 3; ++a)
+            {
+                const float delta = std::abs((right.bounds[2 * a] + right.bounds[2 * a + 1]) - (left.bounds[2 * a] + left.bounds[2 * a + 1]));
+                if (delta > separation)
+                {
+                    axis = a;
+                    separation = delta;
+                }
+            }
+            const bool flip = right.bounds[2 * axis] + right.bounds[2 * axis + 1] < left.bounds[2 * axis] + left.bounds[2 * axis + 1];
+            node.split |= axis | (flip ? BVH_SPLIT_FLIP : 0);
+        }
+
+        // relocate into the shared buffers, the root is its own parent
+        for (cl_BVHnode &node : *res)
+        {
+            node.first_child_or_primitive += node.is_leaf ? primitive_offset : node_offset;
+            node.parent += node_offset;
+        }
         return res;
     }
 
@@ -0,0 +1,223 @@
+#include <BVH/lbvh.h>
+#include <BVH/bvh.h>
+#include <Profiling/profiler.h>
+
+#include <algorithm>
+#include <iostream>
+
+extern cl::Context context;
+
+namespace CL_RAYTRACER
+{
+    // 4 bit digits over the 30 bit Morton codes, an even count leaves the result in the first buffers
+    constexpr cl_uint LBVH_RADIX = 16;
+    constexpr cl_uint LBVH_RADIX_PASSES = 8;
+
+    LBVHBuilder::LBVHBuilder(const cl::Program &program, const cl::Device &device)
+    {
+        morton = cl::Kernel(program, "lbvh_morton");
+        radix_count = cl::Kernel(program, "lbvh_radix_count");
+        radix_scan = cl::Kernel(program, "lbvh_radix_scan");
+        radix_scatter = cl::Kernel(program, "lbvh_radix_scatter");
+        hierarchy = cl::Kernel(program, "lbvh_hierarchy");
+        leaves = cl::Kernel(program, "lbvh_leaves");
+
+        // the scans and the local sort of the scatter are written for whole groups
+        const std::size_t group_size = std::min({
+            morton.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            radix_count.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            radix_scan.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            radix_scatter.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            hierarchy.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            leaves.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)});
+        supported = group_size >= LBVH_GROUP_SIZE;
+        if (!supported)
+            std::cout << "[LBVH] the device runs work-groups of up to " << group_size << " work-items, the builder needs " << LBVH_GROUP_SIZE << std::endl;
+    }
+
+    LBVHBuilder::~LBVHBuilder() {}
+
+    void LBVHBuilder::build(const cl::CommandQueue &queue, const cl::Buffer &vertices, const cl::Buffer &faces, const cl::Buffer &nodes,
+                            cl_uint root, cl_uint primitive_offset, cl_uint face_count, const float *bounds,
+                            const std::vector<cl::Event> *events, cl::Event *event)
+    {
+        // no zero-sized NDRanges or buffers
+        if (face_count == 0)
+            return;
+
+        const cl_uint groups = (face_count + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE;
+        const std::size_t global_work_size = groups * LBVH_GROUP_SIZE;
+        const cl_uint internal_count = std::max(face_count, 2u) - 1;
+
+        // the leaves read the faces in their original order while they write them in leaf order
+        cl::Buffer source(context, CL_MEM_READ_WRITE, 3 * sizeof(cl_uint) * face_count);
+        cl::Buffer keys[2] = {cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * face_count),
+                              cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * face_count)};
+        cl::Buffer values[2] = {cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * face_count),
+                                cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * face_count)};
+        cl::Buffer histograms(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * LBVH_RADIX * groups);
+        cl::Buffer children(context, CL_MEM_READ_WRITE, sizeof(cl_uint2) * internal_count);
+        cl::Buffer parents(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * (2 * internal_count + 1));
+        cl::Buffer arrivals(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * internal_count);
+
+        queue.enqueueCopyBuffer(faces, source, 3 * sizeof(cl_uint) * primitive_offset, 0, 3 * sizeof(cl_uint) * face_count,
+                                events, PROFILE_EVENT("lbvh copy faces"));
+        queue.enqueueFillBuffer(arrivals, 0u, 0, sizeof(cl_uint) * internal_count, nullptr, PROFILE_EVENT("lbvh fill arrivals"));
+
+        // a flat axis is quantized to 0
+        cl_float4 lo = {{bounds[0], bounds[2], bounds[4], 0.0f}};
+        cl_float4 inv_extent = {{0.0f, 0.0f, 0.0f, 0.0f}};
+        for (int a = 0; a < 3; ++a)
+        {
+            const float extent = bounds[2 * a + 1] - bounds[2 * a];
+            if (extent > 0.0f)
+                inv_extent.s[a] = 1.0f / extent;
+        }
+
+        morton.setArg(0, source);
+        morton.setArg(1, vertices);
+        morton.setArg(2, face_count);
+        morton.setArg(3, lo);
+        morton.setArg(4, inv_extent);
+        morton.setArg(5, keys[0]);
+        morton.setArg(6, values[0]);
+        queue.enqueueNDRangeKernel(morton, cl::NullRange, global_work_size, LBVH_GROUP_SIZE, nullptr, PROFILE_EVENT("lbvh_morton"));
+
+        radix_count.setArg(1, face_count);
+        radix_count.setArg(3, histograms);
+        radix_scan.setArg(0, histograms);
+        radix_scan.setArg(1, LBVH_RADIX * groups);
+        radix_scatter.setArg(2, face_count);
+        radix_scatter.setArg(4, histograms);
+        for (cl_uint pass = 0; pass < LBVH_RADIX_PASSES; ++pass)
+        {
+            const cl_uint shift = 4 * pass;
+            const cl_uint in = pass & 1;
+
+            radix_count.setArg(0, keys[in]);
+            radix_count.setArg(2, shift);
+            queue.enqueueNDRangeKernel(radix_count, cl::NullRange, global_work_size, LBVH_GROUP_SIZE, nullptr, PROFILE_EVENT("lbvh_radix_count"));
+
+            queue.enqueueNDRangeKernel(radix_scan, cl::NullRange, LBVH_GROUP_SIZE, LBVH_GROUP_SIZE, nullptr, PROFILE_EVENT("lbvh_radix_scan"));
+
+            radix_scatter.setArg(0, keys[in]);
+            radix_scatter.setArg(1, values[in]);
+            radix_scatter.setArg(3, shift);
+            radix_scatter.setArg(5, keys[1 - in]);
+            radix_scatter.setArg(6, values[1 - in]);
+            queue.enqueueNDRangeKernel(radix_scatter, cl::NullRange, global_work_size, LBVH_GROUP_SIZE, nullptr, PROFILE_EVENT("lbvh_radix_scatter"));
+        }
+
+        // a single face is a leaf root, there's no internal node
+        if (face_count > 1)
+        {
+            hierarchy.setArg(0, keys[0]);
+            hierarchy.setArg(1, face_count);
+            hierarchy.setArg(2, children);
+            hierarchy.setArg(3, parents);
+            queue.enqueueNDRangeKernel(hierarchy, cl::NullRange, global_work_size, LBVH_GROUP_SIZE, nullptr, PROFILE_EVENT("lbvh_hierarchy"));
+        }
+
+        leaves.setArg(0, source);
+        leaves.setArg(1, vertices);
+        leaves.setArg(2, values[0]);
+        leaves.setArg(3, children);
+        leaves.setArg(4, parents);
+        leaves.setArg(5, face_count);
+        leaves.setArg(6, root);
+        leaves.setArg(7, primitive_offset);
+        leaves.setArg(8, faces);
+        leaves.setArg(9, nodes);
+        leaves.setArg(10, arrivals);
+        queue.enqueueNDRangeKernel(leaves, cl::NullRange, global_work_size, LBVH_GROUP_SIZE, nullptr, event);
+        if (event)
+            PROFILE_ADD_EVENT("lbvh_leaves", *event);
+    }
+
+    float LBVHBuilder::verify(const cl::CommandQueue &queue, const std::vector<cl_float> &positions, const cl::Buffer &faces, const cl::Buffer &nodes,
+                              cl_uint root, cl_uint primitive_offset, cl_uint face_count) const
+    {
+        if (face_count == 0)
+            return 0.0f;
+
+        const cl_uint node_count = 2 * face_count - 1;
+        std::vector<cl_BVHnode> tree(node_count);
+        std::vector<cl_uint> indices(3 * face_count);
+        queue.enqueueReadBuffer(nodes, CL_TRUE, sizeof(cl_BVHnode) * root, sizeof(cl_BVHnode) * node_count, tree.data());
+        queue.enqueueReadBuffer(faces, CL_TRUE, 3 * sizeof(cl_uint) * primitive_offset, 3 * sizeof(cl_uint) * face_count, indices.data());
+
+        const auto halfArea = [](const cl_BVHnode &node) {
+            const float dx = node.bounds[1] - node.bounds[0], dy = node.bounds[3] - node.bounds[2], dz = node.bounds[5] - node.bounds[4];
+            return dx * dy + dy * dz + dz * dx;
+        };
+        const auto contains = [](const float *outer, const float *inner) {
+            for (int a = 0; a < 3; ++a)
+                if (inner[2 * a] < outer[2 * a] || inner[2 * a + 1] > outer[2 * a + 1])
+                    return false;
+            return true;
+        };
+        const auto broken = [&](const char *what, cl_uint node) {
+            std::cout << "[LBVH] broken tree at node " << root + node << ": " << what << std::endl;
+            return -1.0f;
+        };
+
+        // the device merges the boxes with min/max of the same floats, containment holds exactly
+        std::vector<bool> visited(node_count, false), seen(face_count, false);
+        std::vector<cl_uint> stack = {0};
+        cl_uint leaf_count = 0;
+        double cost = 0.0;
+        while (!stack.empty())
+        {
+            const cl_uint i = stack.back();
+            stack.pop_back();
+            if (visited[i])
+                return broken("reached twice", i);
+            visited[i] = true;
+
+            const cl_BVHnode &node = tree[i];
+            if (node.parent < root || node.parent - root >= node_count)
+                return broken("parent out of range", i);
+            cost += halfArea(node) * (node.is_leaf ? (double)node.primitive_count : 1.0);
+
+            if (node.is_leaf)
+            {
+                const cl_uint face = node.first_child_or_primitive - primitive_offset;
+                if (node.primitive_count != 1 || node.first_child_or_primitive < primitive_offset || face >= face_count)
+                    return broken("face out of range", i);
+                if (seen[face])
+                    return broken("face in two leaves", i);
+                seen[face] = true;
+                ++leaf_count;
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    const std::size_t vertex = indices[3 * face + k];
+                    if (3 * vertex + 2 >= positions.size())
+                        return broken("vertex out of range", i);
+                    const float point[6] = {positions[3 * vertex], positions[3 * vertex], positions[3 * vertex + 1],
+                                            positions[3 * vertex + 1], positions[3 * vertex + 2], positions[3 * vertex + 2]};
+                    if (!contains(node.bounds, point))
+                        return broken("triangle outside the leaf", i);
+                }
+                continue;
+            }
+
+            const cl_uint first = node.first_child_or_primitive - root;
+            if (node.first_child_or_primitive < root || first + 1 >= node_count)
+                return broken("children out of range", i);
+            for (cl_uint child = first; child < first + 2; ++child)
+            {
+                if (tree[child].parent != root + i)
+                    return broken("parent link", child);
+                if (!contains(node.bounds, tree[child].bounds))
+                    return broken("child outside its parent", child);
+                stack.push_back(child);
+            }
+        }
+        if (leaf_count != face_count || tree[0].parent != root)
+            return broken("unreachable nodes", 0);
+
+        const float root_area = halfArea(tree[0]);
+        return root_area > 0.0f ? (float)(cost / root_area) : 0.0f;
+    }
+} // namespace CL_RAYTRACER
@@ -0,0 +1,329 @@
+#include <BVH/parallel_builder.h>
+
+#include <bvh/bvh.hpp>
+#include <bvh/triangle.hpp>
+
+#include <Scheduler/thread_pool.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+
+namespace CL_RAYTRACER
+{
+    namespace
+    {
+        constexpr std::size_t BIN_COUNT = 32;
+        // larger leaves are always split, the wide layouts split them again past WIDE_LEAF_SIZE
+        constexpr std::size_t MAX_LEAF_SIZE = 16;
+        // smaller subtrees are built by the task that split them
+        constexpr std::size_t TASK_SIZE = 4096;
+        // larger nodes are binned in chunks on every thread
+        constexpr std::size_t PARALLEL_BINNING_SIZE = 1 << 16;
+        constexpr std::size_t GRAIN = 1 << 14;
+
+        struct Box
+        {
+            float lo[3] = {INFINITY, INFINITY, INFINITY};
+            float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+            void extend(const Box &box)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = std::min(lo[a], box.lo[a]);
+                    hi[a] = std::max(hi[a], box.hi[a]);
+                }
+            }
+
+            void extend(const float *p)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = std::min(lo[a], p[a]);
+                    hi[a] = std::max(hi[a], p[a]);
+                }
+            }
+
+            float halfArea() const
+            {
+                const float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+                return dx * dy + dy * dz + dz * dx;
+            }
+        };
+
+        struct Bin
+        {
+            Box box;
+            Box centers;
+            std::size_t count = 0;
+
+            void extend(const Bin &bin)
+            {
+                box.extend(bin.box);
+                centers.extend(bin.centers);
+                count += bin.count;
+            }
+        };
+
+        using Bins = std::array<std::array<Bin, BIN_COUNT>, 3>;
+
+        // what a split reads of a primitive, partitioned in place so that every pass over a node is sequential
+        struct Reference
+        {
+            Box box;
+            float center[3];
+            std::size_t primitive;
+        };
+
+        // a node that still has to be built and its primitives in `references`
+        struct Range
+        {
+            std::size_t node;
+            std::size_t begin;
+            std::size_t end;
+            Box box;
+            Box centers;
+        };
+
+        class ParallelBuilder
+        {
+        private:
+            Bvh &bvh;
+            ThreadPool &pool;
+            std::vector<Reference> references;
+            // the root is node 0, the children pairs start at odd indices like in the bvh library
+            std::atomic<std::size_t> node_count{1};
+
+            // small nodes get a bin per primitive, setting up and sweeping all of them dominates near the leaves
+            static std::size_t binCount(const Range &range)
+            {
+                return std::min(BIN_COUNT, range.end - range.begin);
+            }
+
+            static std::size_t binIndex(const Range &range, int axis, float center)
+            {
+                const std::size_t bin_count = binCount(range);
+                const float extent = range.centers.hi[axis] - range.centers.lo[axis];
+                const std::size_t bin = (std::size_t)((center - range.centers.lo[axis]) * (bin_count / extent));
+                return std::min(bin, bin_count - 1);
+            }
+
+            void binRange(const Range &range, std::size_t begin, std::size_t end, Bins &bins) const
+            {
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    const Reference &ref = references[i];
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        if (range.centers.hi[a] <= range.centers.lo[a])
+                            continue;
+
+                        Bin &bin = bins[a][binIndex(range, a, ref.center[a])];
+                        bin.box.extend(ref.box);
+                        bin.centers.extend(ref.center);
+                        ++bin.count;
+                    }
+                }
+            }
+
+            Bins bin(const Range &range)
+            {
+                const std::size_t count = range.end - range.begin;
+                if (count < PARALLEL_BINNING_SIZE)
+                {
+                    Bins bins;
+                    binRange(range, range.begin, range.end, bins);
+                    return bins;
+                }
+
+                std::vector<Bins> partial((count + GRAIN - 1) / GRAIN);
+                pool.parallelFor(count, GRAIN, [&](std::size_t begin, std::size_t end) {
+                    binRange(range, range.begin + begin, range.begin + end, partial[begin / GRAIN]);
+                });
+
+                Bins bins;
+                for (const Bins &chunk : partial)
+                {
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        for (std::size_t b = 0; b < binCount(range); ++b)
+                            bins[a][b].extend(chunk[a][b]);
+                    }
+                }
+                return bins;
+            }
+
+            void makeLeaf(const Range &range)
+            {
+                Bvh::Node &node = bvh.nodes[range.node];
+                node.is_leaf = true;
+                node.primitive_count = range.end - range.begin;
+                node.first_child_or_primitive = range.begin;
+            }
+
+            // the boxes of [begin, end), for the splits the bins can't separate
+            Range bound(std::size_t node, std::size_t begin, std::size_t end) const
+            {
+                Range range = {node, begin, end, Box(), Box()};
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    range.box.extend(references[i].box);
+                    range.centers.extend(references[i].center);
+                }
+                return range;
+            }
+
+            void build(Range range)
+            {
+                Bvh::Node &node = bvh.nodes[range.node];
+                for (int a = 0; a < 3; ++a)
+                {
+                    node.bounds[2 * a + 0] = range.box.lo[a];
+                    node.bounds[2 * a + 1] = range.box.hi[a];
+                }
+
+                const std::size_t count = range.end - range.begin;
+                if (count <= 1)
+                {
+                    makeLeaf(range);
+                    return;
+                }
+
+                // the lowest SAH cost of every bin boundary, a sweep from each side
+                const Bins bins = bin(range);
+                const std::size_t bin_count = binCount(range);
+                int best_axis = -1;
+                std::size_t best_split = 0;
+                float best_cost = INFINITY;
+                for (int a = 0; a < 3; ++a)
+                {
+                    std::array<float, BIN_COUNT> right_cost;
+                    Bin right;
+                    for (std::size_t b = bin_count - 1; b > 0; --b)
+                    {
+                        right.extend(bins[a][b]);
+                        right_cost[b] = right.count ? right.box.halfArea() * right.count : 0.0f;
+                    }
+
+                    Bin left;
+                    for (std::size_t b = 1; b < bin_count; ++b)
+                    {
+                        left.extend(bins[a][b - 1]);
+                        if (left.count == 0 || left.count == count)
+                            continue;
+
+                        const float cost = left.box.halfArea() * left.count + right_cost[b];
+                        if (cost < best_cost)
+                        {
+                            best_axis = a;
+                            best_split = b;
+                            best_cost = cost;
+                        }
+                    }
+                }
+
+                // a traversal step and a triangle test cost the same, like in BVH::GetCost()
+                const float split_cost = 1.0f + best_cost / range.box.halfArea();
+                if (count <= MAX_LEAF_SIZE && (best_axis < 0 || split_cost >= (float)count))
+                {
+                    makeLeaf(range);
+                    return;
+                }
+
+                const std::size_t first_child = node_count.fetch_add(2);
+                node.is_leaf = false;
+                node.primitive_count = 0;
+                node.first_child_or_primitive = first_child;
+
+                Range left, right;
+                if (best_axis >= 0)
+                {
+                    const auto begin = references.begin() + range.begin;
+                    const auto middle = std::partition(begin, references.begin() + range.end, [&](const Reference &ref) {
+                        return binIndex(range, best_axis, ref.center[best_axis]) < best_split;
+                    });
+
+                    const std::size_t mid = range.begin + (middle - begin);
+                    left = {first_child + 0, range.begin, mid, Box(), Box()};
+                    right = {first_child + 1, mid, range.end, Box(), Box()};
+                    for (std::size_t b = 0; b < bin_count; ++b)
+                    {
+                        Range &side = b < best_split ? left : right;
+                        side.box.extend(bins[best_axis][b].box);
+                        side.centers.extend(bins[best_axis][b].centers);
+                    }
+                }
+                else
+                {
+                    // every center in one spot, split the range in half
+                    const std::size_t mid = range.begin + count / 2;
+                    left = bound(first_child + 0, range.begin, mid);
+                    right = bound(first_child + 1, mid, range.end);
+                }
+
+                ThreadPool::TaskGroup group;
+                if (left.end - left.begin >= TASK_SIZE)
+                    pool.spawn(group, [this, left] { build(left); });
+                else
+                    build(left);
+                build(right);
+                pool.wait(group);
+            }
+
+        public:
+            ParallelBuilder(ThreadPool &pool, Bvh &bvh) : bvh(bvh), pool(pool) {}
+
+            void build(const std::vector<Triangle> &triangles)
+            {
+                const std::size_t count = triangles.size();
+                bvh.nodes = std::make_unique<Bvh::Node[]>(std::max<std::size_t>(2 * count, 2) - 1);
+                bvh.primitive_indices = std::make_unique<std::size_t[]>(std::max<std::size_t>(count, 1));
+                node_count = 1;
+
+                references.resize(count);
+                pool.parallelFor(count, GRAIN, [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        const Triangle &tri = triangles[i];
+                        Box box;
+                        for (const auto &v : {tri.p0, tri.p1(), tri.p2()})
+                        {
+                            const float p[3] = {v[0], v[1], v[2]};
+                            box.extend(p);
+                        }
+                        references[i].box = box;
+                        for (int a = 0; a < 3; ++a)
+                            references[i].center[a] = 0.5f * (box.lo[a] + box.hi[a]);
+                        references[i].primitive = i;
+                    }
+                });
+
+                // the root's boxes, reduced per chunk
+                std::vector<Range> partial((count + GRAIN - 1) / GRAIN);
+                pool.parallelFor(count, GRAIN, [&](std::size_t begin, std::size_t end) {
+                    partial[begin / GRAIN] = bound(0, begin, end);
+                });
+
+                Range root = {0, 0, count, Box(), Box()};
+                for (const Range &chunk : partial)
+                {
+                    root.box.extend(chunk.box);
+                    root.centers.extend(chunk.centers);
+                }
+
+                build(root);
+                bvh.node_count = node_count;
+                for (std::size_t i = 0; i < count; ++i)
+                    bvh.primitive_indices[i] = references[i].primitive;
+            }
+        };
+    } // namespace
+
+    void buildParallelBinnedSah(ThreadPool &pool, Bvh &bvh, const std::vector<Triangle> &triangles)
+    {
+        ParallelBuilder builder(pool, bvh);
+        builder.build(triangles);
+    }
+} // namespace CL_RAYTRACER
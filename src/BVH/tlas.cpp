@@ -0,0 +1,227 @@
+#include <BVH/tlas.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace CL_RAYTRACER
+{
+    namespace
+    {
+        struct TLASItem
+        {
+            float bounds[6];
+            float center[3];
+            cl_uint ref;
+        };
+
+        void emptyBounds(float *bounds)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                bounds[2 * a + 0] = FLT_MAX;
+                bounds[2 * a + 1] = -FLT_MAX;
+            }
+        }
+
+        void extend(float *bounds, const float *other)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                bounds[2 * a + 0] = std::min(bounds[2 * a + 0], other[2 * a + 0]);
+                bounds[2 * a + 1] = std::max(bounds[2 * a + 1], other[2 * a + 1]);
+            }
+        }
+
+        float halfArea(const float *bounds)
+        {
+            const float dx = bounds[1] - bounds[0], dy = bounds[3] - bounds[2], dz = bounds[5] - bounds[4];
+            return dx * dy + dy * dz + dz * dx;
+        }
+
+        // levels of a balanced tree over `count` leaves
+        std::size_t ceilLog2(std::size_t count)
+        {
+            std::size_t levels = 0;
+            while (((std::size_t)1 << levels) < count)
+                ++levels;
+            return levels;
+        }
+
+        // splits [begin, end) in half along the longest axis of the centers, the children are at most one level deeper
+        // than a balanced tree
+        std::size_t medianSplit(std::vector<TLASItem> &items, std::size_t begin, std::size_t end)
+        {
+            float centers[6];
+            emptyBounds(centers);
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const float c[6] = {items[i].center[0], items[i].center[0], items[i].center[1], items[i].center[1], items[i].center[2], items[i].center[2]};
+                extend(centers, c);
+            }
+
+            int axis = 0;
+            for (int a = 1; a < 3; ++a)
+            {
+                if (centers[2 * a + 1] - centers[2 * a] > centers[2 * axis + 1] - centers[2 * axis])
+                    axis = a;
+            }
+
+            const std::size_t mid = begin + (end - begin) / 2;
+            std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end,
+                             [axis](const TLASItem &l, const TLASItem &r) { return l.center[axis] < r.center[axis]; });
+            return mid;
+        }
+
+        // the lowest SAH cost of the centroid order of every axis, sorts [begin, end) along it
+        std::size_t sahSplit(std::vector<TLASItem> &items, std::size_t begin, std::size_t end)
+        {
+            const std::size_t count = end - begin;
+            int best_axis = 0;
+            std::size_t best_split = begin + count / 2;
+            float best_cost = FLT_MAX;
+            std::vector<float> right_area(count);
+            for (int a = 0; a < 3; ++a)
+            {
+                std::sort(items.begin() + begin, items.begin() + end,
+                          [a](const TLASItem &l, const TLASItem &r) { return l.center[a] < r.center[a]; });
+
+                float bounds[6];
+                emptyBounds(bounds);
+                for (std::size_t i = count - 1; i > 0; --i)
+                {
+                    extend(bounds, items[begin + i].bounds);
+                    right_area[i] = halfArea(bounds);
+                }
+
+                emptyBounds(bounds);
+                for (std::size_t i = 1; i < count; ++i)
+                {
+                    extend(bounds, items[begin + i - 1].bounds);
+                    const float cost = halfArea(bounds) * i + right_area[i] * (count - i);
+                    if (cost < best_cost)
+                    {
+                        best_axis = a;
+                        best_split = begin + i;
+                        best_cost = cost;
+                    }
+                }
+            }
+
+            if (best_axis != 2)
+                std::sort(items.begin() + begin, items.begin() + end,
+                          [best_axis](const TLASItem &l, const TLASItem &r) { return l.center[best_axis] < r.center[best_axis]; });
+
+            return best_split;
+        }
+
+        // top-down SAH, sweeps the centroid order of every axis. The objects are few enough for a full sort.
+        // A node that couldn't fit a balanced subtree below TLAS_MAX_DEPTH anymore is split at the median instead,
+        // which keeps depth + ceilLog2(count) <= TLAS_MAX_DEPTH for every node
+        void build(std::vector<TLASItem> &items, std::size_t begin, std::size_t end, std::size_t index, std::size_t depth, std::vector<cl_BVHnode> &nodes)
+        {
+            cl_BVHnode &node = nodes[index];
+            emptyBounds(node.bounds);
+            for (std::size_t i = begin; i < end; ++i)
+                extend(node.bounds, items[i].bounds);
+            node.split = 0;
+
+            const std::size_t count = end - begin;
+            if (count == 1)
+            {
+                node.is_leaf = true;
+                node.first_child_or_primitive = items[begin].ref;
+                node.primitive_count = 1;
+                return;
+            }
+
+            // `node` doesn't survive the resize
+            const std::size_t first_child = nodes.size();
+            nodes.resize(first_child + 2);
+            nodes[index].is_leaf = false;
+            nodes[index].first_child_or_primitive = (cl_uint)first_child;
+            nodes[index].primitive_count = 0;
+            nodes[first_child + 0].parent = nodes[first_child + 1].parent = (cl_uint)index;
+
+            const std::size_t split = depth + ceilLog2(count) < TLAS_MAX_DEPTH ? sahSplit(items, begin, end) : medianSplit(items, begin, end);
+            build(items, begin, split, first_child + 0, depth + 1, nodes);
+            build(items, split, end, first_child + 1, depth + 1, nodes);
+        }
+    } // namespace
+
+    bool makeInstance(const cl_float *transform, cl_uint root, const float *bounds, cl_Instance *instance, float *world_bounds)
+    {
+        // m: the linear part, t: the translation
+        const float m[3][3] = {{transform[0], transform[1], transform[2]}, {transform[4], transform[5], transform[6]}, {transform[8], transform[9], transform[10]}};
+        const float t[3] = {transform[3], transform[7], transform[11]};
+
+        const float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                          m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                          m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        if (std::abs(det) < 1e-12f)
+            return false;
+
+        float inv[3][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                // cofactor of m[c][r]
+                const int r0 = (c + 1) % 3, r1 = (c + 2) % 3, c0 = (r + 1) % 3, c1 = (r + 2) % 3;
+                inv[r][c] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+            }
+        }
+
+        for (int r = 0; r < 3; ++r)
+        {
+            instance->world_to_object[r] = {{inv[r][0], inv[r][1], inv[r][2],
+                                             -(inv[r][0] * t[0] + inv[r][1] * t[1] + inv[r][2] * t[2])}};
+        }
+        instance->root = root;
+        instance->pad[0] = instance->pad[1] = instance->pad[2] = 0;
+
+        // the corners of the model's box in world space
+        emptyBounds(world_bounds);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            const float p[3] = {bounds[corner & 1], bounds[2 + ((corner >> 1) & 1)], bounds[4 + ((corner >> 2) & 1)]};
+            float w[6];
+            for (int r = 0; r < 3; ++r)
+                w[2 * r + 0] = w[2 * r + 1] = m[r][0] * p[0] + m[r][1] * p[1] + m[r][2] * p[2] + t[r];
+            extend(world_bounds, w);
+        }
+        return true;
+    }
+
+    std::vector<cl_BVHnode> buildTLAS(const std::vector<TLASPrimitive> &primitives)
+    {
+        std::vector<TLASItem> items(primitives.size());
+        for (std::size_t i = 0; i < primitives.size(); ++i)
+        {
+            std::copy(primitives[i].bounds, primitives[i].bounds + 6, items[i].bounds);
+            items[i].ref = primitives[i].ref;
+        }
+
+        for (TLASItem &item : items)
+        {
+            for (int a = 0; a < 3; ++a)
+                item.center[a] = 0.5f * (item.bounds[2 * a + 0] + item.bounds[2 * a + 1]);
+        }
+
+        std::vector<cl_BVHnode> nodes(1);
+        nodes[0].parent = 0;
+        if (items.empty())
+        {
+            emptyBounds(nodes[0].bounds);
+            nodes[0].is_leaf = true;
+            nodes[0].first_child_or_primitive = 0;
+            nodes[0].primitive_count = 0;
+            nodes[0].split = 0;
+            return nodes;
+        }
+
+        nodes.reserve(2 * items.size() - 1);
+        build(items, 0, items.size(), 0, 0, nodes);
+        return nodes;
+    }
+} // namespace CL_RAYTRACER
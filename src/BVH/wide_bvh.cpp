@@ -0,0 +1,294 @@
+#include <BVH/bvh.h>
+#include <BVH/wide_bvh.h>
+
+#include <bvh/bvh.hpp>
+#include <bvh/triangle.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace CL_RAYTRACER
+{
+    namespace
+    {
+        struct Box
+        {
+            float lo[3] = {INFINITY, INFINITY, INFINITY};
+            float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+            void extend(const Box &box)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = std::min(lo[a], box.lo[a]);
+                    hi[a] = std::max(hi[a], box.hi[a]);
+                }
+            }
+
+            float halfArea() const
+            {
+                const float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+                return dx * dy + dy * dz + dz * dx;
+            }
+        };
+
+        // a child slot before it's encoded: a node of the binary tree or a range of primitives
+        struct WideChild
+        {
+            Box box;
+            bool leaf;
+            std::size_t node;
+            std::size_t first;
+            std::size_t count;
+        };
+
+        template <int N>
+        class WideCollapser
+        {
+        private:
+            const Bvh &bvh;
+            const std::vector<Triangle> &triangles;
+            const cl_uint node_offset;
+            const cl_uint primitive_offset;
+            // first primitive and primitive count below every node of the binary tree, the builders keep a subtree's
+            // primitives next to each other
+            std::vector<std::pair<std::size_t, std::size_t>> spans;
+
+            std::pair<std::size_t, std::size_t> span(std::size_t i)
+            {
+                const Bvh::Node &node = bvh.nodes[i];
+                if (node.is_leaf)
+                    return spans[i] = {(std::size_t)node.first_child_or_primitive, (std::size_t)node.primitive_count};
+
+                const auto a = span(node.first_child_or_primitive + 0);
+                const auto b = span(node.first_child_or_primitive + 1);
+                return spans[i] = {std::min(a.first, b.first), a.second + b.second};
+            }
+
+            std::size_t primitiveCount(const WideChild &child) const
+            {
+                return child.leaf ? child.count : spans[child.node].second;
+            }
+
+            // levels of wide nodes below a node of `count` primitives when every node splits them evenly
+            static std::size_t balancedDepth(std::size_t count)
+            {
+                std::size_t depth = 0;
+                for (std::size_t capacity = 1; capacity < count; capacity *= N)
+                    ++depth;
+                return depth;
+            }
+
+            Box nodeBox(std::size_t i) const
+            {
+                const Bvh::Node &node = bvh.nodes[i];
+                Box box;
+                for (int a = 0; a < 3; ++a)
+                {
+                    box.lo[a] = node.bounds[2 * a + 0];
+                    box.hi[a] = node.bounds[2 * a + 1];
+                }
+                return box;
+            }
+
+            WideChild fromNode(std::size_t i) const
+            {
+                const Bvh::Node &node = bvh.nodes[i];
+                return {nodeBox(i), (bool)node.is_leaf, i, (std::size_t)node.first_child_or_primitive, (std::size_t)node.primitive_count};
+            }
+
+            WideChild fromRange(std::size_t first, std::size_t count) const
+            {
+                WideChild child = {Box(), true, 0, first, count};
+                for (std::size_t p = first; p < first + count; ++p)
+                {
+                    const Triangle &tri = triangles[bvh.primitive_indices[p]];
+                    for (const auto &v : {tri.p0, tri.p1(), tri.p2()})
+                    {
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            child.box.lo[a] = std::min(child.box.lo[a], v[a]);
+                            child.box.hi[a] = std::max(child.box.hi[a], v[a]);
+                        }
+                    }
+                }
+                return child;
+            }
+
+            // leaves that don't fit a child slot are split like internal nodes
+            static bool canOpen(const WideChild &child)
+            {
+                return !child.leaf || child.count > WIDE_LEAF_SIZE;
+            }
+
+            void open(const WideChild &child, WideChild *a, WideChild *b) const
+            {
+                if (child.leaf)
+                {
+                    const std::size_t half = child.count / 2;
+                    *a = fromRange(child.first, half);
+                    *b = fromRange(child.first + half, child.count - half);
+                    return;
+                }
+                *a = fromNode(child.first + 0);
+                *b = fromNode(child.first + 1);
+            }
+
+            // opens the child with the largest surface area until the node is full, `balanced` opens the one with the most
+            // primitives instead: the children of a range of n primitives get at most ceil(n / N) of them
+            std::vector<WideChild> collect(const WideChild &parent, bool balanced) const
+            {
+                std::vector<WideChild> children;
+                if (!canOpen(parent))
+                {
+                    children.push_back(parent);
+                    return children;
+                }
+
+                children.resize(2);
+                open(parent, &children[0], &children[1]);
+                while (children.size() < N)
+                {
+                    int best = -1;
+                    float best_area = -1.0f;
+                    for (std::size_t i = 0; i < children.size(); ++i)
+                    {
+                        const float area = balanced ? (float)children[i].count : children[i].box.halfArea();
+                        if (canOpen(children[i]) && area > best_area)
+                        {
+                            best = (int)i;
+                            best_area = area;
+                        }
+                    }
+                    if (best < 0)
+                        break;
+
+                    WideChild a, b;
+                    open(children[best], &a, &b);
+                    children[best] = a;
+                    children.push_back(b);
+                }
+                return children;
+            }
+
+            static void quantize(const Box &parent, const std::vector<WideChild> &children, cl_WideBVHnode<N> *node)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    const float extent = parent.hi[a] - parent.lo[a];
+                    int e = extent > 0.0f ? (int)std::ceil(std::log2(extent / 255.0f)) : -126;
+                    e = std::clamp(e, -126, 127);
+                    while (e < 127 && std::ldexp(255.0f, e) < extent)
+                        ++e;
+                    const float scale = std::ldexp(1.0f, e);
+
+                    node->origin[a] = parent.lo[a];
+                    node->exponent[a] = (cl_char)e;
+
+                    for (std::size_t i = 0; i < N; ++i)
+                    {
+                        if (i >= children.size())
+                        {
+                            node->lo[a][i] = 0;
+                            node->hi[a][i] = 0;
+                            continue;
+                        }
+
+                        // rounded outwards, the decoded box always contains the child
+                        int lo = std::clamp((int)std::floor((children[i].box.lo[a] - parent.lo[a]) / scale), 0, 255);
+                        int hi = std::clamp((int)std::ceil((children[i].box.hi[a] - parent.lo[a]) / scale), 0, 255);
+                        while (lo > 0 && parent.lo[a] + lo * scale > children[i].box.lo[a])
+                            --lo;
+                        while (hi < 255 && parent.lo[a] + hi * scale < children[i].box.hi[a])
+                            ++hi;
+                        node->lo[a][i] = (cl_uchar)lo;
+                        node->hi[a][i] = (cl_uchar)hi;
+                    }
+                }
+            }
+
+            /*
+             * An internal node pushes up to N - 1 children on the traversal stack, so internal nodes at most
+             * WIDE_STACK_SIZE / (N - 1) levels below the root never overflow it. Every node of n > 1 primitives keeps
+             * depth + balancedDepth(n) within one more level: once it passes the limit, the node's binary subtree is
+             * replaced by its primitive range and split evenly, each level below takes one off balancedDepth()
+             */
+            cl_uint build(const WideChild &parent, std::size_t depth)
+            {
+                const bool balanced = depth + balancedDepth(primitiveCount(parent)) > WIDE_STACK_SIZE / (N - 1);
+                const std::vector<WideChild> children = balanced && !parent.leaf
+                                                            ? collect({parent.box, true, 0, spans[parent.node].first, spans[parent.node].second}, true)
+                                                            : collect(parent, balanced);
+
+                Box box;
+                for (const WideChild &child : children)
+                    box.extend(child.box);
+
+                const std::size_t index = nodes.size();
+                nodes.emplace_back();
+
+                cl_uint codes[N];
+                for (std::size_t i = 0; i < N; ++i)
+                {
+                    if (i >= children.size())
+                        codes[i] = WIDE_EMPTY;
+                    else if (children[i].leaf && children[i].count <= WIDE_LEAF_SIZE)
+                        codes[i] = WIDE_LEAF | (cl_uint)((children[i].count - 1) << 26) | (primitive_offset + (cl_uint)children[i].first);
+                    else
+                        codes[i] = node_offset + build(children[i], depth + 1);
+                }
+
+                // `nodes` may have grown in the meantime
+                cl_WideBVHnode<N> &node = nodes[index];
+                std::memset(&node, 0, sizeof(node));
+                std::copy(codes, codes + N, node.child);
+                quantize(box, children, &node);
+                return (cl_uint)index;
+            }
+
+        public:
+            std::vector<cl_WideBVHnode<N>> nodes;
+
+            WideCollapser(const Bvh &bvh, const std::vector<Triangle> &triangles, cl_uint node_offset, cl_uint primitive_offset)
+                : bvh(bvh), triangles(triangles), node_offset(node_offset), primitive_offset(primitive_offset)
+            {
+            }
+
+            void build()
+            {
+                nodes.clear();
+                spans.resize(bvh.node_count);
+                span(0);
+                build(fromNode(0), 0);
+            }
+        };
+
+        template <int N>
+        std::unique_ptr<std::vector<cl_uint>> collapse(const Bvh &bvh, const std::vector<Triangle> &triangles, cl_uint node_offset, cl_uint primitive_offset)
+        {
+            static_assert(sizeof(cl_WideBVHnode<N>) % sizeof(cl_uint) == 0, "the nodes are uploaded as words");
+
+            WideCollapser<N> collapser(bvh, triangles, node_offset, primitive_offset);
+            collapser.build();
+
+            auto res = std::make_unique<std::vector<cl_uint>>(collapser.nodes.size() * sizeof(cl_WideBVHnode<N>) / sizeof(cl_uint));
+            std::memcpy(res->data(), collapser.nodes.data(), collapser.nodes.size() * sizeof(cl_WideBVHnode<N>));
+            return res;
+        }
+    } // namespace
+
+    std::unique_ptr<std::vector<cl_uint>> BVH::PrepareWideData(int width, cl_uint node_offset, cl_uint primitive_offset) const
+    {
+        if (primitive_offset + triangles.size() > WIDE_MAX_PRIMITIVES)
+        {
+            std::cerr << "[BVH] " << primitive_offset + triangles.size() << " triangles don't fit the wide nodes (" << WIDE_MAX_PRIMITIVES << " max)" << std::endl;
+            return nullptr;
+        }
+
+        // called per frame for the animated models, the caller reports the node counts
+        return width == 8 ? collapse<8>(*bvh, triangles, node_offset, primitive_offset)
+                          : collapse<4>(*bvh, triangles, node_offset, primitive_offset);
+    }
+} // namespace CL_RAYTRACER
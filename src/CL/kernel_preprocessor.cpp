@@ -0,0 +1,216 @@
+#include <CL/kernel_preprocessor.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <regex>
+#include <filesystem>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    namespace
+    {
+        const std::string_view INCLUDE_DIRECTIVE = "#FILE:";
+
+        bool isPlaceholderChar(char c)
+        {
+            return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        }
+    } // namespace
+
+    KernelPreprocessor::KernelPreprocessor()
+        : line(1)
+    {
+    }
+
+    void KernelPreprocessor::define(const std::string &name, const std::string &value)
+    {
+        values[name] = value;
+        disabled.erase(name);
+    }
+
+    void KernelPreprocessor::disable(const std::string &name)
+    {
+        values.erase(name);
+        disabled.insert(name);
+    }
+
+    bool KernelPreprocessor::process(const std::string &filepath, std::string *source)
+    {
+        const double tStart = utils::getTime();
+        const std::filesystem::path path(filepath);
+
+        directory = path.parent_path().string();
+        files.clear();
+        file_ids.clear();
+        segments.clear();
+        unknown.clear();
+        line = 1;
+        source->clear();
+
+        std::cout << "----------------------------------------------------------" << std::endl;
+
+        if (!include(path.filename().string(), source))
+            return false;
+
+        std::cout << "Preprocessed " << files.size() << " OpenCL files (" << source->size() / 1024 << "KB, "
+                  << line - 1 << " lines) in " << (utils::getTime() - tStart) * 1e3 << "ms" << std::endl;
+        return true;
+    }
+
+    bool KernelPreprocessor::include(const std::string &name, std::string *source)
+    {
+        const std::string key = std::filesystem::path(name).lexically_normal().generic_string();
+
+        const auto it = file_ids.find(key);
+        if (it != file_ids.end())
+        {
+            if (!files[it->second].open)
+                return true;
+
+            std::cout << "\nInclude cycle:";
+            for (const File &file : files)
+            {
+                if (file.open)
+                    std::cout << " " << file.name << " ->";
+            }
+            std::cout << " " << key << std::endl;
+            return false;
+        }
+
+        const std::filesystem::path filepath = std::filesystem::path(directory) / key;
+        std::ifstream file(filepath, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "\nCouldn't find OpenCL file (" << filepath.string() << ')' << std::endl;
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        const std::string text = buffer.str();
+
+        const std::size_t id = files.size();
+        files.push_back({key, true});
+        file_ids.emplace(key, id);
+        source->reserve(source->size() + text.size());
+
+        std::size_t file_line = 1;
+        for (std::size_t pos = 0; pos < text.size(); ++file_line)
+        {
+            std::size_t end = text.find('\n', pos);
+            if (end == std::string::npos)
+                end = text.size();
+
+            std::string_view current(text.data() + pos, end - pos);
+            if (!current.empty() && current.back() == '\r')
+                current.remove_suffix(1);
+
+            if (current.substr(0, INCLUDE_DIRECTIVE.size()) == INCLUDE_DIRECTIVE)
+            {
+                std::string_view included = current.substr(INCLUDE_DIRECTIVE.size());
+                while (!included.empty() && (included.back() == ' ' || included.back() == '\t'))
+                    included.remove_suffix(1);
+
+                if (!include(std::string(included), source))
+                    return false;
+            }
+            else
+            {
+                emitLine(current, id, file_line, source);
+            }
+
+            pos = end + 1;
+        }
+
+        files[id].open = false;
+        return true;
+    }
+
+    void KernelPreprocessor::emitLine(std::string_view text, std::size_t file, std::size_t file_line, std::string *source)
+    {
+        std::size_t hash = text.find('#');
+        if (hash != std::string_view::npos)
+        {
+            // substitute every "#NAME#" of the line
+            line_buffer.clear();
+            std::size_t copied = 0;
+            while (hash != std::string_view::npos)
+            {
+                std::size_t end = hash + 1;
+                while (end < text.size() && isPlaceholderChar(text[end]))
+                    ++end;
+
+                // the name has to start with a letter, "#define", "#if" etc. never match
+                if (end < text.size() && text[end] == '#' && end > hash + 1 && text[hash + 1] >= 'A' && text[hash + 1] <= 'Z')
+                {
+                    const std::string name(text.substr(hash + 1, end - hash - 1));
+                    const auto value = values.find(name);
+                    if (value != values.end())
+                    {
+                        line_buffer.append(text.data() + copied, hash - copied);
+                        line_buffer += value->second;
+                        copied = end + 1;
+                    }
+                    else if (disabled.count(name))
+                    {
+                        return;
+                    }
+                    else if (unknown.insert(name).second)
+                    {
+                        std::cout << "[Warning]: unknown placeholder #" << name << "# in " << files[file].name << ":" << file_line << std::endl;
+                    }
+                    hash = text.find('#', end + 1);
+                }
+                else
+                {
+                    hash = text.find('#', hash + 1);
+                }
+            }
+            line_buffer.append(text.data() + copied, text.size() - copied);
+            text = line_buffer;
+        }
+
+        // a new segment whenever the output stops following the same file line by line
+        if (segments.empty() || segments.back().file != file ||
+            line - segments.back().line != file_line - segments.back().file_line)
+            segments.push_back({line, file, file_line});
+
+        source->append(text.data(), text.size());
+        *source += '\n';
+        ++line;
+    }
+
+    std::string KernelPreprocessor::getLocation(std::size_t line) const
+    {
+        const auto segment = std::upper_bound(segments.begin(), segments.end(), line,
+                                              [](std::size_t l, const Segment &s) { return l < s.line; });
+        if (segment == segments.begin())
+            return "<source>:" + std::to_string(line);
+
+        const Segment &s = *(segment - 1);
+        return files[s.file].name + ":" + std::to_string(s.file_line + line - s.line);
+    }
+
+    std::string KernelPreprocessor::remapLog(const std::string &log) const
+    {
+        // "<kernel>:12:3: error", "/tmp/OCL1234.cl:12:3: warning", "1:12:3: error", ...
+        static const std::regex location(R"(([^\s:]+):(\d+):(\d+):)");
+
+        std::stringstream in(log);
+        std::string out;
+        std::string log_line;
+        std::smatch match;
+        while (std::getline(in, log_line))
+        {
+            if (std::regex_search(log_line, match, location))
+                out += match.prefix().str() + getLocation(std::stoul(match[2].str())) + ":" + match[3].str() + ":" + match.suffix().str();
+            else
+                out += log_line;
+            out += '\n';
+        }
+        return out;
+    }
+} // namespace CL_RAYTRACER
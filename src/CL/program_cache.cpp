@@ -0,0 +1,164 @@
+#include <CL/program_cache.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    ProgramCache program_cache("../cache/programs");
+
+    namespace
+    {
+        // bump whenever the file layout changes
+        constexpr cl_uint CACHE_VERSION = 1;
+        constexpr char CACHE_MAGIC[4] = {'C', 'L', 'P', 'B'};
+
+        struct CacheHeader
+        {
+            char magic[4];
+            cl_uint version;
+            cl_ulong key;
+            double build_time;
+            cl_ulong size;
+        };
+    } // namespace
+
+    // 64-bit FNV-1a, the fields are separated so ("ab", "c") and ("a", "bc") differ
+    cl_ulong hashKey(const std::vector<std::string> &fields)
+    {
+        cl_ulong hash = 0xcbf29ce484222325ull;
+        for (const std::string &field : fields)
+        {
+            for (const char c : field)
+            {
+                hash ^= (unsigned char)c;
+                hash *= 0x100000001b3ull;
+            }
+            hash ^= 0xff;
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    ProgramCache::ProgramCache(const std::string &directory)
+        : directory(directory), hits(0), misses(0), saved(0.0)
+    {
+    }
+
+    std::string ProgramCache::getFilepath(cl_ulong key) const
+    {
+        std::stringstream filename;
+        filename << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+        return (std::filesystem::path(directory) / filename.str()).string();
+    }
+
+    bool ProgramCache::read(cl_ulong key, double *build_time, std::vector<unsigned char> *binary) const
+    {
+        std::ifstream file(getFilepath(key), std::ios::binary);
+        if (!file)
+            return false;
+
+        CacheHeader header;
+        if (!file.read((char *)&header, sizeof(CacheHeader)) ||
+            !std::equal(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic) ||
+            header.version != CACHE_VERSION || header.key != key)
+            return false;
+
+        binary->resize(header.size);
+        if (!file.read((char *)binary->data(), header.size))
+            return false;
+
+        *build_time = header.build_time;
+        return true;
+    }
+
+    void ProgramCache::write(cl_ulong key, double build_time, const cl::Program &program) const
+    {
+        // the program is built for a single device
+        std::size_t size = 0;
+        if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(std::size_t), &size, nullptr) != CL_SUCCESS || !size)
+            return;
+
+        std::vector<unsigned char> binary(size);
+        unsigned char *binaries[] = {binary.data()};
+        if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr) != CL_SUCCESS)
+            return;
+
+        std::error_code err;
+        std::filesystem::create_directories(directory, err);
+
+        // other instances may be reading the cache, the rename makes the new entry appear at once
+        const std::string filepath = getFilepath(key);
+        const std::string temp_filepath = filepath + ".tmp";
+        {
+            std::ofstream file(temp_filepath, std::ios::binary);
+            if (!file)
+            {
+                std::cout << "[ProgramCache] couldn't write " << temp_filepath << std::endl;
+                return;
+            }
+
+            CacheHeader header = {{CACHE_MAGIC[0], CACHE_MAGIC[1], CACHE_MAGIC[2], CACHE_MAGIC[3]}, CACHE_VERSION, key, build_time, size};
+            file.write((const char *)&header, sizeof(CacheHeader));
+            file.write((const char *)binary.data(), size);
+        }
+        std::filesystem::rename(temp_filepath, filepath, err);
+        if (err)
+            std::cout << "[ProgramCache] couldn't write " << filepath << " (" << err.message() << ")" << std::endl;
+    }
+
+    cl_int ProgramCache::build(const cl::Context &context, const cl::Device &device, const std::string &source,
+                               const std::string &options, cl::Program *program)
+    {
+        const double tStart = utils::getTime();
+        const std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+
+        const cl_ulong key = hashKey({source, device_name, device.getInfo<CL_DEVICE_VERSION>(), device.getInfo<CL_DRIVER_VERSION>(), options});
+
+        double build_time = 0.0;
+        std::vector<unsigned char> binary;
+        if (!directory.empty() && read(key, &build_time, &binary))
+        {
+            cl_int err = CL_SUCCESS;
+            std::vector<cl_int> status;
+            *program = cl::Program(context, {device}, {{binary.data(), binary.size()}}, &status, &err);
+
+            // a driver update can invalidate binaries without changing the version string
+            if (err == CL_SUCCESS && program->build({device}, options.c_str()) == CL_SUCCESS)
+            {
+                const double load_time = utils::getTime() - tStart;
+                ++hits;
+                saved += std::max(0.0, build_time - load_time);
+
+                std::cout << "[ProgramCache] hit for " << device_name << ", loaded in " << load_time << "s (built in " << build_time << "s)" << std::endl;
+                return CL_SUCCESS;
+            }
+            std::cout << "[ProgramCache] rejected binary for " << device_name << " (" << err << "), building from source" << std::endl;
+        }
+
+        ++misses;
+        *program = cl::Program(context, source);
+        const cl_int result = program->build({device}, options.c_str());
+        build_time = utils::getTime() - tStart;
+
+        std::cout << "[ProgramCache] miss for " << device_name << ", built in " << build_time << "s" << std::endl;
+        if (result == CL_SUCCESS && !directory.empty())
+            write(key, build_time, *program);
+
+        return result;
+    }
+
+    void ProgramCache::printSummary() const
+    {
+        std::cout << "[ProgramCache] hits: " << hits << ", misses: " << misses << ", saved: " << saved << "s";
+        if (directory.empty())
+            std::cout << " (disabled)";
+        std::cout << std::endl;
+    }
+} // namespace CL_RAYTRACER
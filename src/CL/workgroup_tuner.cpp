@@ -0,0 +1,165 @@
+#include <CL/workgroup_tuner.h>
+#include <CL/program_cache.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+
+namespace CL_RAYTRACER
+{
+    WorkGroupTuner workgroup_tuner("../cache/workgroups.txt");
+
+    namespace
+    {
+        // square power of two blocks for the morton order
+        const WorkGroupConfig CANDIDATES[] = {
+            {PIXEL_ORDER_LINEAR, 64, 1},
+            {PIXEL_ORDER_LINEAR, 128, 1},
+            {PIXEL_ORDER_LINEAR, 256, 1},
+            {PIXEL_ORDER_TILED, 8, 4},
+            {PIXEL_ORDER_TILED, 8, 8},
+            {PIXEL_ORDER_TILED, 16, 4},
+            {PIXEL_ORDER_TILED, 16, 8},
+            {PIXEL_ORDER_TILED, 8, 16},
+            {PIXEL_ORDER_TILED, 32, 2},
+            {PIXEL_ORDER_TILED, 32, 4},
+            {PIXEL_ORDER_TILED, 16, 16},
+            {PIXEL_ORDER_TILED, 32, 8},
+            {PIXEL_ORDER_TILED, 64, 4},
+            {PIXEL_ORDER_MORTON, 8, 8},
+            {PIXEL_ORDER_MORTON, 16, 16},
+        };
+    } // namespace
+
+    std::size_t WorkGroupConfig::getGlobalSize(int width, int height) const
+    {
+        if (order == PIXEL_ORDER_LINEAR)
+            return ((std::size_t)width * height + block_w - 1) / block_w * block_w;
+
+        const std::size_t blocks_x = (width + block_w - 1) / block_w;
+        const std::size_t blocks_y = (height + block_h - 1) / block_h;
+        return blocks_x * blocks_y * getLocalSize();
+    }
+
+    cl_int4 WorkGroupConfig::getKernelArg(int width) const
+    {
+        return {{order, block_w, block_h, (width + block_w - 1) / block_w}};
+    }
+
+    std::string WorkGroupConfig::toString() const
+    {
+        static const char *orders[] = {"linear", "tiled", "morton"};
+
+        std::stringstream ss;
+        ss << orders[order] << " " << block_w << "x" << block_h;
+        return ss.str();
+    }
+
+    WorkGroupTuner::WorkGroupTuner(const std::string &filepath)
+        : filepath(filepath), loaded(false)
+    {
+    }
+
+    cl_ulong WorkGroupTuner::getKey(const cl::Device &device, const std::string &kernel_name, const std::string &source, const std::string &options)
+    {
+        return hashKey({kernel_name, source, device.getInfo<CL_DEVICE_NAME>(), device.getInfo<CL_DRIVER_VERSION>(), options});
+    }
+
+    WorkGroupConfig WorkGroupTuner::getDefault(const cl::Kernel &kernel, const cl::Device &device)
+    {
+        return {PIXEL_ORDER_LINEAR, (cl_int)kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device), 1};
+    }
+
+    // one "key order block_w block_h" line per entry
+    void WorkGroupTuner::load()
+    {
+        loaded = true;
+
+        std::ifstream file(filepath);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::stringstream ss(line);
+            cl_ulong key;
+            WorkGroupConfig config;
+            if (ss >> std::hex >> key >> std::dec >> config.order >> config.block_w >> config.block_h &&
+                config.order >= PIXEL_ORDER_LINEAR && config.order <= PIXEL_ORDER_MORTON && config.block_w > 0 && config.block_h > 0)
+                entries[key] = config;
+        }
+    }
+
+    void WorkGroupTuner::save() const
+    {
+        std::error_code err;
+        std::filesystem::create_directories(std::filesystem::path(filepath).parent_path(), err);
+
+        // same as the program cache, other instances only ever see a whole file
+        const std::string temp_filepath = filepath + ".tmp";
+        {
+            std::ofstream file(temp_filepath);
+            if (!file)
+            {
+                std::cout << "[WorkGroupTuner] couldn't write " << temp_filepath << std::endl;
+                return;
+            }
+            for (const auto &entry : entries)
+            {
+                file << std::hex << std::setw(16) << std::setfill('0') << entry.first << std::dec << " "
+                     << entry.second.order << " " << entry.second.block_w << " " << entry.second.block_h << std::endl;
+            }
+        }
+        std::filesystem::rename(temp_filepath, filepath, err);
+        if (err)
+            std::cout << "[WorkGroupTuner] couldn't write " << filepath << " (" << err.message() << ")" << std::endl;
+    }
+
+    bool WorkGroupTuner::find(cl_ulong key, WorkGroupConfig *config)
+    {
+        if (!loaded)
+            load();
+
+        const auto it = entries.find(key);
+        if (it == entries.end())
+            return false;
+
+        *config = it->second;
+        return true;
+    }
+
+    WorkGroupConfig WorkGroupTuner::tune(cl_ulong key, const cl::Kernel &kernel, const cl::Device &device,
+                                         const std::function<double(const WorkGroupConfig &)> &benchmark)
+    {
+        if (!loaded)
+            load();
+
+        const WorkGroupConfig fallback = getDefault(kernel, device);
+        const std::size_t max_size = fallback.getLocalSize();
+
+        std::cout << "[WorkGroupTuner] benchmarking work-group shapes" << std::endl;
+
+        WorkGroupConfig best = fallback;
+        double best_time = benchmark(fallback);
+        std::cout << "  " << std::left << std::setw(16) << fallback.toString() << std::right << best_time * 1e3 << "ms" << std::endl;
+
+        for (const WorkGroupConfig &config : CANDIDATES)
+        {
+            if (config.getLocalSize() > max_size || (config.order == PIXEL_ORDER_LINEAR && config.block_w == fallback.block_w))
+                continue;
+
+            const double time = benchmark(config);
+            std::cout << "  " << std::left << std::setw(16) << config.toString() << std::right << time * 1e3 << "ms" << std::endl;
+            if (time < best_time)
+            {
+                best = config;
+                best_time = time;
+            }
+        }
+        std::cout << "[WorkGroupTuner] using " << best.toString() << std::endl;
+
+        entries[key] = best;
+        save();
+        return best;
+    }
+} // namespace CL_RAYTRACER
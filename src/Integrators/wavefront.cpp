@@ -0,0 +1,139 @@
+#include <Integrators/wavefront.h>
+#include <Profiling/profiler.h>
+
+#include <iostream>
+#include <algorithm>
+
+extern cl::Context context;
+
+namespace CL_RAYTRACER
+{
+    // WF_SCENE_PARAMS in kernels/integrators/wavefront.cl, the stage's own arguments follow them
+    constexpr cl_uint WF_SCENE_ARGS = 8;
+
+    Wavefront::Wavefront(const cl::Program &program, const cl::Device &device, const WavefrontScene &scene, const WavefrontTargets &targets)
+        : num_paths(targets.width * targets.height)
+    {
+        generate = cl::Kernel(program, "wf_generate");
+        extend = cl::Kernel(program, "wf_extend");
+        shade = cl::Kernel(program, "wf_shade");
+        shadow = cl::Kernel(program, "wf_shadow");
+        accumulate = cl::Kernel(program, "wf_accumulate");
+
+        paths = cl::Buffer(context, CL_MEM_READ_WRITE, num_paths * sizeof(cl_WFPath));
+        queues = cl::Buffer(context, CL_MEM_READ_WRITE, WF_QUEUE_COUNT * num_paths * sizeof(cl_uint));
+        queue_counters = cl::Buffer(context, CL_MEM_READ_WRITE, WF_QUEUE_COUNT * sizeof(cl_uint));
+
+        // the queue appends are aggregated per work-group, use the same group size for every stage
+        local_work_size = std::min({
+            generate.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            extend.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            shade.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            shadow.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+            accumulate.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)});
+        global_work_size = ((num_paths + local_work_size - 1) / local_work_size) * local_work_size;
+        queue_work_size = std::min(global_work_size, device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * local_work_size * 4);
+
+        // generate
+        generate.setArg(0, targets.width);
+        generate.setArg(1, targets.height);
+        generate.setArg(3, targets.camera);
+        generate.setArg(6, targets.path_state);
+        generate.setArg(7, paths);
+        generate.setArg(8, queues);
+        generate.setArg(9, queue_counters);
+        generate.setArg(10, targets.sample_count);
+
+        // extend
+        setSceneArgs(extend, scene);
+        extend.setArg(WF_SCENE_ARGS + 0, num_paths);
+        extend.setArg(WF_SCENE_ARGS + 1, targets.path_state);
+        extend.setArg(WF_SCENE_ARGS + 2, paths);
+        extend.setArg(WF_SCENE_ARGS + 3, queues);
+        extend.setArg(WF_SCENE_ARGS + 4, queue_counters);
+
+        // shade
+        setSceneArgs(shade, scene);
+        shade.setArg(WF_SCENE_ARGS + 0, targets.env_map);
+        shade.setArg(WF_SCENE_ARGS + 1, num_paths);
+        shade.setArg(WF_SCENE_ARGS + 3, targets.path_state);
+        shade.setArg(WF_SCENE_ARGS + 4, paths);
+        shade.setArg(WF_SCENE_ARGS + 5, queues);
+        shade.setArg(WF_SCENE_ARGS + 6, queue_counters);
+
+        // shadow
+        setSceneArgs(shadow, scene);
+        shadow.setArg(WF_SCENE_ARGS + 0, num_paths);
+        shadow.setArg(WF_SCENE_ARGS + 1, targets.path_state);
+        shadow.setArg(WF_SCENE_ARGS + 2, paths);
+        shadow.setArg(WF_SCENE_ARGS + 3, queues);
+        shadow.setArg(WF_SCENE_ARGS + 4, queue_counters);
+
+        // accumulate
+        accumulate.setArg(0, targets.width);
+        accumulate.setArg(1, targets.height);
+        accumulate.setArg(2, targets.path_state);
+        accumulate.setArg(3, targets.output);
+
+        std::cout << "[Wavefront] " << num_paths << " paths, " << WF_QUEUE_COUNT << " queues ("
+                  << getMemoryUsage() / (1024 * 1024) << "MB)" << std::endl;
+    }
+
+    Wavefront::~Wavefront() {}
+
+    void Wavefront::setSceneArgs(cl::Kernel &kernel, const WavefrontScene &scene)
+    {
+        kernel.setArg(0, scene.meshes);
+        kernel.setArg(1, scene.mesh_count);
+        kernel.setArg(2, scene.faces);
+        kernel.setArg(3, scene.vertices);
+        kernel.setArg(4, scene.normals);
+        kernel.setArg(5, scene.material);
+        kernel.setArg(6, scene.bvh);
+        kernel.setArg(7, scene.settings);
+    }
+
+    void Wavefront::setCamera(const cl::Buffer &camera)
+    {
+        generate.setArg(3, camera);
+    }
+
+    void Wavefront::setRayStats(const cl::Buffer &ray_stats)
+    {
+        generate.setArg(11, ray_stats);
+        extend.setArg(WF_SCENE_ARGS + 5, ray_stats);
+        shade.setArg(WF_SCENE_ARGS + 7, ray_stats);
+        shadow.setArg(WF_SCENE_ARGS + 5, ray_stats);
+    }
+
+    void Wavefront::enqueue(const cl::CommandQueue &queue, cl_uint framenumber, int random0, int random1,
+                            const std::vector<cl::Event> *events, cl::Event *event)
+    {
+        queue.enqueueFillBuffer(queue_counters, 0, 0, WF_QUEUE_COUNT * sizeof(cl_uint), events, PROFILE_EVENT("wf fill queue counters"));
+
+        generate.setArg(2, framenumber);
+        generate.setArg(4, random0);
+        generate.setArg(5, random1);
+        queue.enqueueNDRangeKernel(generate, cl::NullRange, global_work_size, local_work_size, nullptr, PROFILE_EVENT("wf_generate"));
+
+        // the queue lengths stay on the device, these stages loop over their queue at a fixed width
+        queue.enqueueNDRangeKernel(extend, cl::NullRange, queue_work_size, local_work_size, nullptr, PROFILE_EVENT("wf_extend"));
+
+        // one launch per material class keeps the work-items of a launch on the same bsdf
+        for (cl_uint i = 0; i < WF_SHADE_QUEUES; ++i)
+        {
+            shade.setArg(WF_SCENE_ARGS + 2, WF_QUEUE_SHADE + i);
+            queue.enqueueNDRangeKernel(shade, cl::NullRange, queue_work_size, local_work_size, nullptr, PROFILE_EVENT("wf_shade"));
+        }
+
+        queue.enqueueNDRangeKernel(shadow, cl::NullRange, queue_work_size, local_work_size, nullptr, PROFILE_EVENT("wf_shadow"));
+        queue.enqueueNDRangeKernel(accumulate, cl::NullRange, global_work_size, local_work_size, nullptr, event);
+        if (event)
+            PROFILE_ADD_EVENT("wf_accumulate", *event);
+    }
+
+    std::size_t Wavefront::getMemoryUsage() const
+    {
+        return num_paths * sizeof(cl_WFPath) + WF_QUEUE_COUNT * (num_paths + 1) * sizeof(cl_uint);
+    }
+} // namespace CL_RAYTRACER
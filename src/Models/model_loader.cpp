@@ -1,12 +1,13 @@
 #include <Model/model_loader.h>
 
 #include <iostream>
+#include <cstring>
+#include <unordered_map>
 #include <assimp/scene.h>		// Output data structure
 #include <assimp/postprocess.h> // Post processing flags
 
 #ifdef PROFILING
 #include <iomanip>		// std::setprecision
-#include <GLFW/glfw3.h> // glfwGetTime
 #endif
 
 namespace CL_RAYTRACER
@@ -20,7 +21,7 @@ namespace IO
 
 #ifdef PROFILING
 		std::cout << "Loading " << filepath << " ..." << std::endl;
-		double start = glfwGetTime();
+		double start = utils::getTime();
 #endif
 		//check if file exists
 		std::ifstream fin(filepath.c_str());
@@ -49,7 +50,7 @@ namespace IO
 
 #ifdef PROFILING
 		std::cout << std::setprecision(4) << "Loaded " << filepath << " at "
-					<< (glfwGetTime() - start) << "s ..." << std::endl;
+					<< (utils::getTime() - start) << "s ..." << std::endl;
 #endif
 		return true;
 	}
@@ -175,6 +176,70 @@ namespace IO
 		return scene;
 	}
 
+	IndexedMesh ModelLoader::getIndexedMesh(bool weld) const
+	{
+		struct KeyHash
+		{
+			std::size_t operator()(const std::array<cl_uint, 6> &key) const
+			{
+				std::size_t hash = 0;
+				for (const cl_uint k : key)
+					hash = hash * 0x9E3779B1u + k;
+				return hash;
+			}
+		};
+
+		IndexedMesh res;
+		// bit patterns of position and normal, the pool's index of the vertex
+		std::unordered_map<std::array<cl_uint, 6>, cl_uint, KeyHash> pool;
+
+		for (const MeshData &meshData : *sceneData)
+		{
+			const std::vector<float> &positions = getPositions(meshData);
+			const std::vector<float> &normals = getNormals(meshData);
+
+			if (!weld)
+			{
+				for (const auto &f : getIndices4(meshData))
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						res.faces.push_back((cl_uint)res.getVertexCount());
+						res.positions.insert(res.positions.end(), &positions[3 * f.s[c]], &positions[3 * f.s[c]] + 3);
+						res.normals.insert(res.normals.end(), &normals[3 * f.s[c]], &normals[3 * f.s[c]] + 3);
+					}
+				}
+				continue;
+			}
+
+			// the mesh's vertices in the pool
+			std::vector<cl_uint> remap(meshData.first[1]);
+			for (std::size_t v = 0; v < remap.size(); ++v)
+			{
+				std::array<cl_uint, 6> key;
+				std::memcpy(&key[0], &positions[3 * v], 3 * sizeof(float));
+				std::memcpy(&key[3], &normals[3 * v], 3 * sizeof(float));
+
+				const auto inserted = pool.emplace(key, (cl_uint)res.getVertexCount());
+				if (inserted.second)
+				{
+					res.positions.insert(res.positions.end(), &positions[3 * v], &positions[3 * v] + 3);
+					res.normals.insert(res.normals.end(), &normals[3 * v], &normals[3 * v] + 3);
+				}
+				remap[v] = inserted.first->second;
+			}
+
+			for (const auto &f : getIndices4(meshData))
+			{
+				res.faces.push_back(remap[f.s[0]]);
+				res.faces.push_back(remap[f.s[1]]);
+				res.faces.push_back(remap[f.s[2]]);
+			}
+		}
+
+		return res;
+	}
+
 	const void *ModelLoader::getPositionsPtr(const MeshData &data)
 	{
 		return &data.second[0];
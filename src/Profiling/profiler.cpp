@@ -0,0 +1,162 @@
+#include <Profiling/profiler.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    Profiler profiler;
+
+    // resolve the finished events every so often so the pending list stays short
+    constexpr std::size_t MAX_PENDING_EVENTS = 256;
+
+    void Profiler::beginPhase(const std::string &name)
+    {
+        phase = name;
+        phase_start = utils::getTime();
+    }
+
+    void Profiler::endPhase()
+    {
+        phases.emplace_back(phase, utils::getTime() - phase_start);
+    }
+
+    cl::Event *Profiler::newEvent(const std::string &stage)
+    {
+        if (pending.size() >= MAX_PENDING_EVENTS)
+            resolve(false);
+
+        pending.emplace_back(stage, cl::Event());
+        return &pending.back().second;
+    }
+
+    void Profiler::addEvent(const std::string &stage, const cl::Event &event)
+    {
+        if (pending.size() >= MAX_PENDING_EVENTS)
+            resolve(false);
+
+        pending.emplace_back(stage, event);
+    }
+
+    void Profiler::resolve(bool wait)
+    {
+        while (!pending.empty())
+        {
+            const cl::Event &event = pending.front().second;
+
+            // the enqueue failed or didn't ask for an event
+            if (!event())
+            {
+                pending.pop_front();
+                continue;
+            }
+
+            if (wait)
+                event.wait();
+            else if (event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+                break;
+
+            // e.g. GL acquire/release on drivers that don't time them
+            cl_int err_start, err_end;
+            const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err_start);
+            const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err_end);
+            if (err_start == CL_SUCCESS && err_end == CL_SUCCESS)
+                stages[pending.front().first].push_back((end - start) * 1e-6);
+
+            pending.pop_front();
+        }
+    }
+
+    void Profiler::report(const std::string &filepath)
+    {
+        resolve(true);
+
+        struct Stats
+        {
+            std::string name;
+            std::size_t count;
+            double min, avg, p99, total;
+        };
+
+        std::vector<Stats> stats;
+        for (auto &stage : stages)
+        {
+            std::vector<double> &ms = stage.second;
+            std::sort(ms.begin(), ms.end());
+
+            const double total = std::accumulate(ms.begin(), ms.end(), 0.0);
+            const std::size_t p99 = std::min(ms.size() - 1, (std::size_t)(0.99 * ms.size()));
+            stats.push_back({stage.first, ms.size(), ms.front(), total / ms.size(), ms[p99], total});
+        }
+
+        const bool json = filepath.size() > 5 && filepath.substr(filepath.size() - 5) == ".json";
+        const bool csv = filepath.size() > 4 && filepath.substr(filepath.size() - 4) == ".csv";
+
+        std::ofstream file;
+        if (json || csv)
+        {
+            file.open(filepath);
+            if (!file)
+                std::cout << "couldn't write " << filepath << std::endl;
+        }
+        std::ostream &out = file.is_open() ? file : std::cout;
+        out << std::fixed << std::setprecision(4);
+
+        if (json)
+        {
+            out << "{" << std::endl
+                << "  \"phases\": [" << std::endl;
+            for (std::size_t i = 0; i < phases.size(); ++i)
+            {
+                out << "    { \"name\": \"" << phases[i].first << "\", \"ms\": " << phases[i].second * 1e3 << " }"
+                    << (i + 1 < phases.size() ? "," : "") << std::endl;
+            }
+            out << "  ]," << std::endl
+                << "  \"stages\": [" << std::endl;
+            for (std::size_t i = 0; i < stats.size(); ++i)
+            {
+                const Stats &s = stats[i];
+                out << "    { \"name\": \"" << s.name << "\", \"count\": " << s.count
+                    << ", \"min_ms\": " << s.min << ", \"avg_ms\": " << s.avg << ", \"p99_ms\": " << s.p99
+                    << ", \"total_ms\": " << s.total << " }" << (i + 1 < stats.size() ? "," : "") << std::endl;
+            }
+            out << "  ]" << std::endl
+                << "}" << std::endl;
+        }
+        else if (csv)
+        {
+            out << "type,name,count,min_ms,avg_ms,p99_ms,total_ms" << std::endl;
+            for (const auto &p : phases)
+            {
+                const double ms = p.second * 1e3;
+                out << "phase," << p.first << ",1," << ms << "," << ms << "," << ms << "," << ms << std::endl;
+            }
+            for (const Stats &s : stats)
+                out << "stage," << s.name << "," << s.count << "," << s.min << "," << s.avg << "," << s.p99 << "," << s.total << std::endl;
+        }
+        else
+        {
+            out << std::endl
+                << "startup:" << std::endl;
+            for (const auto &p : phases)
+                out << "  " << std::left << std::setw(24) << p.first << std::right << std::setw(12) << p.second * 1e3 << "ms" << std::endl;
+
+            out << std::left << std::setw(26) << "stage" << std::right << std::setw(10) << "count"
+                << std::setw(12) << "min(ms)" << std::setw(12) << "avg(ms)" << std::setw(12) << "p99(ms)" << std::setw(14) << "total(ms)" << std::endl;
+            for (const Stats &s : stats)
+            {
+                out << "  " << std::left << std::setw(24) << s.name << std::right << std::setw(10) << s.count
+                    << std::setw(12) << s.min << std::setw(12) << s.avg << std::setw(12) << s.p99 << std::setw(14) << s.total << std::endl;
+            }
+        }
+        out << std::defaultfloat << std::setprecision(6);
+
+        if (file.is_open())
+            std::cout << "profiling report saved in " << filepath << std::endl;
+    }
+} // namespace CL_RAYTRACER
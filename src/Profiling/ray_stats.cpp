@@ -0,0 +1,51 @@
+#include <Profiling/ray_stats.h>
+
+#include <iostream>
+#include <iomanip>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    RayStatistics::RayStatistics()
+        : counters(), stack(0), shadow_stack(0), tStart(0.0), elapsed(0.0)
+    {
+    }
+
+    void RayStatistics::start()
+    {
+        tStart = utils::getTime();
+        elapsed = 0.0;
+    }
+
+    void RayStatistics::update(const cl_uint *device)
+    {
+        for (cl_uint i = 0; i < RAY_STATS_COUNTERS; ++i)
+            counters[i] = ((cl_ulong)device[2 * i + 1] << 32) | device[2 * i];
+        stack = device[RAY_STATS_STACK];
+        shadow_stack = device[RAY_STATS_SHADOW_STACK];
+
+        elapsed = utils::getTime() - tStart;
+    }
+
+    void RayStatistics::print() const
+    {
+        const cl_ulong primary = counters[RAY_STATS_PRIMARY];
+        const cl_ulong closest = counters[RAY_STATS_CLOSEST];
+        const cl_ulong shadow = counters[RAY_STATS_SHADOW];
+        const cl_ulong rays = closest + shadow;
+        // per ray averages, the counters don't tell closest-hit and shadow traversals apart
+        const double inv_rays = rays ? 1.0 / rays : 0.0;
+
+        std::cout << std::endl
+                  << "rays: " << rays << " (primary: " << primary << ", secondary: " << closest - primary
+                  << ", shadow: " << shadow << ")" << std::endl;
+        if (elapsed > 0.0)
+            std::cout << "ray throughput: " << std::setprecision(4) << rays / elapsed * 1e-6 << " Mrays/s" << std::endl;
+        std::cout << "nodes/ray: " << counters[RAY_STATS_NODES] * inv_rays << std::endl
+                  << "triangles/ray: " << counters[RAY_STATS_TRIANGLES] * inv_rays << std::endl
+                  << "primitives/ray: " << counters[RAY_STATS_PRIMITIVES] * inv_rays << std::endl
+                  << "max stack: " << stack << ", max shadow stack: " << shadow_stack << std::endl
+                  << std::setprecision(6);
+    }
+} // namespace CL_RAYTRACER
@@ -0,0 +1,61 @@
+#include <Scene/scene_watcher.h>
+#include <CL/program_cache.h>
+
+#include <iostream>
+#include <chrono>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    // seconds between two checks of the file's modification time
+    constexpr double POLL_INTERVAL = 0.25;
+
+    SceneWatcher::SceneWatcher(const std::string &filepath)
+        : filepath(filepath), last_poll(utils::getTime()), build_start(0.0)
+    {
+        std::error_code err;
+        last_write = std::filesystem::last_write_time(filepath, err);
+    }
+
+    bool SceneWatcher::changed()
+    {
+        const double now = utils::getTime();
+        if (now - last_poll < POLL_INTERVAL)
+            return false;
+        last_poll = now;
+
+        // e.g. an editor that replaces the file, try again on the next poll
+        std::error_code err;
+        const std::filesystem::file_time_type write = std::filesystem::last_write_time(filepath, err);
+        if (err || write == last_write)
+            return false;
+
+        last_write = write;
+        return true;
+    }
+
+    void SceneWatcher::startBuild(const cl::Context &context, const cl::Device &device, const std::string &source, const std::string &options)
+    {
+        std::cout << "rebuilding the program in the background..." << std::endl;
+        build_start = utils::getTime();
+
+        // the render thread doesn't touch the program cache or `program` until the build is done
+        build = std::async(std::launch::async, [this, context, device, source, options]() {
+            return program_cache.build(context, device, source, options, &program);
+        });
+    }
+
+    bool SceneWatcher::finishBuild(cl_int *result, cl::Program *program)
+    {
+        if (!build.valid() || build.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        *result = build.get();
+        *program = this->program;
+        this->program = cl::Program();
+
+        std::cout << "rebuilt the program in " << utils::getTime() - build_start << "s" << std::endl;
+        return true;
+    }
+} // namespace CL_RAYTRACER
@@ -0,0 +1,330 @@
+#include <Scheduler/multi_device.h>
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <chrono>
+#include <random>
+
+#include <utils.h>
+#include <CL/program_cache.h>
+#include <Integrators/path_state.h>
+
+extern cl::Device device;
+extern cl::Context context;
+extern cl::CommandQueue queue;
+extern cl::Program program;
+
+namespace CL_RAYTRACER
+{
+    TileScheduler::TileScheduler(std::size_t workers, cl_uint num_pixels, cl_uint tile_size, cl_uint passes)
+        : queues(workers), stolen(workers, 0), num_pixels(num_pixels), tile_size(tile_size), pass(0), passes(passes), stopped(false)
+    {
+        distribute();
+    }
+
+    // contiguous runs of tiles, so that a thief takes the far end of its victim's run
+    void TileScheduler::distribute()
+    {
+        const cl_uint num_tiles = (num_pixels + tile_size - 1) / tile_size;
+        for (cl_uint t = 0; t < num_tiles; ++t)
+        {
+            const std::size_t worker = (std::size_t)t * queues.size() / num_tiles;
+            queues[worker].push_back({t * tile_size, std::min((t + 1) * tile_size, num_pixels), pass});
+        }
+    }
+
+    bool TileScheduler::next(std::size_t worker, Tile &tile)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::deque<Tile> &own = queues[worker];
+        while (own.empty())
+        {
+            if (stopped)
+                return false;
+
+            auto victim = std::max_element(queues.begin(), queues.end(),
+                                           [](const std::deque<Tile> &a, const std::deque<Tile> &b) { return a.size() < b.size(); });
+            if (!victim->empty())
+            {
+                const std::size_t count = (victim->size() + 1) / 2;
+                own.insert(own.end(), victim->end() - count, victim->end());
+                victim->erase(victim->end() - count, victim->end());
+                ++stolen[worker];
+            }
+            else if (passes == 0 || pass + 1 < passes)
+            {
+                ++pass;
+                distribute();
+            }
+            else
+                return false;
+        }
+
+        if (stopped)
+            return false;
+
+        tile = own.front();
+        own.pop_front();
+        return true;
+    }
+
+    void TileScheduler::stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+
+    //---------------------------------------------------------------------------------------
+
+    MultiDevice::MultiDevice(const std::vector<cl::Device> &devices, const MultiDeviceScene &scene, int width, int height, cl_uint spp)
+        : width(width), height(height), spp(spp)
+    {
+        // the scene buffers only live in the primary context, read them back once for every other device
+        std::vector<std::vector<char>> host_buffers;
+        std::vector<cl_float> host_env_map;
+        for (const cl::Buffer *buffer : {&scene.meshes, &scene.faces, &scene.vertices, &scene.normals, &scene.material, &scene.bvh, &scene.camera, &scene.settings})
+        {
+            host_buffers.emplace_back();
+            if (!(*buffer)())
+                continue;
+
+            host_buffers.back().resize(buffer->getInfo<CL_MEM_SIZE>());
+            queue.enqueueReadBuffer(*buffer, CL_TRUE, 0, host_buffers.back().size(), host_buffers.back().data());
+        }
+
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        region[0] = scene.env_map.getImageInfo<CL_IMAGE_WIDTH>();
+        region[1] = scene.env_map.getImageInfo<CL_IMAGE_HEIGHT>();
+        region[2] = 1;
+        host_env_map.resize(4 * region[0] * region[1]);
+        queue.enqueueReadImage(scene.env_map, CL_TRUE, origin, region, 0, 0, host_env_map.data());
+
+        workers.push_back(std::make_unique<DeviceWorker>());
+        workers.back()->device = device;
+        workers.back()->context = context;
+        workers.back()->queue = queue;
+        workers.back()->program = program;
+        initWorker(*workers.back(), scene, {}, {});
+
+        for (const cl::Device &secondary : devices)
+        {
+            workers.push_back(std::make_unique<DeviceWorker>());
+            DeviceWorker &worker = *workers.back();
+            worker.device = secondary;
+
+            cl_int err = CL_SUCCESS;
+            worker.context = cl::Context(secondary, nullptr, nullptr, nullptr, &err);
+            if (err)
+            {
+                std::cout << "couldn't create a context for " << secondary.getInfo<CL_DEVICE_NAME>() << " (" << err << ")" << std::endl;
+                workers.pop_back();
+                continue;
+            }
+            worker.queue = cl::CommandQueue(worker.context, secondary);
+
+            cl_int result = program_cache.build(worker.context, secondary, scene.source, scene.options, &worker.program);
+            if (result)
+            {
+                std::cout << "Error during compilation OpenCL code for " << secondary.getInfo<CL_DEVICE_NAME>() << "!!!\n (" << result << ")" << std::endl;
+                if (result == CL_BUILD_PROGRAM_FAILURE)
+                    std::cerr << worker.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(secondary) << std::endl;
+                workers.pop_back();
+                continue;
+            }
+
+            initWorker(worker, scene, host_buffers, host_env_map);
+        }
+    }
+
+    MultiDevice::~MultiDevice()
+    {
+    }
+
+    // `host_buffers` is empty for the primary device, it shares the scene's buffers
+    void MultiDevice::initWorker(DeviceWorker &worker, const MultiDeviceScene &scene,
+                                 const std::vector<std::vector<char>> &host_buffers, const std::vector<cl_float> &host_env_map)
+    {
+        auto upload = [&](const cl::Buffer &buffer, std::size_t i) {
+            if (host_buffers.empty())
+                return buffer;
+            if (host_buffers[i].empty())
+                return cl::Buffer();
+            return cl::Buffer(worker.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, host_buffers[i].size(), (void *)host_buffers[i].data());
+        };
+
+        cl_int err = CL_SUCCESS;
+        if (host_buffers.empty())
+            worker.env_map = scene.env_map;
+        else
+            worker.env_map = cl::Image2D(worker.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_FLOAT),
+                                         scene.env_map.getImageInfo<CL_IMAGE_WIDTH>(), scene.env_map.getImageInfo<CL_IMAGE_HEIGHT>(), 0,
+                                         (void *)host_env_map.data(), &err);
+        worker.output = cl::Image2D(worker.context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height, 0, NULL, &err);
+        if (err)
+            std::cout << "couldn't create the images for " << worker.device.getInfo<CL_DEVICE_NAME>() << " (" << err << ")" << std::endl;
+
+        const std::size_t num_pixels = width * height;
+        worker.path_state = cl::Buffer(worker.context, CL_MEM_READ_WRITE, num_pixels * PATH_STATE_SIZE);
+        worker.sample_count = cl::Buffer(worker.context, CL_MEM_READ_WRITE, sizeof(cl_uint4));
+        worker.work_counter = cl::Buffer(worker.context, CL_MEM_READ_WRITE, sizeof(cl_uint2));
+        worker.queue.enqueueFillBuffer(worker.path_state, 0, 0, num_pixels * PATH_STATE_SIZE);
+        worker.queue.enqueueFillBuffer(worker.sample_count, 0, 0, sizeof(cl_uint4));
+
+        // same arguments as the single device render_persistent
+        worker.kernel = cl::Kernel(worker.program, "render_persistent");
+        worker.kernel.setArg(0, upload(scene.meshes, 0));
+        worker.kernel.setArg(1, width);
+        worker.kernel.setArg(2, height);
+        worker.kernel.setArg(3, scene.mesh_count);
+        worker.kernel.setArg(5, upload(scene.camera, 6));
+        worker.kernel.setArg(8, worker.output);
+        worker.kernel.setArg(9, upload(scene.faces, 1));
+        worker.kernel.setArg(10, upload(scene.vertices, 2));
+        worker.kernel.setArg(11, upload(scene.normals, 3));
+        worker.kernel.setArg(12, upload(scene.material, 4));
+        worker.kernel.setArg(13, worker.env_map);
+        worker.kernel.setArg(14, worker.path_state);
+        worker.kernel.setArg(15, upload(scene.bvh, 5));
+        worker.kernel.setArg(16, worker.sample_count);
+        worker.kernel.setArg(17, worker.work_counter);
+        worker.kernel.setArg(18, spp);
+        worker.kernel.setArg(19, cl::Buffer());
+        worker.kernel.setArg(20, upload(scene.settings, 7));
+
+        worker.local_work_size = worker.kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(worker.device);
+        worker.global_work_size = worker.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * worker.local_work_size * 4;
+        worker.queue.finish();
+    }
+
+    std::vector<cl::Device> MultiDevice::getSecondaryDevices(const cl::Device &primary)
+    {
+        std::vector<cl::Device> secondary;
+
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        for (const cl::Platform &platform : platforms)
+        {
+            std::vector<cl::Device> devices;
+            platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            std::copy_if(devices.begin(), devices.end(), std::back_inserter(secondary),
+                         [&](const cl::Device &d) { return d() != primary(); });
+        }
+
+        return secondary;
+    }
+
+    void MultiDevice::work(std::size_t id, TileScheduler &scheduler)
+    {
+        DeviceWorker &worker = *workers[id];
+        std::minstd_rand rng((unsigned int)id + 1);
+
+        Tile tile;
+        while (scheduler.next(id, tile))
+        {
+            const double tStart = utils::getTime();
+
+            const std::size_t pixels = tile.end - tile.begin;
+            const std::size_t global_work_size = std::min(worker.global_work_size,
+                                                          (pixels + worker.local_work_size - 1) / worker.local_work_size * worker.local_work_size);
+
+            worker.kernel.setArg(4, tile.pass + 1);
+            worker.kernel.setArg(6, (int)(rng() % 1000));
+            worker.kernel.setArg(7, (int)(rng() % 1000));
+            worker.queue.enqueueFillBuffer(worker.work_counter, cl_uint2{{tile.begin, tile.end}}, 0, sizeof(cl_uint2));
+            worker.queue.enqueueNDRangeKernel(worker.kernel, cl::NullRange, global_work_size, worker.local_work_size);
+            worker.queue.finish();
+
+            worker.busy += utils::getTime() - tStart;
+            worker.samples += pixels * spp;
+            ++worker.tiles;
+        }
+    }
+
+    std::vector<cl_float> MultiDevice::render(cl_uint target_spp, double time_budget)
+    {
+        const cl_uint num_pixels = width * height;
+
+        // at least 8 bands of rows for every device so there's something left to steal
+        const cl_uint rows = std::max(1, std::min(64, height / (int)(8 * workers.size())));
+        const cl_uint passes = target_spp ? (target_spp + spp - 1) / spp : 0;
+        TileScheduler scheduler(workers.size(), num_pixels, rows * width, passes);
+
+        const double tStart = utils::getTime();
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < workers.size(); ++i)
+            threads.emplace_back(&MultiDevice::work, this, i, std::ref(scheduler));
+
+        // stop handing out tiles once the time budget is spent, the tiles in flight still finish
+        if (time_budget > 0.0)
+        {
+            bool done = false;
+            while (!done && utils::getTime() - tStart < time_budget)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+                cl_ulong samples = 0;
+                for (const auto &worker : workers)
+                    samples += worker->samples;
+                done = target_spp && samples >= (cl_ulong)passes * spp * num_pixels;
+            }
+            scheduler.stop();
+        }
+
+        for (std::thread &thread : threads)
+            thread.join();
+
+        const double elapsed = utils::getTime() - tStart;
+
+        // merge the accumulation buffers, the devices may have rendered different passes of the same pixel
+        std::vector<cl_float> pixels(4 * num_pixels, 0.0f);
+        std::vector<cl_uint> samples(num_pixels, 0);
+        // only the acc and samples streams of the path state are needed
+        std::vector<cl_float4> acc(num_pixels);
+        std::vector<cl_uint> worker_samples(num_pixels);
+        for (const auto &worker : workers)
+        {
+            worker->queue.enqueueReadBuffer(worker->path_state, CL_FALSE, getPathStreamOffset(PATH_ACC, num_pixels), num_pixels * sizeof(cl_float4), acc.data());
+            worker->queue.enqueueReadBuffer(worker->path_state, CL_TRUE, getPathStreamOffset(PATH_SAMPLES, num_pixels), num_pixels * sizeof(cl_uint), worker_samples.data());
+            for (std::size_t i = 0; i < num_pixels; ++i)
+            {
+                for (int c = 0; c < 4; ++c)
+                    pixels[4 * i + c] += acc[i].s[c];
+                samples[i] += worker_samples[i];
+            }
+        }
+        for (std::size_t i = 0; i < num_pixels; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+                pixels[4 * i + c] = samples[i] ? pixels[4 * i + c] / samples[i] : 0.0f;
+        }
+
+        // per-device throughput
+        cl_ulong total = 0;
+        for (const auto &worker : workers)
+            total += worker->samples;
+
+        std::cout << std::endl
+                  << std::left << std::setw(40) << "device" << std::right
+                  << std::setw(8) << "tiles" << std::setw(8) << "stolen"
+                  << std::setw(14) << "Msamples/s" << std::setw(8) << "share" << std::endl;
+        for (std::size_t i = 0; i < workers.size(); ++i)
+        {
+            const DeviceWorker &worker = *workers[i];
+            std::cout << std::left << std::setw(40) << worker.device.getInfo<CL_DEVICE_NAME>().substr(0, 39) << std::right
+                      << std::setw(8) << worker.tiles << std::setw(8) << scheduler.getStolen(i)
+                      << std::setw(14) << std::fixed << std::setprecision(2) << (worker.busy > 0.0 ? worker.samples / worker.busy * 1e-6 : 0.0)
+                      << std::setw(7) << std::setprecision(1) << (total ? 100.0 * worker.samples / total : 0.0) << "%" << std::endl;
+        }
+        std::cout << std::defaultfloat << std::setprecision(6)
+                  << "rendered " << (double)total / num_pixels << "spp on " << workers.size() << " device(s) in " << elapsed << "s ("
+                  << total / elapsed * 1e-6 << " Msamples/s)" << std::endl;
+
+        return pixels;
+    }
+} // namespace CL_RAYTRACER
@@ -0,0 +1,104 @@
+#include <Scheduler/render_controller.h>
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include <utils.h>
+
+namespace CL_RAYTRACER
+{
+    // the first noise checkpoint, fewer samples are mostly fireflies
+    constexpr double NOISE_MIN_SPP = 4.0;
+
+    RenderController::RenderController(cl_uint target_spp, double time_budget, float noise_threshold)
+        : target_spp(target_spp), time_budget(time_budget), noise_threshold(noise_threshold),
+          tStart(0.0), spp(0.0), elapsed(0.0), noise(-1.0f), reason(StopReason::NONE), checkpoint_spp(0.0)
+    {
+    }
+
+    void RenderController::start()
+    {
+        tStart = utils::getTime();
+        spp = elapsed = 0.0;
+        noise = -1.0f;
+        reason = StopReason::NONE;
+        checkpoint.clear();
+        checkpoint_spp = 0.0;
+    }
+
+    /*
+     * The image at 2n spp averages the one at n spp with n independent samples,
+     * so their difference has the same deviation as the error of the 2n image.
+     * The estimate is the mean relative luminance difference between the two.
+     */
+    void RenderController::updateNoise(const std::vector<cl_float> &radiance)
+    {
+        std::vector<float> luminance(radiance.size() / 4);
+        for (std::size_t i = 0; i < luminance.size(); ++i)
+            luminance[i] = 0.2126f * radiance[4 * i + 0] + 0.7152f * radiance[4 * i + 1] + 0.0722f * radiance[4 * i + 2];
+
+        if (checkpoint.size() == luminance.size())
+        {
+            double sum = 0.0;
+            for (std::size_t i = 0; i < luminance.size(); ++i)
+            {
+                // the offset keeps dark pixels from dominating
+                sum += std::fabs(luminance[i] - checkpoint[i]) / (luminance[i] + 1e-2f);
+            }
+            noise = (float)(sum / luminance.size());
+        }
+
+        checkpoint.swap(luminance);
+        checkpoint_spp = spp;
+    }
+
+    bool RenderController::update(double spp, const std::function<std::vector<cl_float>()> &readback)
+    {
+        // the accumulation was reset, e.g. the camera moved
+        if (spp < this->spp)
+        {
+            noise = -1.0f;
+            checkpoint.clear();
+            checkpoint_spp = 0.0;
+        }
+
+        this->spp = spp;
+        elapsed = utils::getTime() - tStart;
+
+        if (noise_threshold > 0.0f && spp >= std::max(NOISE_MIN_SPP, 2.0 * checkpoint_spp))
+            updateNoise(readback());
+
+        if (target_spp && spp >= target_spp)
+            reason = StopReason::TARGET_SPP;
+        else if (time_budget > 0.0 && elapsed >= time_budget)
+            reason = StopReason::TIME_BUDGET;
+        else if (noise_threshold > 0.0f && noise >= 0.0f && noise <= noise_threshold)
+            reason = StopReason::NOISE_THRESHOLD;
+
+        return reason != StopReason::NONE;
+    }
+
+    void RenderController::printProgress(cl_uint framenumber) const
+    {
+        std::cout << "\rframe: " << framenumber << ", spp: " << spp << ", elapsed: " << elapsed << "s";
+        if (noise >= 0.0f)
+            std::cout << ", noise: " << noise;
+        std::cout << "  " << std::flush;
+    }
+
+    void RenderController::printSummary(cl_uint framenumber, std::size_t num_pixels) const
+    {
+        static const char *reasons[] = {"none", "target spp", "time budget", "noise threshold", "converged", "frame limit"};
+
+        std::cout << std::endl
+                  << "stopped: " << reasons[(int)reason] << std::endl
+                  << "frames: " << framenumber << std::endl
+                  << "spp: " << spp << std::endl
+                  << "elapsed: " << elapsed << "s" << std::endl;
+        if (noise >= 0.0f)
+            std::cout << "noise: " << noise << std::endl;
+        if (elapsed > 0.0)
+            std::cout << "throughput: " << (spp * num_pixels / elapsed) * 1e-6 << " Msamples/s" << std::endl;
+    }
+} // namespace CL_RAYTRACER
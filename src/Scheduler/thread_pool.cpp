@@ -0,0 +1,135 @@
+#include <Scheduler/thread_pool.h>
+
+#include <algorithm>
+
+namespace CL_RAYTRACER
+{
+    namespace
+    {
+        // the pool and the queue of the current worker thread
+        thread_local const ThreadPool *current_pool = nullptr;
+        thread_local std::size_t current_queue = 0;
+    } // namespace
+
+    ThreadPool::ThreadPool(std::size_t threads)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (std::size_t i = 0; i < threads; ++i)
+            queues.push_back(std::make_unique<Queue>());
+
+        for (std::size_t i = 0; i + 1 < threads; ++i)
+            workers.emplace_back(&ThreadPool::work, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    std::size_t ThreadPool::self() const
+    {
+        return current_pool == this ? current_queue : queues.size() - 1;
+    }
+
+    bool ThreadPool::runOne(std::size_t index)
+    {
+        std::function<void()> task;
+        {
+            Queue &own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+            }
+        }
+
+        for (std::size_t i = 1; !task && i < queues.size(); ++i)
+        {
+            Queue &victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+            }
+        }
+
+        if (!task)
+            return false;
+
+        --queued;
+        task();
+        return true;
+    }
+
+    void ThreadPool::work(std::size_t index)
+    {
+        current_pool = this;
+        current_queue = index;
+
+        while (true)
+        {
+            if (runOne(index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping)
+                return;
+        }
+    }
+
+    void ThreadPool::spawn(TaskGroup &group, std::function<void()> task)
+    {
+        // counted before it can be popped, `queued` never wraps
+        ++group.pending;
+        ++queued;
+        {
+            Queue &own = *queues[self()];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.tasks.push_front([task = std::move(task), &group] {
+                task();
+                --group.pending;
+            });
+        }
+
+        // a worker that just found every queue empty is either asleep or still holds the lock
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_one();
+    }
+
+    void ThreadPool::wait(TaskGroup &group)
+    {
+        const std::size_t index = self();
+        while (group.pending > 0)
+        {
+            if (!runOne(index))
+                std::this_thread::yield();
+        }
+    }
+
+    void ThreadPool::parallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &body)
+    {
+        grain = std::max<std::size_t>(grain, 1);
+
+        TaskGroup group;
+        for (std::size_t begin = 0; begin < count; begin += grain)
+        {
+            const std::size_t end = std::min(count, begin + grain);
+            spawn(group, [&body, begin, end] { body(begin, end); });
+        }
+        wait(group);
+    }
+} // namespace CL_RAYTRACER
@@ -8,16 +8,22 @@
 #include <cstdlib>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include <string>
 
 #include <rapidjson/document.h>
 #include <rapidjson/istreamwrapper.h>
 
+#ifndef HEADLESS_ONLY
 #include <GL/glew.h>
+#endif
 #define CL_VERSION_1_2
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#ifndef HEADLESS_ONLY
 #if defined OS_WIN
 #define GLFW_EXPOSE_NATIVE_WIN32
 #define GLFW_EXPOSE_NATIVE_WGL
@@ -29,22 +35,36 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
+#endif
 
 //----------------------------------------------
 
 constexpr char *models_directory = "../resources/models/";
 constexpr char *kernel_filepath = "../kernels/main.cl";
 
-// @ToDo use the actual buffer size 
-constexpr std::size_t RayI_size = 16 * 7;
-
 //----------------------------------------------
 
 #include <Camera/camera.h>
 #include <Scene/scene.h>
+#ifndef HEADLESS_ONLY
 #include <GL/cl_gl_interop.h>
+#endif
+#include <Headless/headless.h>
 #include <Model/model_loader.h>
 #include <BVH/bvh.h>
+#include <BVH/tlas.h>
+#include <BVH/wide_bvh.h>
+#include <BVH/animation.h>
+#include <BVH/lbvh.h>
+#include <Integrators/wavefront.h>
+#include <Integrators/path_state.h>
+#include <Scheduler/multi_device.h>
+#include <Scheduler/render_controller.h>
+#include <Profiling/profiler.h>
+#include <Profiling/ray_stats.h>
+#include <CL/program_cache.h>
+#include <Scene/scene_watcher.h>
+#include <CL/workgroup_tuner.h>
 
 #include <CL/cl_help.h>
 namespace clw = cl_help;
@@ -59,66 +79,413 @@ int window_height = 720;
 std::string env_map_filepath = "";
 // encoder
 unsigned char encoder = 0;
+// offline rendering without a window or a GL context
+#ifdef HEADLESS_ONLY
+bool HEADLESS = true;
+bool buffer_reset(true);
+#else
+bool HEADLESS = false;
+#endif
+// headless stop conditions (samples per pixel, seconds)
+cl_uint target_spp = 0;
+double time_budget = 0.0;
+float noise_threshold = 0.0f;
+// profiling report, ".json" or ".csv" (stdout if empty)
+std::string profile_filepath = "";
+// headless output
+std::string output_filepath = "";
 
 cl::Device device;
 cl::Context context;
 cl::CommandQueue queue;
+// camera uploads, overlap with the rendering of the previous frame
+cl::CommandQueue upload_queue;
 cl::Kernel kernel;
 cl::Program program;
 // cl::Program bvh_program;
 cl::Buffer cl_output;
+// the meshes followed by the instances and their top-level BVH, see buildTLAS()
 cl::Buffer cl_meshes;
-cl::Buffer cl_camera;
-cl::ImageGL cl_screen;
-cl::ImageGL cl_env_map;
+// frames the host may enqueue ahead of the device
+constexpr std::size_t FRAMES_IN_FLIGHT = 3;
+cl::Buffer cl_cameras[FRAMES_IN_FLIGHT];
+// last command of the frame that used each camera slot
+cl::Event frame_events[FRAMES_IN_FLIGHT];
+// host copies of the scene writes each slot's frame reads, see writeForFrame()
+std::vector<std::vector<unsigned char>> frame_uploads[FRAMES_IN_FLIGHT];
+cl::Image cl_screen;
+cl::Image cl_env_map;
 //  clw::ImageGL cl_noise_tex;
 std::vector<cl::Memory> cl_screens;
 cl::Buffer mBufVertices;
 cl::Buffer mBufNormals;
+cl::Buffer mBufFaces;
 cl::Buffer mBufMaterial;
 cl::Buffer cl_flattenI;
 cl::Buffer mNewBufBVH;
-cl::Buffer mNewBufIndices;
+cl::Buffer cl_sample_count;
+// bumped instead of clearing the path state, see kernels/path_state.cl
+cl_uint path_epoch = 0;
+cl::Buffer cl_work_counter;
+cl::Kernel adaptive_kernel;
+cl::Buffer cl_active_mask;
+cl::Buffer cl_active_pixels;
+// device limits, queried in initOpenCL()
+cl_ulong max_alloc_size = 0;
+cl_ulong max_constant_size = 0;
 
 std::size_t global_work_size;
 std::size_t local_work_size;
 cl_uint BVH_NUM_NODES = 0;
+// a model's BVH in the shared node buffer, every instance of the model points at it
+struct ModelBLAS
+{
+	cl_uint root;
+	float bounds[6];
+	// where the model starts in the shared vertex and face buffers
+	cl_uint vertex_offset;
+	cl_uint primitive_offset;
+	// animated models only, see animateModels()
+	std::unique_ptr<ModelAnimation> animation;
+	std::size_t frame = 0;
+};
+// the models by path, loaded once at startup
+std::map<std::string, ModelBLAS> blas_library;
 cl_uint framenumber = 0;
-Camera *hostRendercam = nullptr;
+Camera hostRendercams[FRAMES_IN_FLIGHT];
 InteractiveCamera *interactiveCamera = nullptr;
 host_scene *scene = nullptr;
 std::string scene_filepath = "../scenes/cornell.json";
 bool ALPHA_TESTING = false;
+// split render_kernel into generate/extend/shade/shadow stages
+bool WAVEFRONT = false;
+std::unique_ptr<Wavefront> wavefront;
+// persistent threads, whole paths per pixel and launch (0: one bounce per launch)
+cl_uint PERSISTENT_SPP = 0;
+// headless: split the frame into tiles across every OpenCL device
+bool MULTI_DEVICE = false;
+std::string kernel_source;
+KernelPreprocessor kernel_preprocessor;
+// adaptive sampling: relative error a pixel has to reach (0: off)
+float ADAPTIVE_THRESHOLD = 0.0f;
+// headless: render the frame in tiles of TILE_SIZE^2 pixels (0: whole frame)
+cl_uint TILE_SIZE = 0;
+// build the kernels with -DRAY_STATS: count rays, node visits and primitive tests
+bool RAY_STATS = false;
+// branching factor of the uploaded BVH, 4 and 8 are collapsed with quantized child boxes
+int BVH_WIDTH = 4;
+// binary BVH only: walk the tree through parent pointers instead of a per work-item stack
+bool BVH_STACKLESS = false;
+// animated models: rebuild the BVH once refits made its SAH cost this many times worse (0: every frame)
+float REFIT_THRESHOLD = 1.5f;
+// host build of the model BVHs
+BVHBuilder BVH_BUILDER = BVH_BUILDER_SWEEP;
+// -bvh-builder lbvh: the static models are built on the device, the animated ones with BVH_BUILDER
+bool LBVH_BUILD = false;
+// -lbvh-verify: read the device builds back, check them and compare their SAH cost with a host build
+bool LBVH_VERIFY = false;
+cl::Buffer cl_ray_stats;
+RayStatistics ray_statistics;
+// scene data that isn't compiled into the program, see Settings in header.cl
+cl::Buffer cl_settings;
+// interactive: edits of the scene file are applied while rendering
+std::unique_ptr<SceneWatcher> scene_watcher;
+// the edited scene and its source while the program is rebuilt in the background
+host_scene *pending_scene = nullptr;
+std::string pending_source;
+KernelPreprocessor pending_preprocessor;
+// work-group shape and pixel order of render_kernel
+WorkGroupConfig launch_config = {};
+// 0: scanline order, 1: benchmark the work-group shapes once and reuse the cached winner, 2: benchmark again
+cl_uint AUTOTUNE = 1;
+// render_kernel launches timed per work-group shape
+constexpr cl_uint TUNE_LAUNCHES = 8;
+
+// global buffers can't be larger than one allocation of the device
+void checkAllocSize(const char *name, std::size_t bytes)
+{
+	if (bytes <= max_alloc_size)
+		return;
+
+	std::cout << name << " needs " << bytes / (1024 * 1024) << "MB, the device allows allocations of up to " << max_alloc_size / (1024 * 1024) << "MB" << std::endl;
+	exit(1);
+}
+
+// bytes of one node in the uploaded BVH layout
+std::size_t bvhNodeSize()
+{
+	if (BVH_WIDTH > 2)
+		return BVH_WIDTH == 8 ? sizeof(cl_WideBVHnode<8>) : sizeof(cl_WideBVHnode<4>);
+	return sizeof(cl_BVHnode);
+}
+
+// the nodes of `bvh` in the uploaded layout, relocated to where the model starts in the shared buffers
+std::unique_ptr<std::vector<cl_uint>> prepareModelNodes(const BVH &bvh, cl_uint root, cl_uint primitive_offset)
+{
+	if (BVH_WIDTH > 2)
+		return bvh.PrepareWideData(BVH_WIDTH, root, primitive_offset);
+
+	static_assert(sizeof(cl_BVHnode) % sizeof(cl_uint) == 0, "the nodes are uploaded as words");
+	std::unique_ptr<std::vector<cl_BVHnode>> nodes = bvh.PrepareData(root, primitive_offset);
+	auto res = std::make_unique<std::vector<cl_uint>>(nodes->size() * sizeof(cl_BVHnode) / sizeof(cl_uint));
+	std::memcpy(res->data(), nodes->data(), nodes->size() * sizeof(cl_BVHnode));
+	return res;
+}
+
+// root bounds of the model in the cl_BVHnode layout, the device builds don't have a host tree to ask
+void getVertexBounds(const IO::IndexedMesh &mesh, float *bounds)
+{
+	for (int a = 0; a < 3; ++a)
+	{
+		bounds[2 * a + 0] = INFINITY;
+		bounds[2 * a + 1] = -INFINITY;
+	}
+	for (std::size_t i = 0; i < mesh.positions.size(); ++i)
+	{
+		const std::size_t a = i % 3;
+		bounds[2 * a + 0] = std::min(bounds[2 * a + 0], mesh.positions[i]);
+		bounds[2 * a + 1] = std::max(bounds[2 * a + 1], mesh.positions[i]);
+	}
+}
 
-std::size_t initOpenCLBuffers_Faces(const std::shared_ptr<IO::ModelLoader>& ml, const BVH* bvh)
+// every model is built once and appended to the shared geometry and node buffers, the instances only reference it
+void initOpenCLBuffers_Models()
 {
-	std::unique_ptr<std::vector<cl_ulong>> indices = bvh->GetPrimitiveIndices();
-	std::vector<vec3> vertices4;
-	std::vector<vec3> normals4;
+	IO::IndexedMesh geometry;
+	std::vector<cl_uint> nodes;
+	const std::size_t node_size = bvhNodeSize();
 
-	const auto& scene = ml->getFaces();
-	for (const auto &mesh : scene->meshes)
+	// the static models are built on the device once the shared buffers exist, behind the host-built nodes
+	struct DeviceBuild
 	{
-		for (const auto &face : mesh.faces)
+		std::string path;
+		ModelBLAS *blas;
+		cl_uint face_count;
+		// SAH cost of the BVH_BUILDER build with -lbvh-verify
+		float host_cost;
+	};
+	std::unique_ptr<LBVHBuilder> lbvh;
+	std::vector<DeviceBuild> device_builds;
+	if (LBVH_BUILD)
+	{
+		lbvh = std::make_unique<LBVHBuilder>(program, device);
+		if (!lbvh->isSupported())
+		{
+			std::cout << "-bvh-builder lbvh isn't supported by the device, building the models on the host" << std::endl;
+			lbvh.reset();
+		}
+	}
+
+	for (const std::string &path : scene->getModelPaths())
+	{
+		PROFILE_PHASE_BEGIN("model import (" + path + ")");
+		std::shared_ptr<IO::ModelLoader> ml = std::make_shared<IO::ModelLoader>();
+		ml->ImportFromFile(std::string(models_directory + path));
+		PROFILE_PHASE_END();
+
+		const auto animation = scene->animations.find(path);
+		const bool animated = animation != scene->animations.end() && !animation->second.frames.empty();
+
+		// shared vertex pool and three indices per face, a leaf's primitive range indexes the faces directly.
+		// The frames of an animation move every corner on its own, vertices that coincide in the first one aren't welded
+		IO::IndexedMesh mesh = ml->getIndexedMesh(!animated);
+
+		ModelBLAS &blas = blas_library[path];
+		blas.vertex_offset = (cl_uint)geometry.getVertexCount();
+		blas.primitive_offset = (cl_uint)geometry.getFaceCount();
+
+		// the faces go up in their loaded order, the device writes them back in leaf order
+		if (lbvh && !animated && mesh.getFaceCount() > 0)
 		{
-			vertices4.emplace_back(face.points[0].pos.x, face.points[0].pos.y, face.points[0].pos.z);
-			vertices4.emplace_back(face.points[1].pos.x, face.points[1].pos.y, face.points[1].pos.z);
-			vertices4.emplace_back(face.points[2].pos.x, face.points[2].pos.y, face.points[2].pos.z);
+			getVertexBounds(mesh, blas.bounds);
+			device_builds.push_back({path, &blas, (cl_uint)mesh.getFaceCount(), LBVH_VERIFY ? BVH(ml, BVH_BUILDER).GetCost() : 0.0f});
+
+			geometry.positions.insert(geometry.positions.end(), mesh.positions.begin(), mesh.positions.end());
+			geometry.normals.insert(geometry.normals.end(), mesh.normals.begin(), mesh.normals.end());
+			for (const cl_uint vertex : mesh.faces)
+				geometry.faces.push_back(blas.vertex_offset + vertex);
 
-			normals4.emplace_back(face.points[0].nor.x, face.points[0].nor.y, face.points[0].nor.z);
-			normals4.emplace_back(face.points[1].nor.x, face.points[1].nor.y, face.points[1].nor.z);
-			normals4.emplace_back(face.points[2].nor.x, face.points[2].nor.y, face.points[2].nor.z);
+			std::cout << "[Scene] " << path << ": " << mesh.getFaceCount() << " faces, " << mesh.getVertexCount() << " vertices, "
+					  << 2 * mesh.getFaceCount() - 1 << " BVH2 nodes built on the device" << std::endl;
+			continue;
 		}
+
+		PROFILE_PHASE_BEGIN("bvh build (" + path + ")");
+		std::unique_ptr<BVH> bvh = std::make_unique<BVH>(ml, BVH_BUILDER);
+		PROFILE_PHASE_END();
+
+		std::vector<cl_uint> order;
+		bvh->PermuteFaces(&mesh, &order);
+		blas.root = (cl_uint)(nodes.size() * sizeof(cl_uint) / node_size);
+
+		// the faces keep their count through every frame, so does the vertex pool
+		if (animated)
+		{
+			PROFILE_PHASE_BEGIN("animation import (" + path + ")");
+			blas.animation = std::make_unique<ModelAnimation>(std::move(bvh), std::move(mesh), std::move(order), animation->second.fps);
+			for (const std::string &frame : animation->second.frames)
+			{
+				std::shared_ptr<IO::ModelLoader> frame_ml = std::make_shared<IO::ModelLoader>();
+				frame_ml->ImportFromFile(std::string(models_directory + frame));
+				if (!blas.animation->AddFrame(frame_ml))
+				{
+					std::cout << frame << " doesn't have the triangles of " << path << std::endl;
+					exit(1);
+				}
+			}
+			blas.animation->SetFrame(0, REFIT_THRESHOLD);
+			PROFILE_PHASE_END();
+		}
+		const BVH &model_bvh = blas.animation ? blas.animation->GetBVH() : *bvh;
+		const IO::IndexedMesh &model_mesh = blas.animation ? blas.animation->GetMesh() : mesh;
+		model_bvh.GetBounds(blas.bounds);
+
+		PROFILE_PHASE_BEGIN("scene upload");
+		// the program is already built for this width
+		std::unique_ptr<std::vector<cl_uint>> model_nodes = prepareModelNodes(model_bvh, blas.root, blas.primitive_offset);
+		if (!model_nodes)
+		{
+			std::cout << "the models need -bvh-width 2" << std::endl;
+			exit(1);
+		}
+		nodes.insert(nodes.end(), model_nodes->begin(), model_nodes->end());
+
+		// rebuilds are written in place: a binary tree over n faces has at most 2n - 1 nodes, the wide layouts fewer
+		if (blas.animation)
+			nodes.resize((blas.root + 2 * model_mesh.getFaceCount() - 1) * node_size / sizeof(cl_uint), 0);
+
+		geometry.positions.insert(geometry.positions.end(), model_mesh.positions.begin(), model_mesh.positions.end());
+		geometry.normals.insert(geometry.normals.end(), model_mesh.normals.begin(), model_mesh.normals.end());
+		for (const cl_uint vertex : model_mesh.faces)
+			geometry.faces.push_back(blas.vertex_offset + vertex);
+		PROFILE_PHASE_END();
+
+		std::cout << "[Scene] " << path << ": " << model_mesh.getFaceCount() << " faces, " << model_mesh.getVertexCount() << " unique vertices, "
+				  << model_nodes->size() * sizeof(cl_uint) / node_size << " BVH" << BVH_WIDTH << " nodes";
+		if (blas.animation)
+			std::cout << ", " << blas.animation->GetFrameCount() << " frames";
+		std::cout << std::endl;
 	}
-	std::size_t bytesV = sizeof(vec3) * vertices4.size();
-	std::size_t bytesN = sizeof(vec3) * normals4.size();
-	std::size_t bytesIndices = sizeof(cl_ulong) * indices->size();
 
-	mBufVertices = clw::buffer::create(vertices4, bytesV);	
-	mBufNormals = clw::buffer::create(normals4, bytesN);
-	mNewBufIndices = clw::buffer::create(*indices, bytesIndices);
+	cl_uint node_count = (cl_uint)(nodes.size() * sizeof(cl_uint) / node_size);
+	for (DeviceBuild &build : device_builds)
+	{
+		build.blas->root = node_count;
+		node_count += 2 * build.face_count - 1;
+	}
 
-	return bytesV + bytesN + bytesIndices;
+	PROFILE_PHASE_BEGIN("scene upload");
+	std::size_t bytesV = sizeof(cl_float) * geometry.positions.size();
+	std::size_t bytesN = sizeof(cl_float) * geometry.normals.size();
+	std::size_t bytesF = sizeof(cl_uint) * geometry.faces.size();
+	std::size_t bytesBVH = node_size * node_count;
+	checkAllocSize("the vertex buffer", bytesV);
+	checkAllocSize("the normal buffer", bytesN);
+	checkAllocSize("the face buffer", bytesF);
+	checkAllocSize("the BVH", bytesBVH);
+
+	mBufVertices = clw::buffer::create(geometry.positions, bytesV);
+	mBufNormals = clw::buffer::create(geometry.normals, bytesN);
+	// only the host-built nodes are uploaded, the device builds write the faces and nodes of their models
+	const cl_mem_flags built = device_builds.empty() ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE;
+	mBufFaces = clw::buffer::create(geometry.faces, bytesF, built | CL_MEM_COPY_HOST_PTR);
+	mNewBufBVH = cl::Buffer(context, built, bytesBVH);
+	if (!nodes.empty())
+		queue.enqueueWriteBuffer(mNewBufBVH, CL_TRUE, 0, sizeof(cl_uint) * nodes.size(), nodes.data());
+	PROFILE_PHASE_END();
+
+	if (!device_builds.empty())
+	{
+		PROFILE_PHASE_BEGIN("bvh device build");
+		const double t0 = utils::getTime();
+		for (const DeviceBuild &build : device_builds)
+			lbvh->build(queue, mBufVertices, mBufFaces, mNewBufBVH, build.blas->root, build.blas->primitive_offset, build.face_count, build.blas->bounds);
+		queue.finish();
+		std::cout << "[LBVH] built " << device_builds.size() << " model(s) in " << (utils::getTime() - t0) << " seconds" << std::endl;
+		PROFILE_PHASE_END();
+
+		if (LBVH_VERIFY)
+		{
+			for (const DeviceBuild &build : device_builds)
+			{
+				const float cost = lbvh->verify(queue, geometry.positions, mBufFaces, mNewBufBVH, build.blas->root, build.blas->primitive_offset, build.face_count);
+				if (cost < 0.0f)
+				{
+					std::cout << "[LBVH] " << build.path << ": the device build is broken" << std::endl;
+					exit(1);
+				}
+				std::cout << "[LBVH] " << build.path << ": SAH cost = " << cost << " (host build: " << build.host_cost << ")" << std::endl;
+			}
+		}
+	}
+
+	std::cout << "[Scene] " << blas_library.size() << " model(s), " << geometry.getFaceCount() << " faces, "
+			  << (bytesV + bytesN + bytesF + bytesBVH) / 1024 << "KB of geometry and BVH" << std::endl;
+}
+
+// non-blocking write read by the next frame, the in-order queue runs it behind the frames in flight.
+// The host copy is kept in the frame's slot until that frame has finished
+void writeForFrame(const cl::Buffer &buffer, std::size_t offset, std::size_t bytes, const void *data, const char *name)
+{
+	const std::size_t slot = framenumber % FRAMES_IN_FLIGHT;
+	if (frame_events[slot]())
+	{
+		frame_events[slot].wait();
+		frame_events[slot] = cl::Event();
+		frame_uploads[slot].clear();
+	}
+
+	const unsigned char *first = static_cast<const unsigned char *>(data);
+	const std::vector<unsigned char> &copy = frame_uploads[slot].emplace_back(first, first + bytes);
+	queue.enqueueWriteBuffer(buffer, CL_FALSE, offset, bytes, copy.data(), nullptr, PROFILE_EVENT(name));
+}
+
+// moves the animated models to their frame at `time` seconds and rewrites them in place, false if none changed.
+// The top-level BVH has to be rebuilt over the new bounds afterwards
+bool animateModels(double time)
+{
+	bool changed = false;
+	for (auto &[path, blas] : blas_library)
+	{
+		if (!blas.animation)
+			continue;
+
+		const std::size_t frame = blas.animation->GetFrameAt(time);
+		if (frame == blas.frame)
+			continue;
+		blas.frame = frame;
+
+		// refits keep the faces, a rebuild reorders them
+		const bool rebuilt = blas.animation->SetFrame(frame, REFIT_THRESHOLD);
+		const IO::IndexedMesh &mesh = blas.animation->GetMesh();
+		std::unique_ptr<std::vector<cl_uint>> nodes = prepareModelNodes(blas.animation->GetBVH(), blas.root, blas.primitive_offset);
+
+		// the frames in flight keep reading the previous frame, the writes queue up behind them
+		writeForFrame(mBufVertices, sizeof(cl_float) * 3 * blas.vertex_offset, sizeof(cl_float) * mesh.positions.size(), mesh.positions.data(), "write animation vertices");
+		writeForFrame(mBufNormals, sizeof(cl_float) * 3 * blas.vertex_offset, sizeof(cl_float) * mesh.normals.size(), mesh.normals.data(), "write animation normals");
+		if (rebuilt)
+		{
+			std::vector<cl_uint> faces(mesh.faces);
+			for (cl_uint &vertex : faces)
+				vertex += blas.vertex_offset;
+			writeForFrame(mBufFaces, sizeof(cl_uint) * 3 * blas.primitive_offset, sizeof(cl_uint) * faces.size(), faces.data(), "write animation faces");
+		}
+		writeForFrame(mNewBufBVH, bvhNodeSize() * blas.root, sizeof(cl_uint) * nodes->size(), nodes->data(), "write animation bvh");
+
+		blas.animation->GetBVH().GetBounds(blas.bounds);
+		changed = true;
+	}
+	return changed;
+}
+
+std::string buildOptions()
+{
+	std::string options = "-DBVH_WIDTH=" + std::to_string(BVH_WIDTH);
+	if (BVH_STACKLESS)
+		options += " -DBVH_STACKLESS";
+	if (RAY_STATS)
+		options += " -DRAY_STATS";
+	return options;
 }
 
 void initOpenCL()
@@ -157,42 +524,60 @@ void initOpenCL()
 	std::cout << "\t\t\tMax compute units: " << device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() << std::endl;
 	std::cout << "\t\t\tMax work group size: " << device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() << std::endl;
 
-	std::vector<cl_context_properties> properties;
+	// the geometry and the BVH have to fit a single allocation, the per-scene tables the constant memory
+	max_alloc_size = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	max_constant_size = device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+	std::cout << "\t\t\tMax allocation: " << max_alloc_size / (1024 * 1024) << "MB" << std::endl;
+	std::cout << "\t\t\tMax constant buffer: " << max_constant_size / 1024 << "KB" << std::endl;
+
+	// a plain context is enough when there's no GL texture to share
+	std::vector<cl_context_properties> properties = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform(), 0};
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
 #if defined OS_WIN
-	properties =
-		{
-			CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
-			CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
-			CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
-			0};
+		properties =
+			{
+				CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
+				CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
+				CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+				0};
 #elif defined OS_LNX
-	properties =
-		{
-			CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetGLXContext(window),
-			CL_GLX_DISPLAY_KHR, (cl_context_properties)glfwGetX11Display(),
-			CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
-			0};
+		properties =
+			{
+				CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetGLXContext(window),
+				CL_GLX_DISPLAY_KHR, (cl_context_properties)glfwGetX11Display(),
+				CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+				0};
 #else
-	std::cout << "there's only support for Windows and Linux at the moment" << std::endl;
-	exit(1);
+		std::cout << "there's only support for Windows and Linux at the moment" << std::endl;
+		exit(1);
+#endif
+	}
 #endif
 
 	// Create an OpenCL context
 	context = cl::Context(device, properties.data());
 
 	// Create a command queue
-	queue = cl::CommandQueue(context, device);
+	queue = cl::CommandQueue(context, device, PROFILE_QUEUE_PROPERTIES);
+	upload_queue = cl::CommandQueue(context, device, PROFILE_QUEUE_PROPERTIES);
 
 	{
 		// Create an OpenCL program with source
-		program = cl::Program(context, clw::kernel::parse(kernel_filepath, scene).c_str());
-
-		// Build the program for the selected device
-		cl_int result = program.build({device}); // "-cl-fast-relaxed-math"
+		PROFILE_PHASE_BEGIN("kernel preprocess");
+		kernel_source = clw::kernel::parse(kernel_filepath, scene, &kernel_preprocessor);
+		PROFILE_PHASE_END();
+
+		// Build the program for the selected device, or load the binary of an identical earlier build
+		PROFILE_PHASE_BEGIN("program build");
+		cl_int result = program_cache.build(context, device, kernel_source, buildOptions(), &program); // "-cl-fast-relaxed-math"
+		PROFILE_PHASE_END();
+		program_cache.printSummary();
 		if (result)
 			std::cout << "Error during compilation OpenCL code!!!\n (" << result << ")" << std::endl;
 		if (result == CL_BUILD_PROGRAM_FAILURE)
-			clw::err::printErrorLog(program, device);
+			clw::err::printErrorLog(program, device, &kernel_preprocessor);
 	}
 
 /*
@@ -214,7 +599,10 @@ void initCLKernel()
 {
 
 	// Create a kernel (entry point in the OpenCL source program)
-	kernel = cl::Kernel(program, "render_kernel");
+	if (TILE_SIZE)
+		kernel = cl::Kernel(program, "render_tile");
+	else
+		kernel = cl::Kernel(program, PERSISTENT_SPP ? "render_persistent" : "render_kernel");
 
 	// specify OpenCL kernel arguments
 	kernel.setArg(0, cl_meshes);
@@ -222,12 +610,12 @@ void initCLKernel()
 	kernel.setArg(2, window_height);
 	kernel.setArg(3, scene->object_count);
 	kernel.setArg(4, framenumber);
-	kernel.setArg(5, cl_camera);
+	kernel.setArg(5, cl_cameras[0]);
 	kernel.setArg(6, rand());
 	kernel.setArg(7, rand());
 	kernel.setArg(8, cl_screen);
 
-	kernel.setArg(9, mNewBufIndices);
+	kernel.setArg(9, mBufFaces);
 	kernel.setArg(10, mBufVertices);
 	kernel.setArg(11, mBufNormals);
 	kernel.setArg(12, mBufMaterial);
@@ -236,74 +624,684 @@ void initCLKernel()
 	// kernel.setArg(18, cl_noise_tex);
 	kernel.setArg(14, cl_flattenI);
 	kernel.setArg(15, mNewBufBVH);
+	kernel.setArg(16, cl_sample_count);
+
+	if (PERSISTENT_SPP || TILE_SIZE)
+	{
+		kernel.setArg(17, cl_work_counter);
+		kernel.setArg(18, PERSISTENT_SPP ? PERSISTENT_SPP : 1);
+	}
+
+	// a NULL buffer keeps every pixel active
+	const cl::Buffer no_buffer;
+	if (!TILE_SIZE)
+		kernel.setArg(PERSISTENT_SPP ? 19 : 17, ADAPTIVE_THRESHOLD > 0.0f ? (PERSISTENT_SPP ? cl_active_pixels : cl_active_mask) : no_buffer);
+
+	if (ADAPTIVE_THRESHOLD > 0.0f)
+	{
+		adaptive_kernel = cl::Kernel(program, "adaptive_update");
+		adaptive_kernel.setArg(0, window_width);
+		adaptive_kernel.setArg(1, window_height);
+		adaptive_kernel.setArg(2, cl_flattenI);
+		adaptive_kernel.setArg(3, ADAPTIVE_THRESHOLD);
+		adaptive_kernel.setArg(4, cl_active_mask);
+		adaptive_kernel.setArg(5, cl_active_pixels);
+		adaptive_kernel.setArg(6, cl_work_counter);
+		adaptive_kernel.setArg(7, cl_sample_count);
+	}
+
+	kernel.setArg(PERSISTENT_SPP || TILE_SIZE ? 20 : 18, cl_settings);
+
+	if (!PERSISTENT_SPP && !TILE_SIZE)
+	{
+		// e.g. a rebuilt program with a smaller work-group limit
+		if (!launch_config.block_w || launch_config.getLocalSize() > kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device))
+			launch_config = WorkGroupTuner::getDefault(kernel, device);
+		kernel.setArg(19, launch_config.getKernelArg(window_width));
+	}
+
+	if (RAY_STATS)
+		kernel.setArg(PERSISTENT_SPP || TILE_SIZE ? 21 : 20, cl_ray_stats);
 }
 
-//---------------------------------------------------------------------------------------
+// every pixel in the image has its own thread or "work item",
+// so the total amount of work items equals the number of pixels
+void initWorkSize(std::size_t num_pixels)
+{
+	// launch just enough work items to fill the device, they fetch pixels until none are left
+	if (PERSISTENT_SPP || TILE_SIZE)
+	{
+		local_work_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+		global_work_size = (num_pixels + local_work_size - 1) / local_work_size * local_work_size;
 
-#ifndef NDEBUG
-double acc_time(0);
+		const std::size_t resident = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * local_work_size * 4;
+		global_work_size = std::min(global_work_size, resident);
+		return;
+	}
+
+	// every work-group covers a block of pixels, the blocks on the right and bottom edges are padded
+	local_work_size = launch_config.getLocalSize();
+	global_work_size = launch_config.getGlobalSize(window_width, window_height);
+}
+
+// benchmark the work-group shapes of render_kernel on the scene, the winner is cached per device and program
+void tuneWorkGroups()
+{
+	const cl_ulong key = WorkGroupTuner::getKey(device, "render_kernel", kernel_source, buildOptions());
+
+	WorkGroupConfig config;
+	if (AUTOTUNE < 2 && workgroup_tuner.find(key, &config) && config.getLocalSize() <= kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device))
+	{
+		std::cout << "[WorkGroupTuner] cached " << config.toString() << std::endl;
+	}
+	else
+	{
+		// the candidates trace the view the render starts from
+		interactiveCamera->buildRenderCamera(&hostRendercams[0]);
+		queue.enqueueWriteBuffer(cl_cameras[0], CL_TRUE, 0, sizeof(Camera), &hostRendercams[0]);
+		kernel.setArg(5, cl_cameras[0]);
+
+#ifndef HEADLESS_ONLY
+		if (!HEADLESS)
+		{
+			glFinish();
+			queue.enqueueAcquireGLObjects(&cl_screens);
+		}
+#endif
+		config = workgroup_tuner.tune(key, kernel, device, [](const WorkGroupConfig &candidate) {
+			const std::size_t global_size = candidate.getGlobalSize(window_width, window_height);
+			kernel.setArg(19, candidate.getKernelArg(window_width));
+
+			// every candidate starts from fresh paths, the first launch warms up the caches
+			queue.enqueueFillBuffer(cl_sample_count, cl_uint4{{0, 0, ++path_epoch, 0}}, 0, sizeof(cl_uint4));
+			queue.enqueueNDRangeKernel(kernel, cl::NullRange, global_size, candidate.getLocalSize());
+			queue.finish();
+
+			const double tStart = utils::getTime();
+			for (cl_uint i = 0; i < TUNE_LAUNCHES; ++i)
+				queue.enqueueNDRangeKernel(kernel, cl::NullRange, global_size, candidate.getLocalSize());
+			queue.finish();
+			return utils::getTime() - tStart;
+		});
+#ifndef HEADLESS_ONLY
+		if (!HEADLESS)
+		{
+			queue.enqueueReleaseGLObjects(&cl_screens);
+			queue.finish();
+		}
 #endif
 
-void runKernel()
+		// the benchmark launches aren't part of the render
+		buffer_reset = true;
+		if (RAY_STATS)
+			queue.enqueueFillBuffer(cl_ray_stats, 0, 0, RAY_STATS_SIZE * sizeof(cl_uint));
+	}
+
+	launch_config = config;
+	kernel.setArg(19, launch_config.getKernelArg(window_width));
+	initWorkSize(window_width * window_height);
+}
+
+void initWavefront()
 {
-	//Make sure OpenGL is done using the VBOs
-	glFinish();
+	WavefrontScene wf_scene = {cl_meshes, scene->object_count, mBufFaces, mBufVertices, mBufNormals, mBufMaterial, mNewBufBVH, cl_settings};
+	WavefrontTargets wf_targets = {window_width, window_height, cl_cameras[0], cl_env_map, cl_screen, cl_flattenI, cl_sample_count};
+	wavefront = std::make_unique<Wavefront>(program, device, wf_scene, wf_targets);
+	if (RAY_STATS)
+		wavefront->setRayStats(cl_ray_stats);
+}
 
-	//this passes in the vector of VBO buffer objects
-	queue.enqueueAcquireGLObjects(&cl_screens);
-	queue.finish();
+// the bounds of what intersect_sphere(), intersect_box() and intersect_quad() can hit, false for the SDFs
+bool getMeshBounds(const Mesh &mesh, float *bounds)
+{
+	float lo[3], hi[3];
+	if (mesh.t & SPHERE)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			lo[a] = mesh.position[a] - std::abs(mesh.joker.s[0]);
+			hi[a] = mesh.position[a] + std::abs(mesh.joker.s[0]);
+		}
+	}
+	else if (mesh.t & BOX)
+	{
+		// centered at pos, joker.s012 are the half extents
+		for (int a = 0; a < 3; ++a)
+		{
+			lo[a] = mesh.position[a] - std::abs(mesh.joker.s[a]);
+			hi[a] = mesh.position[a] + std::abs(mesh.joker.s[a]);
+		}
+	}
+	else if (mesh.t & QUAD)
+	{
+		// joker.s012: center, s345 and s678: edges
+		for (int a = 0; a < 3; ++a)
+		{
+			const float extent = 0.5f * (std::abs(mesh.joker.s[3 + a]) + std::abs(mesh.joker.s[6 + a]));
+			lo[a] = mesh.joker.s[a] - extent;
+			hi[a] = mesh.joker.s[a] + extent;
+		}
+	}
+	else
+		return false;
 
-#ifndef NDEBUG
-	double tStart = glfwGetTime();
+	// quads are flat, every box gets a little thickness
+	for (int a = 0; a < 3; ++a)
+	{
+		bounds[2 * a + 0] = lo[a] - 1e-4f;
+		bounds[2 * a + 1] = hi[a] + 1e-4f;
+	}
+	return true;
+}
+
+// a buffer of the same size is written in place, the kernels' arguments stay valid
+void reuseBuffer(cl::Buffer *buffer, std::size_t bytes)
+{
+	if (!(*buffer)() || buffer->getInfo<CL_MEM_SIZE>() != bytes)
+		*buffer = cl::Buffer(context, CL_MEM_READ_ONLY, bytes);
+}
+
+// the meshes and settings of the scene, neither is compiled into the program
+void uploadScene()
+{
+	// every __constant argument of render_kernel shares the device's constant memory
+	const std::size_t constant_bytes = sizeof(Camera) + sizeof(cl_Settings);
+	if (constant_bytes > max_constant_size)
+		std::cout << "the scene's settings need " << constant_bytes / 1024 << "KB of constant memory, the device has "
+				  << max_constant_size / 1024 << "KB" << std::endl;
+
+	// the kernels find the instances and the top-level BVH right behind the meshes
+	std::vector<TLASPrimitive> primitives;
+	for (cl_uint i = 0; i < scene->object_count.s[7]; ++i)
+	{
+		TLASPrimitive primitive = {{}, i};
+		if (getMeshBounds(scene->cpu_meshes[i], primitive.bounds))
+			primitives.push_back(primitive);
+	}
+
+	std::vector<cl_Instance> instances;
+	// one per instance, the kernels always get at least one
+	std::vector<Material> materials;
+	for (const host_scene::host_instance &instance : scene->instances)
+	{
+		const ModelBLAS &blas = blas_library.at(instance.path);
+
+		cl_Instance device_instance;
+		TLASPrimitive primitive = {{}, TLAS_INSTANCE | (cl_uint)instances.size()};
+		if (!makeInstance(instance.transform, blas.root, blas.bounds, &device_instance, primitive.bounds))
+		{
+			std::cout << "skipping an instance of " << instance.path << ", its transform can't be inverted" << std::endl;
+			continue;
+		}
+		instances.push_back(device_instance);
+		materials.push_back(instance.mat);
+		primitives.push_back(primitive);
+	}
+	if (materials.empty())
+		materials.emplace_back();
+	scene->object_count.s[4] = (cl_uint)instances.size();
+
+	const std::vector<cl_BVHnode> tlas = buildTLAS(primitives);
+	const std::size_t bytesMeshes = scene->object_count.s[7] * sizeof(Mesh);
+	const std::size_t bytesInstances = instances.size() * sizeof(cl_Instance);
+	const std::size_t bytesTLAS = tlas.size() * sizeof(cl_BVHnode);
+	checkAllocSize("the meshes", bytesMeshes + bytesInstances + bytesTLAS);
+
+	reuseBuffer(&cl_meshes, bytesMeshes + bytesInstances + bytesTLAS);
+	if (bytesMeshes)
+		writeForFrame(cl_meshes, 0, bytesMeshes, scene->cpu_meshes.data(), "write meshes");
+	if (bytesInstances)
+		writeForFrame(cl_meshes, bytesMeshes, bytesInstances, instances.data(), "write instances");
+	writeForFrame(cl_meshes, bytesMeshes + bytesInstances, bytesTLAS, tlas.data(), "write tlas");
+
+	const std::size_t bytesMaterials = materials.size() * sizeof(Material);
+	checkAllocSize("the materials", bytesMaterials);
+	reuseBuffer(&mBufMaterial, bytesMaterials);
+	writeForFrame(mBufMaterial, 0, bytesMaterials, materials.data(), "write materials");
+
+	cl_Settings settings;
+	scene->getSettings(&settings);
+	reuseBuffer(&cl_settings, sizeof(cl_Settings));
+	writeForFrame(cl_settings, 0, sizeof(cl_Settings), &settings, "write settings");
+}
+
+// rebuild the active pixel mask and list from the per-pixel error estimates
+void updateAdaptive()
+{
+	const std::size_t num_pixels = window_width * window_height;
+	const std::size_t local_size = adaptive_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+	queue.enqueueFillBuffer(cl_work_counter, cl_uint2{{0, 0}}, 0, sizeof(cl_uint2), nullptr, PROFILE_EVENT("fill work counter"));
+	queue.enqueueNDRangeKernel(adaptive_kernel, cl::NullRange, (num_pixels + local_size - 1) / local_size * local_size, local_size,
+							   nullptr, PROFILE_EVENT("adaptive_update"));
+}
+
+// pixels whose error is still above the adaptive threshold
+cl_uint activePixels()
+{
+	cl_uint2 counter;
+	queue.enqueueReadBuffer(cl_work_counter, CL_TRUE, 0, sizeof(cl_uint2), &counter);
+	return counter.s[1];
+}
+
+//---------------------------------------------------------------------------------------
+
+// enqueue the frame behind `upload`, nothing here blocks the host
+void runKernel(const cl::Event &upload, cl::Event *done)
+{
+	std::vector<cl::Event> deps = {upload};
+	cl::Event rendered;
+
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
+		//Make sure OpenGL is done using the VBOs
+		glFinish();
+
+		//this passes in the vector of VBO buffer objects
+		cl::Event acquired;
+		queue.enqueueAcquireGLObjects(&cl_screens, nullptr, &acquired);
+		deps.push_back(acquired);
+		PROFILE_ADD_EVENT("gl acquire", acquired);
+	}
 #endif
+
 	// launch the kernel
-	queue.enqueueNDRangeKernel(kernel, NULL, global_work_size, local_work_size); // local_work_size
-	queue.finish();
-#ifndef NDEBUG
-#if 1
-	acc_time += (glfwGetTime() - tStart);
-	// display avg render time per frame
-	std::cout << "\rRender Time: " << (acc_time / framenumber) << "s  " << std::flush;
-#else
-	// display render time per frame
-	cout << "\rRender Time: " << (glfwGetTime() - tStart) << "s  " << std::flush;
-#endif
+	if (wavefront)
+		wavefront->enqueue(queue, framenumber, rand(), rand(), &deps, &rendered);
+	else if (PERSISTENT_SPP)
+	{
+		// the adaptive list keeps its length in the second counter
+		if (ADAPTIVE_THRESHOLD > 0.0f)
+			queue.enqueueFillBuffer(cl_work_counter, 0, 0, sizeof(cl_uint), &deps, PROFILE_EVENT("fill work counter"));
+		else
+			queue.enqueueFillBuffer(cl_work_counter, cl_uint2{{0, (cl_uint)(window_width * window_height)}}, 0, sizeof(cl_uint2), &deps, PROFILE_EVENT("fill work counter"));
+		queue.enqueueNDRangeKernel(kernel, NULL, global_work_size, local_work_size, nullptr, &rendered);
+		PROFILE_ADD_EVENT("render_persistent", rendered);
+	}
+	else
+	{
+		queue.enqueueNDRangeKernel(kernel, NULL, global_work_size, local_work_size, &deps, &rendered); // local_work_size
+		PROFILE_ADD_EVENT("render_kernel", rendered);
+	}
+
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
+		//Release the VBOs so OpenGL can play with them
+		const std::vector<cl::Event> after_render = {rendered};
+		queue.enqueueReleaseGLObjects(&cl_screens, &after_render, &rendered);
+		PROFILE_ADD_EVENT("gl release", rendered);
+	}
 #endif
+	queue.flush();
 
-	//Release the VBOs so OpenGL can play with them
-	queue.enqueueReleaseGLObjects(&cl_screens);
-	queue.finish();
+	*done = rendered;
 }
 
 //---------------------------------------------------------------------------------------
 
 void render()
 {
+	const std::size_t slot = framenumber % FRAMES_IN_FLIGHT;
+
+	// the camera slot is free again once the frame that read it has finished
+	if (frame_events[slot]())
+		frame_events[slot].wait();
 
 	if (buffer_reset)
 	{
-#ifndef NDEBUG
-		acc_time = 0;
-#endif
-		queue.enqueueFillBuffer(cl_flattenI, 0, 0, window_width * window_height * RayI_size);
+		queue.enqueueFillBuffer(cl_sample_count, cl_uint4{{0, 0, ++path_epoch, 0}}, 0, sizeof(cl_uint4), nullptr, PROFILE_EVENT("reset path state"));
 		framenumber = 0;
 	}
 	buffer_reset = false;
 
+	// every launch of the persistent kernel adds whole paths, render_kernel only a bounce
+	if (ADAPTIVE_THRESHOLD > 0.0f && framenumber % (PERSISTENT_SPP ? 1 : 32) == 0)
+		updateAdaptive();
+
 	// build a new camera for each frame on the CPU
-	interactiveCamera->buildRenderCamera(hostRendercam);
+	interactiveCamera->buildRenderCamera(&hostRendercams[slot]);
 	// copy the host camera to a OpenCL camera
-	queue.enqueueWriteBuffer(cl_camera, CL_TRUE, 0, sizeof(Camera), hostRendercam);
-	queue.finish();
+	cl::Event upload;
+	upload_queue.enqueueWriteBuffer(cl_cameras[slot], CL_FALSE, 0, sizeof(Camera), &hostRendercams[slot], nullptr, &upload);
+	upload_queue.flush();
+	PROFILE_ADD_EVENT("write camera", upload);
 
 	kernel.setArg(4, ++framenumber);
-	kernel.setArg(5, cl_camera);
+	kernel.setArg(5, cl_cameras[slot]);
 	kernel.setArg(6, rand());
 	kernel.setArg(7, rand());
+	if (wavefront)
+		wavefront->setCamera(cl_cameras[slot]);
 
-	runKernel();
+	runKernel(upload, &frame_events[slot]);
 
-	drawGL();
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
+		// the displayed frame is the only point where the host waits for the device
+		frame_events[slot].wait();
+		drawGL();
+	}
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+
+// average samples per pixel, every path start bumps the device counter, see countSamples() in path_state.cl
+double samplesPerPixel()
+{
+	cl_uint2 samples = {{0, 0}};
+	queue.enqueueReadBuffer(cl_sample_count, CL_TRUE, 0, sizeof(cl_uint2), &samples);
+	return (double)((cl_ulong)samples.s[1] << 32 | samples.s[0]) / (window_width * window_height);
+}
+
+// RGBA radiance of the current frame
+std::vector<cl_float> readRadiance()
+{
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
+		glFinish();
+		queue.enqueueAcquireGLObjects(&cl_screens);
+	}
+#endif
+
+	cl::size_t<3> origin;
+	cl::size_t<3> region;
+	region[0] = window_width;
+	region[1] = window_height;
+	region[2] = 1;
+
+	std::vector<cl_float> pixels(4 * window_width * window_height);
+	queue.enqueueReadImage(cl_screen, CL_TRUE, origin, region, 0, 0, pixels.data());
+
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
+	{
+		queue.enqueueReleaseGLObjects(&cl_screens);
+		queue.finish();
+	}
+#endif
+	return pixels;
+}
+
+// frames after which every active pixel has started target_spp paths, 0: no spp target
+cl_ulong frameLimit()
+{
+	if (!target_spp)
+		return 0;
+
+	// every launch of the persistent kernel adds PERSISTENT_SPP paths to each pixel
+	if (PERSISTENT_SPP)
+		return (target_spp + PERSISTENT_SPP - 1) / PERSISTENT_SPP;
+
+	// render_kernel and the wavefront integrator trace a bounce or a scattering event per frame, a path ends
+	// after at most every bounce and every scattering event plus the frame that starts it
+	const cl_ulong bounces = std::min(scene->MAX_BOUNCES, CL_RAYTRACER::PATH_MAX_BOUNCES);
+	const cl_ulong scatters = std::min(scene->MAX_SCATTERING_EVENTS, CL_RAYTRACER::PATH_MAX_SCATTERING_EVENTS);
+	return target_spp * (bounces + scatters + 1);
+}
+
+// true once the controller's target is met, polled every 16 frames so the queue isn't stalled on every bounce
+bool renderDone(RenderController &controller)
+{
+	if (!PERSISTENT_SPP && framenumber % 16)
+		return false;
+
+	bool done = controller.update(samplesPerPixel(), readRadiance);
+	controller.printProgress(framenumber);
+
+	// the frame count doesn't depend on the device counter, a render with an spp target always ends
+	if (!done && target_spp && framenumber >= frameLimit())
+	{
+		controller.stop(StopReason::FRAME_LIMIT);
+		done = true;
+	}
+
+	// the average spp stalls once every pixel is below the adaptive threshold
+	if (!done && ADAPTIVE_THRESHOLD > 0.0f && activePixels() == 0)
+	{
+		controller.stop(StopReason::CONVERGED);
+		done = true;
+	}
+	return done;
+}
+
+// stats summary and output, once the render loop is done
+void finishRender(const RenderController &controller)
+{
+	queue.finish();
+	controller.printSummary(framenumber, window_width * window_height);
+	headless::saveImage(readRadiance(), output_filepath);
+}
+
+// keep launching the kernel until the controller's target is met
+void renderHeadless(RenderController &controller)
+{
+	controller.start();
+	do
+	{
+		render();
+	} while (!renderDone(controller));
+
+	finishRender(controller);
+}
+
+// render one tile after the other, the finished tiles are read back while the next one renders
+void renderTiled(int tile_width, int tile_height)
+{
+	interactiveCamera->buildRenderCamera(&hostRendercams[0]);
+	queue.enqueueWriteBuffer(cl_cameras[0], CL_TRUE, 0, sizeof(Camera), &hostRendercams[0]);
+
+	const cl_uint spp = PERSISTENT_SPP ? PERSISTENT_SPP : 1;
+	const cl_uint passes = target_spp ? (target_spp + spp - 1) / spp : 0;
+	const int tiles_x = (window_width + tile_width - 1) / tile_width;
+	const int tiles_y = (window_height + tile_height - 1) / tile_height;
+	const int num_tiles = tiles_x * tiles_y;
+
+	// ring of two radiance targets, the second one is cl_screen
+	cl_int err = CL_SUCCESS;
+	cl::Image targets[2] = {cl_screen, headless::createRenderTarget(&err, tile_width, tile_height)};
+	if (err)
+		std::cout << cl_help::err::getOpenCLErrorCodeStr(err) << std::endl;
+	std::vector<cl_float> readback[2] = {std::vector<cl_float>(4 * tile_width * tile_height), std::vector<cl_float>(4 * tile_width * tile_height)};
+	cl::Event read_events[2];
+	cl_int4 read_tiles[2];
+
+	headless::TiledImage image(output_filepath, window_width, window_height);
+
+	const double tStart = utils::getTime();
+	cl_ulong samples = 0;
+
+	for (int t = 0; t <= num_tiles; ++t)
+	{
+		const int slot = t % 2;
+
+		if (t < num_tiles)
+		{
+			const int x = (t % tiles_x) * tile_width;
+			const int y = (t / tiles_x) * tile_height;
+			const cl_int4 tile = {{x, y, std::min(tile_width, window_width - x), std::min(tile_height, window_height - y)}};
+			const std::size_t tile_pixels = tile.s[2] * tile.s[3];
+
+			queue.enqueueFillBuffer(cl_sample_count, cl_uint4{{0, 0, ++path_epoch, 0}}, 0, sizeof(cl_uint4), nullptr, PROFILE_EVENT("reset path state"));
+
+			kernel.setArg(8, targets[slot]);
+			kernel.setArg(19, tile);
+
+			// what's left of the time budget is split evenly across the remaining tiles
+			const double tile_start = utils::getTime();
+			const double tile_budget = time_budget > 0.0 ? (time_budget - (tile_start - tStart)) / (num_tiles - t) : 0.0;
+
+			for (cl_uint pass = 0; !passes || pass < passes; ++pass)
+			{
+				kernel.setArg(4, pass + 1);
+				kernel.setArg(6, rand());
+				kernel.setArg(7, rand());
+				queue.enqueueFillBuffer(cl_work_counter, 0, 0, sizeof(cl_uint), nullptr, PROFILE_EVENT("fill work counter"));
+				queue.enqueueNDRangeKernel(kernel, cl::NullRange, global_work_size, local_work_size, nullptr, PROFILE_EVENT("render_tile"));
+				samples += tile_pixels * spp;
+
+				if (time_budget > 0.0)
+				{
+					queue.finish();
+					if (utils::getTime() - tile_start >= tile_budget)
+						break;
+				}
+			}
+
+			// the read is in order after the tile's last pass
+			cl::size_t<3> origin;
+			cl::size_t<3> region;
+			region[0] = tile.s[2];
+			region[1] = tile.s[3];
+			region[2] = 1;
+			queue.enqueueReadImage(targets[slot], CL_FALSE, origin, region, 0, 0, readback[slot].data(), nullptr, &read_events[slot]);
+			PROFILE_ADD_EVENT("read tile", read_events[slot]);
+			queue.flush();
+			read_tiles[slot] = tile;
+		}
+
+		// the previous tile has been read back while this one was enqueued
+		if (t > 0)
+		{
+			const int prev = 1 - slot;
+			read_events[prev].wait();
+			image.write(readback[prev], read_tiles[prev].s[0], read_tiles[prev].s[1], read_tiles[prev].s[2], read_tiles[prev].s[3]);
+			std::cout << "\rtile: " << t << "/" << num_tiles << ", elapsed: " << utils::getTime() - tStart << "s  " << std::flush;
+		}
+	}
+
+	const double elapsed = utils::getTime() - tStart;
+	std::cout << std::endl
+			  << "rendered " << (double)samples / ((double)window_width * window_height) << "spp in " << elapsed << "s ("
+			  << samples / elapsed * 1e-6 << " Msamples/s)" << std::endl;
+
+	image.close();
+}
+
+// totals of the traversal counters since the render started
+void reportRayStats()
+{
+	if (!RAY_STATS)
+		return;
+
+	cl_uint counters[RAY_STATS_SIZE];
+	queue.enqueueReadBuffer(cl_ray_stats, CL_TRUE, 0, sizeof(counters), counters);
+	ray_statistics.update(counters);
+	ray_statistics.print();
+}
+
+// hand out tiles to every device until the target spp or the time budget is hit
+void renderMultiDevice()
+{
+	interactiveCamera->buildRenderCamera(&hostRendercams[0]);
+	queue.enqueueWriteBuffer(cl_cameras[0], CL_TRUE, 0, sizeof(Camera), &hostRendercams[0]);
+
+	MultiDeviceScene md_scene = {kernel_source, buildOptions(), cl_meshes, scene->object_count, mBufFaces, mBufVertices, mBufNormals, mBufMaterial, mNewBufBVH, cl_cameras[0], cl_env_map, cl_settings};
+	MultiDevice multi_device(MultiDevice::getSecondaryDevices(device), md_scene, window_width, window_height, PERSISTENT_SPP ? PERSISTENT_SPP : 1);
+	std::cout << "rendering on " << multi_device.getDeviceCount() << " device(s)" << std::endl;
+
+	headless::saveImage(multi_device.render(target_spp, time_budget), output_filepath);
+}
+
+//---------------------------------------------------------------------------------------
+
+// swap in `next` and restart the accumulation, the program has to be built for it
+void applyScene(host_scene *next)
+{
+	// the frames in flight still read the old buffers
+	queue.finish();
+
+	delete scene;
+	scene = next;
+
+	uploadScene();
+
+	initCLKernel();
+	initWorkSize(window_width * window_height);
+	if (WAVEFRONT)
+		initWavefront();
+
+	buffer_reset = true;
+}
+
+// the animated models follow the clock, every new frame restarts the accumulation
+void animateScene()
+{
+	static const double start = utils::getTime();
+	if (!animateModels(utils::getTime() - start))
+		return;
+
+	uploadScene();
+	buffer_reset = true;
+}
+
+// apply edits of the scene file, only a different material or primitive mix rebuilds the program
+void reloadScene()
+{
+	// keep rendering the old scene until its program is ready
+	if (pending_scene)
+	{
+		cl_int result;
+		cl::Program rebuilt;
+		if (!scene_watcher->finishBuild(&result, &rebuilt))
+			return;
+
+		if (result == CL_SUCCESS)
+		{
+			program = rebuilt;
+			kernel_source.swap(pending_source);
+			kernel_preprocessor = std::move(pending_preprocessor);
+			applyScene(pending_scene);
+		}
+		else
+		{
+			std::cout << "Error during compilation OpenCL code!!!\n (" << result << ")" << std::endl;
+			if (result == CL_BUILD_PROGRAM_FAILURE)
+				clw::err::printErrorLog(rebuilt, device, &pending_preprocessor);
+			delete pending_scene;
+		}
+		pending_scene = nullptr;
+		return;
+	}
+
+	if (!scene_watcher->changed())
+		return;
+
+	host_scene *next = new host_scene();
+	if (!next->load())
+	{
+		delete next;
+		return;
+	}
+
+	// the models and their bvhs are only loaded at startup, the instances can change
+	for (const std::string &path : next->getModelPaths())
+	{
+		if (!blas_library.count(path))
+		{
+			std::cout << "the scene uses a new model (" << path << "), restart to load it" << std::endl;
+			delete next;
+			return;
+		}
+	}
+
+	pending_preprocessor = KernelPreprocessor();
+	std::string source = clw::kernel::parse(kernel_filepath, next, &pending_preprocessor);
+
+	// settings only, the program stays
+	if (source == kernel_source)
+	{
+		applyScene(next);
+		return;
+	}
+
+	pending_scene = next;
+	pending_source.swap(source);
+	scene_watcher->startBuild(context, device, pending_source, buildOptions());
 }
 
 //---------------------------------------------------------------------------------------
@@ -362,19 +1360,184 @@ int main(int argc, char **argv)
 		{ // alpha channel
 			ALPHA_TESTING = true;
 		}
+		else if (arg == "-wavefront")
+		{ // wavefront integrator
+			WAVEFRONT = true;
+		}
+		else if (arg == "-persistent")
+		{ // persistent threads: paths per pixel and launch
+			PERSISTENT_SPP = atoi(argv[++i]);
+		}
+		else if (arg == "-multi-device")
+		{ // headless: render on every OpenCL device
+			MULTI_DEVICE = true;
+		}
+		else if (arg == "-tile")
+		{ // headless: tile size in pixels
+			TILE_SIZE = atoi(argv[++i]);
+		}
+		else if (arg == "-adaptive")
+		{ // adaptive sampling: relative error threshold
+			ADAPTIVE_THRESHOLD = (float)atof(argv[++i]);
+		}
 		else if (arg == "-encoder")
 		{ // encoder { 0: ".png", 1: ".hdr" }
 			encoder = atoi(argv[++i]);
 		}
+		else if (arg == "-headless")
+		{ // render offline without a window
+			HEADLESS = true;
+		}
+		else if (arg == "-spp")
+		{ // target samples per pixel
+			target_spp = atoi(argv[++i]);
+		}
+		else if (arg == "-time")
+		{ // time budget in seconds
+			time_budget = atof(argv[++i]);
+		}
+		else if (arg == "-noise")
+		{ // stop once the estimated noise drops below this value
+			noise_threshold = (float)atof(argv[++i]);
+		}
+		else if (arg == "-stats")
+		{ // traversal counters
+			RAY_STATS = true;
+		}
+		else if (arg == "-bvh-width")
+		{ // BVH branching factor { 2, 4, 8 }
+			BVH_WIDTH = atoi(argv[++i]);
+		}
+		else if (arg == "-bvh-stackless")
+		{ // parent pointer traversal of the binary BVH
+			BVH_STACKLESS = true;
+		}
+		else if (arg == "-bvh-refit")
+		{ // animated models: SAH degradation that triggers a rebuild (0: every frame)
+			REFIT_THRESHOLD = (float)atof(argv[++i]);
+		}
+		else if (arg == "-bvh-builder")
+		{ // model BVH build { sweep, binned, parallel, lbvh }
+			const std::string name = argv[++i];
+			LBVH_BUILD = name == "lbvh";
+			if (name == "sweep")
+				BVH_BUILDER = BVH_BUILDER_SWEEP;
+			else if (name == "binned")
+				BVH_BUILDER = BVH_BUILDER_BINNED;
+			else if (name == "parallel")
+				BVH_BUILDER = BVH_BUILDER_PARALLEL;
+			else if (!LBVH_BUILD)
+				std::cout << "-bvh-builder has to be sweep, binned, parallel or lbvh" << std::endl;
+		}
+		else if (arg == "-lbvh-verify")
+		{ // check the device builds and compare their SAH cost with the host builder
+			LBVH_VERIFY = true;
+		}
+		else if (arg == "-autotune")
+		{ // work-group shape of render_kernel { 0: off, 1: cached, 2: benchmark again }
+			AUTOTUNE = atoi(argv[++i]);
+		}
+		else if (arg == "-program-cache")
+		{ // compiled program cache directory ("": disabled)
+			program_cache.setDirectory(argv[++i]);
+		}
+		else if (arg == "-profile")
+		{ // profiling report filepath
+			profile_filepath = argv[++i];
+		}
+		else if (arg == "-out")
+		{ // output filepath
+			output_filepath = argv[++i];
+		}
+	}
+	if (WAVEFRONT && PERSISTENT_SPP)
+	{
+		std::cout << "-persistent is ignored by the wavefront integrator" << std::endl;
+		PERSISTENT_SPP = 0;
+	}
+
+	if (MULTI_DEVICE && !HEADLESS)
+	{
+		std::cout << "-multi-device is only supported in headless mode" << std::endl;
+		MULTI_DEVICE = false;
+	}
+
+	if (ADAPTIVE_THRESHOLD > 0.0f && (WAVEFRONT || MULTI_DEVICE || TILE_SIZE))
+	{
+		std::cout << "-adaptive is ignored by -wavefront, -multi-device and -tile" << std::endl;
+		ADAPTIVE_THRESHOLD = 0.0f;
+	}
+
+	if (BVH_WIDTH != 2 && BVH_WIDTH != 4 && BVH_WIDTH != 8)
+	{
+		std::cout << "-bvh-width has to be 2, 4 or 8" << std::endl;
+		BVH_WIDTH = 4;
+	}
+
+	if (LBVH_VERIFY && !LBVH_BUILD)
+	{
+		std::cout << "-lbvh-verify is ignored without -bvh-builder lbvh" << std::endl;
+		LBVH_VERIFY = false;
+	}
+
+	if (LBVH_BUILD && BVH_WIDTH != 2)
+	{
+		std::cout << "-bvh-builder lbvh writes binary nodes, using -bvh-width 2" << std::endl;
+		BVH_WIDTH = 2;
+	}
+
+	if (BVH_STACKLESS && BVH_WIDTH != 2)
+	{
+		std::cout << "-bvh-stackless traverses the binary BVH, using -bvh-width 2" << std::endl;
+		BVH_WIDTH = 2;
+	}
+
+	if (RAY_STATS && MULTI_DEVICE)
+	{
+		std::cout << "-stats is ignored by -multi-device" << std::endl;
+		RAY_STATS = false;
+	}
+
+	if (TILE_SIZE && (!HEADLESS || WAVEFRONT || MULTI_DEVICE))
+	{
+		std::cout << "-tile is only supported in single device headless mode without -wavefront" << std::endl;
+		TILE_SIZE = 0;
 	}
-	global_work_size = window_width * window_height;
 
-	// initialise OpenGL (GLEW and GLUT window + callback functions)
-	initGL();
+	// tiles bound the path state and the radiance target to a single tile
+	const int target_width = TILE_SIZE ? std::min<int>(TILE_SIZE, window_width) : window_width;
+	const int target_height = TILE_SIZE ? std::min<int>(TILE_SIZE, window_height) : window_height;
+
+	if (HEADLESS)
+	{
+		if (!target_spp && time_budget <= 0.0 && noise_threshold <= 0.0f)
+			target_spp = 64;
+	}
+#ifndef HEADLESS_ONLY
+	else
+	{
+		// initialise OpenGL (GLEW and GLUT window + callback functions)
+		initGL();
+	}
+#endif
+	if (output_filepath.empty())
+		output_filepath = encoder ? "render.hdr" : "render.png";
+
+	// the tiles are rendered in passes of fixed spp, there's no image to estimate the noise from
+	if ((MULTI_DEVICE || TILE_SIZE) && !target_spp && time_budget <= 0.0)
+	{
+		std::cout << "-noise isn't supported by -multi-device and -tile, rendering 64spp" << std::endl;
+		target_spp = 64;
+	}
+
+	RenderController controller(target_spp, time_budget, noise_threshold);
 
 	// initialise scene
+	PROFILE_PHASE_BEGIN("scene parse");
 	scene = new host_scene();
-	scene->load();
+	if (!scene->load())
+		exit(1);
+	PROFILE_PHASE_END();
 
 	cl_int err;
 
@@ -393,45 +1556,42 @@ int main(int argc, char **argv)
 
 	std::cout << "=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-" << std::endl;
 
-	glfwShowWindow(window);
-
-	//make sure OpenGL is finished before we proceed
-	glFinish();
-
-	if (scene->BUILD_BVH)
+#ifndef HEADLESS_ONLY
+	if (!HEADLESS)
 	{
-		mBufMaterial = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(Material));
-		queue.enqueueWriteBuffer(mBufMaterial, CL_TRUE, 0, sizeof(Material), scene->obj_mat);
-
-		std::shared_ptr<IO::ModelLoader> ml = std::make_shared<IO::ModelLoader>();
-		ml->ImportFromFile(std::string(models_directory + scene->obj_path));
-		
-		std::unique_ptr<BVH> bvh = std::make_unique<BVH>(ml);
-		std::unique_ptr<std::vector<cl_BVHnode>> nodes = bvh->PrepareData();
-		std::size_t bytesBVH = sizeof(cl_BVHnode) * nodes->size();
-		mNewBufBVH = clw::buffer::create(*nodes, bytesBVH);
+		glfwShowWindow(window);
 
-		initOpenCLBuffers_Faces(ml, bvh.get());
+		//make sure OpenGL is finished before we proceed
+		glFinish();
 	}
+#endif
+
+	if (scene->BUILD_BVH)
+		initOpenCLBuffers_Models();
 
 	//
-	cl_meshes = clw::buffer::create(scene->cpu_meshes, scene->object_count.s[7] * sizeof(Mesh));
+	uploadScene();
 
 	// initialise an interactive camera on the CPU side
 	initCamera();
 
-	// create a CPU camera
-	hostRendercam = new Camera();
-	// camera's CL memory buffer
-	cl_camera = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(Camera));
-	queue.enqueueWriteBuffer(cl_camera, CL_TRUE, 0, sizeof(Camera), hostRendercam);
+	// camera's CL memory buffers, one per frame in flight
+	for (cl::Buffer &cl_camera : cl_cameras)
+	{
+		cl_camera = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(Camera));
+		queue.enqueueWriteBuffer(cl_camera, CL_TRUE, 0, sizeof(Camera), &hostRendercams[0]);
+	}
 
-#if 0
-	Texture* cubemap = loadHDR(env_map_filepath.c_str());
-	cl_env_map = cl::Image2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat( CL_RGBA, CL_HALF_FLOAT ), cubemap->width, cubemap->height, 0, cubemap->data, &err);
-#else
-	cl_env_map = cl::ImageGL(context, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, tex1, &err);
-	cl_screens.push_back(cl_env_map);
+	if (HEADLESS)
+	{
+		cl_env_map = headless::createEnvMap(&err);
+	}
+#ifndef HEADLESS_ONLY
+	else
+	{
+		cl_env_map = cl::ImageGL(context, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, tex1, &err);
+		cl_screens.push_back(cl_env_map);
+	}
 #endif
 	if (err)
 		std::cout << cl_help::err::getOpenCLErrorCodeStr(err) << std::endl;
@@ -442,28 +1602,79 @@ int main(int argc, char **argv)
 	// if (err) cout << cl_help::getOpenCLErrorCodeStr(err) << std::endl;
 
 	// radiance
-	cl_screen = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, tex0, &err);
-	cl_screens.push_back(cl_screen);
+	if (HEADLESS)
+	{
+		cl_screen = headless::createRenderTarget(&err, target_width, target_height);
+	}
+#ifndef HEADLESS_ONLY
+	else
+	{
+		cl_screen = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, tex0, &err);
+		cl_screens.push_back(cl_screen);
+	}
+#endif
 	if (err)
 		std::cout << cl_help::err::getOpenCLErrorCodeStr(err) << std::endl;
 
 	//
-	cl_flattenI = cl::Buffer(context, CL_MEM_READ_WRITE, window_width * window_height * RayI_size);
+	// structure of arrays, cleared once, later resets only bump the epoch
+	cl_flattenI = cl::Buffer(context, CL_MEM_READ_WRITE, target_width * target_height * PATH_STATE_SIZE);
+	queue.enqueueFillBuffer(cl_flattenI, 0, 0, target_width * target_height * PATH_STATE_SIZE);
+	// completed + in-flight paths (64 bit) and the path state's epoch
+	cl_sample_count = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint4));
+	queue.enqueueFillBuffer(cl_sample_count, cl_uint4{{0, 0, path_epoch, 0}}, 0, sizeof(cl_uint4));
+	// next pixel handed out to the persistent threads
+	cl_work_counter = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint2));
+	if (ADAPTIVE_THRESHOLD > 0.0f)
+	{
+		cl_active_mask = cl::Buffer(context, CL_MEM_READ_WRITE, window_width * window_height * sizeof(cl_uchar));
+		cl_active_pixels = cl::Buffer(context, CL_MEM_READ_WRITE, window_width * window_height * sizeof(cl_uint));
+	}
+	// 64-bit counters and stack high-water marks, accumulated over the whole run
+	if (RAY_STATS)
+	{
+		cl_ray_stats = cl::Buffer(context, CL_MEM_READ_WRITE, RAY_STATS_SIZE * sizeof(cl_uint));
+		queue.enqueueFillBuffer(cl_ray_stats, 0, 0, RAY_STATS_SIZE * sizeof(cl_uint));
+	}
 
 	// intitialise the kernel
 	initCLKernel();
 
-	// every pixel in the image has its own thread or "work item",
-	// so the total amount of work items equals the number of pixels
-	local_work_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+	if (WAVEFRONT)
+		initWavefront();
+
+	initWorkSize(target_width * target_height);
+
+	// the persistent, tiled and wavefront kernels hand out pixels themselves
+	if (AUTOTUNE && !WAVEFRONT && !PERSISTENT_SPP && !TILE_SIZE && !MULTI_DEVICE)
+		tuneWorkGroups();
 
-	// Ensure the global work size is a multiple of local work size
-	if (global_work_size % local_work_size != 0)
-		global_work_size = (global_work_size / local_work_size + 1) * local_work_size;
+	ray_statistics.start();
+
+	if (HEADLESS)
+	{
+		if (MULTI_DEVICE)
+			renderMultiDevice();
+		else if (TILE_SIZE)
+			renderTiled(target_width, target_height);
+		else
+			renderHeadless(controller);
+		reportRayStats();
+#ifdef PROFILING
+		profiler.report(profile_filepath);
+#endif
+		return 0;
+	}
+
+#ifndef HEADLESS_ONLY
+	scene_watcher = std::make_unique<SceneWatcher>(scene_filepath);
 
 	// render loop
+	controller.start();
 	while (!glfwWindowShouldClose(window))
 	{
+		reloadScene();
+		animateScene();
 		render();
 
 		// swap front and back buffers
@@ -477,9 +1688,22 @@ int main(int argc, char **argv)
 			saveImage();
 			render_to_file = false;
 		}
+
+		// a batch job exits once it's done
+		if (controller.hasTarget() && renderDone(controller))
+		{
+			finishRender(controller);
+			break;
+		}
 	}
 
+	reportRayStats();
+#ifdef PROFILING
+	profiler.report(profile_filepath);
+#endif
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
+#endif
 	return 0;
 }